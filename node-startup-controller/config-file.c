@@ -0,0 +1,158 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+
+#include <dlt/dlt.h>
+
+#include <node-startup-controller/config-file.h>
+
+
+
+/**
+ * SECTION: config-file
+ * @title: Configuration file
+ * @short_description: Access to the runtime configuration of the Node Startup Controller.
+ * @stability: Internal
+ *
+ * The Node Startup Controller reads optional tuning parameters from a #GKeyFile at
+ * start-up. The file location is defined by the environment variable
+ * %NODE_STARTUP_CONTROLLER_CONFIG or, if it is not set, by the build-time definition of
+ * %CONFIG_PATH. A missing configuration file is not an error; all components fall back
+ * to their built-in defaults in that case.
+ */
+
+
+
+DLT_IMPORT_CONTEXT (controller_context);
+
+
+
+/**
+ * config_file_load:
+ *
+ * Loads the configuration file of the Node Startup Controller.
+ *
+ * Returns: A #GKeyFile with the contents of the configuration file. If the file does
+ * not exist or cannot be parsed, an empty #GKeyFile is returned. Free it with
+ * g_key_file_free().
+ */
+GKeyFile *
+config_file_load (void)
+{
+  const gchar *config_path;
+  GKeyFile    *key_file;
+  GError      *error = NULL;
+
+  /* check which configuration file to use; the NODE_STARTUP_CONTROLLER_CONFIG
+   * environment variable has priority over the build-time CONFIG_PATH definition */
+  config_path = g_getenv ("NODE_STARTUP_CONTROLLER_CONFIG");
+  if (config_path == NULL)
+    config_path = CONFIG_PATH;
+
+  key_file = g_key_file_new ();
+  if (!g_key_file_load_from_file (key_file, config_path, G_KEY_FILE_NONE, &error))
+    {
+      /* only complain if the file exists but could not be loaded */
+      if (error->domain != G_FILE_ERROR || error->code != G_FILE_ERROR_NOENT)
+        {
+          DLT_LOG (controller_context, DLT_LOG_WARN,
+                   DLT_STRING ("Failed to load the configuration file:"),
+                   DLT_STRING ("path"), DLT_STRING (config_path),
+                   DLT_STRING ("error message"), DLT_STRING (error->message));
+        }
+      g_error_free (error);
+    }
+
+  return key_file;
+}
+
+
+
+/**
+ * config_file_get_integer:
+ * @key_file: A #GKeyFile returned by config_file_load().
+ * @group: The group to look up the @key in.
+ * @key: The key to look up.
+ * @default_value: The value to return if @key is not set or invalid.
+ *
+ * Looks up an integer value in the configuration.
+ *
+ * Returns: The integer value of @key in @group, or @default_value.
+ */
+gint
+config_file_get_integer (GKeyFile    *key_file,
+                         const gchar *group,
+                         const gchar *key,
+                         gint         default_value)
+{
+  GError *error = NULL;
+  gint    value;
+
+  g_return_val_if_fail (key_file != NULL, default_value);
+  g_return_val_if_fail (group != NULL && key != NULL, default_value);
+
+  value = g_key_file_get_integer (key_file, group, key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return value;
+}
+
+
+
+/**
+ * config_file_get_boolean:
+ * @key_file: A #GKeyFile returned by config_file_load().
+ * @group: The group to look up the @key in.
+ * @key: The key to look up.
+ * @default_value: The value to return if @key is not set or invalid.
+ *
+ * Looks up a boolean value in the configuration.
+ *
+ * Returns: The boolean value of @key in @group, or @default_value.
+ */
+gboolean
+config_file_get_boolean (GKeyFile    *key_file,
+                         const gchar *group,
+                         const gchar *key,
+                         gboolean     default_value)
+{
+  gboolean value;
+  GError  *error = NULL;
+
+  g_return_val_if_fail (key_file != NULL, default_value);
+  g_return_val_if_fail (group != NULL && key != NULL, default_value);
+
+  value = g_key_file_get_boolean (key_file, group, key, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return default_value;
+    }
+
+  return value;
+}
@@ -0,0 +1,39 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifndef __CONFIG_FILE_H__
+#define __CONFIG_FILE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+GKeyFile *config_file_load        (void) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gint      config_file_get_integer (GKeyFile    *key_file,
+                                   const gchar *group,
+                                   const gchar *key,
+                                   gint         default_value);
+gboolean  config_file_get_boolean (GKeyFile    *key_file,
+                                   const gchar *group,
+                                   const gchar *key,
+                                   gboolean     default_value);
+
+G_END_DECLS
+
+#endif /* !__CONFIG_FILE_H__ */
@@ -24,8 +24,12 @@
 #include <glib-object.h>
 #include <gio/gio.h>
 
+#include <dlt/dlt.h>
+
+#include <node-startup-controller/config-file.h>
 #include <node-startup-controller/job-manager.h>
 #include <node-startup-controller/systemd-manager-dbus.h>
+#include <node-startup-controller/systemd-transport.h>
 
 
 
@@ -49,11 +53,109 @@
  * 
  * The #JobManager finds out that a job has finished by listening to "JobRemoved" signals
  * from systemd and looking for that job by its job name.
+ *
+ * Requests for the same unit are coalesced and ordered. A request to start or stop a
+ * unit that is already being started or stopped, respectively, does not create
+ * another job in systemd; the caller is subscribed to the job in flight instead and
+ * notified together with all other subscribers when it finishes. A request that
+ * conflicts with the job in flight, e.g. stopping a unit that is still being started,
+ * is queued and only sent to systemd once the job in flight has finished, so requests
+ * for a unit always take effect in the order in which they were made. Cancelling the
+ * #GCancellable of a request unsubscribes its caller, who is notified with a
+ * %G_IO_ERROR_CANCELLED error, while the job itself keeps running for the others.
+ * Only when the last subscriber is gone is the job cancelled, see below.
+ *
+ * A job may finish before the reply to the StartUnit or StopUnit call that created it
+ * has been processed, in which case its "JobRemoved" signal arrives before the job is
+ * known. While such calls are outstanding, the #JobManager therefore buffers
+ * "JobRemoved" signals of unknown jobs and finishes a job right away if its removal
+ * has been buffered when the reply arrives. The buffer holds at most
+ * %JOB_MANAGER_MAX_EARLY_REMOVALS entries, each for at most
+ * %JOB_MANAGER_EARLY_REMOVAL_TIMEOUT seconds. The number of jobs finished this way
+ * is available in the "early-removals" property.
+ *
+ * Whole sets of units can be started or stopped with job_manager_start_many() and
+ * job_manager_stop_many(). All the StartUnit or StopUnit calls of such a batch are
+ * sent to systemd back to back without waiting for any of the replies, so the batch
+ * costs roughly one D-Bus round trip instead of one per unit. The @callback is called
+ * for each unit of the batch as its job finishes, and the @batch_callback once all of
+ * them have finished.
+ *
+ * Every request may choose the systemd job mode its job is created with, e.g. "replace"
+ * to replace a conflicting job queued in systemd, or "ignore-dependencies" to keep the
+ * transaction systemd has to compute small. Requests that do not choose a mode use
+ * %JOB_MANAGER_DEFAULT_MODE. Requests are only coalesced with a job in flight that uses
+ * the same mode and, for transient units, wants the same units; a request that
+ * differs in either is queued behind it.
+ *
+ * A whole set of units can also be started with a single job through
+ * job_manager_start_transient(). It asks systemd to create a transient unit, usually a
+ * target, that wants and is ordered after all the units and starts it. systemd then
+ * computes one transaction for all the units, and the #JobManager only has to wait for
+ * one job. Since the job of a unit that is merely wanted may fail without failing the
+ * transient unit, callers that care about the individual units have to check their
+ * states once the job has finished.
+ *
+ * Each job sent to systemd is given the "job-timeout" to finish. A job that misses it
+ * is cancelled in systemd and finishes with the result "timeout". Jobs that finish with
+ * the result "failed" or "timeout" are sent to systemd again up to "max-retries" times,
+ * waiting "retry-delay" milliseconds before the first retry and twice as long before
+ * each further one. The retry of a job that has timed out also waits until systemd has
+ * replied to its cancellation. Calls that systemd refuses, e.g. because the unit does
+ * not exist or the caller is not allowed to start it, are not retried; only errors
+ * that may go away, like a missing reply, a closed connection or a conflicting job that
+ * is still queued, are. These properties are initialized from the %JobTimeout,
+ * %MaxRetries and %RetryDelay keys in the %JobManager group of the configuration file.
+ *
+ * When all subscribers of a job have cancelled their requests, the job is cancelled in
+ * systemd as well: a start job is revoked by stopping the unit in "replace" mode, which
+ * also stops whatever the job has started already, and a stop job is cancelled with the
+ * Cancel method of the systemd job. If the job is not known yet because the reply to its
+ * StartUnit or StopUnit call is still awaited, it is cancelled when the reply arrives.
+ *
+ * If the connection to systemd hiccups or systemd is re-executed, "JobRemoved" signals
+ * may be lost and the jobs they belong to would never finish. The #JobManager therefore
+ * reconciles its jobs with the jobs systemd still knows about, using the ListJobs
+ * method. Jobs that have vanished from systemd are finished with the result
+ * %JOB_MANAGER_RESULT_VANISHED. This happens every "reconcile-interval" milliseconds
+ * while there are jobs, whenever systemd reappears on the bus, and whenever
+ * job_manager_reconcile() is called. The "reconcile-interval" property is initialized
+ * from the %ReconcileInterval key in the %JobManager group of the configuration file.
+ *
+ * systemd closes its private socket when it is re-executed, and a peer-to-peer
+ * connection has no bus daemon to tell about systemd reappearing. When the connection
+ * of its #SystemdManager is closed, the #JobManager therefore connects to systemd again
+ * with systemd_transport_connect(), which falls back to the system bus if the private
+ * socket is not available yet, and retries every %JOB_MANAGER_RECONNECT_DELAY
+ * milliseconds until it succeeds. The new #SystemdManager replaces the old one in the
+ * "systemd-manager" property, is subscribed to and the jobs are reconciled with it.
+ * A #SystemdManager can also be replaced with job_manager_set_systemd_manager().
  */
 
 
 
-typedef struct _JobManagerJob JobManagerJob;
+/* limits of the buffer of early "JobRemoved" signals */
+#define JOB_MANAGER_MAX_EARLY_REMOVALS    64
+#define JOB_MANAGER_EARLY_REMOVAL_TIMEOUT 10
+
+/* maximum number of times the retry delay is doubled */
+#define JOB_MANAGER_MAX_RETRY_BACKOFF     10
+
+/* milliseconds between two attempts to reconnect to systemd */
+#define JOB_MANAGER_RECONNECT_DELAY       1000
+
+
+
+DLT_IMPORT_CONTEXT (controller_context);
+
+
+
+typedef struct _JobManagerBatch      JobManagerBatch;
+typedef struct _JobManagerJob        JobManagerJob;
+typedef struct _JobManagerReconcile  JobManagerReconcile;
+typedef struct _JobManagerRemoval    JobManagerRemoval;
+typedef struct _JobManagerRevoke     JobManagerRevoke;
+typedef struct _JobManagerSubscriber JobManagerSubscriber;
 
 
 
@@ -63,43 +165,118 @@ enum
   PROP_0,
   PROP_CONNECTION,
   PROP_SYSTEMD_MANAGER,
+  PROP_EARLY_REMOVALS,
+  PROP_JOB_TIMEOUT,
+  PROP_MAX_RETRIES,
+  PROP_RETRY_DELAY,
+  PROP_RECONCILE_INTERVAL,
 };
 
 
 
-static void           job_manager_constructed      (GObject           *object);
-static void           job_manager_finalize         (GObject           *object);
-static void           job_manager_get_property     (GObject           *object,
-                                                    guint              prop_id,
-                                                    GValue            *value,
-                                                    GParamSpec        *pspec);
-static void           job_manager_set_property     (GObject           *object,
-                                                    guint              prop_id,
-                                                    const GValue      *value,
-                                                    GParamSpec        *pspec);
-static void           job_manager_start_unit_reply (GObject           *object,
-                                                    GAsyncResult      *result,
-                                                    gpointer           user_data);
-static void           job_manager_stop_unit_reply  (GObject           *object,
-                                                    GAsyncResult      *result,
-                                                    gpointer           user_data);
-static void           job_manager_job_removed      (SystemdManager    *systemd_manager,
-                                                    guint              id,
-                                                    const gchar       *job_name,
-                                                    const gchar       *unit,
-                                                    const gchar       *result,
-                                                    JobManager        *job_manager);
-static JobManagerJob *job_manager_job_new          (JobManager        *manager,
-                                                    const gchar       *unit,
-                                                    GCancellable      *cancellable,
-                                                    JobManagerCallback callback,
-                                                    gpointer           user_data);
-static void           job_manager_job_unref        (JobManagerJob     *job);
-static void           job_manager_remember_job     (JobManager        *manager,
-                                                    const gchar       *job_name,
-                                                    JobManagerJob     *job);
-static void           job_manager_forget_job       (JobManager        *manager,
-                                                    const gchar       *job_name);
+static void           job_manager_constructed            (GObject                *object);
+static void           job_manager_finalize               (GObject                *object);
+static void           job_manager_get_property           (GObject                *object,
+                                                          guint                   prop_id,
+                                                          GValue                 *value,
+                                                          GParamSpec             *pspec);
+static void           job_manager_set_property           (GObject                *object,
+                                                          guint                   prop_id,
+                                                          const GValue           *value,
+                                                          GParamSpec             *pspec);
+static void           job_manager_start_unit_reply       (GObject                *object,
+                                                          GAsyncResult           *result,
+                                                          gpointer                user_data);
+static void           job_manager_stop_unit_reply        (GObject                *object,
+                                                          GAsyncResult           *result,
+                                                          gpointer                user_data);
+static void           job_manager_transient_unit_reply   (GObject                *object,
+                                                          GAsyncResult           *result,
+                                                          gpointer                user_data);
+static void           job_manager_job_created            (JobManagerJob          *job,
+                                                          const gchar            *job_name);
+static void           job_manager_job_removed            (SystemdManager         *systemd_manager,
+                                                          guint                   id,
+                                                          const gchar            *job_name,
+                                                          const gchar            *unit,
+                                                          const gchar            *result,
+                                                          JobManager             *job_manager);
+static void           job_manager_request                (JobManager             *manager,
+                                                          const gchar            *unit,
+                                                          gboolean                start,
+                                                          const gchar            *mode,
+                                                          const gchar *const     *wants,
+                                                          GCancellable           *cancellable,
+                                                          JobManagerCallback      callback,
+                                                          gpointer                user_data,
+                                                          JobManagerBatch        *batch);
+static JobManagerJob *job_manager_job_new                (JobManager             *manager,
+                                                          const gchar            *unit,
+                                                          gboolean                start,
+                                                          const gchar            *mode,
+                                                          const gchar *const     *wants);
+static gboolean       job_manager_job_matches            (JobManagerJob          *job,
+                                                          gboolean                start,
+                                                          const gchar            *mode,
+                                                          const gchar *const     *wants);
+static void           job_manager_job_submit             (JobManagerJob          *job);
+static gboolean       job_manager_job_timeout_expired    (gpointer                user_data);
+static gboolean       job_manager_job_retry              (gpointer                user_data);
+static void           job_manager_job_finish             (JobManagerJob          *job,
+                                                          const gchar            *result,
+                                                          GError                 *error);
+static void           job_manager_job_complete           (JobManagerJob          *job,
+                                                          const gchar            *result,
+                                                          GError                 *error);
+static void           job_manager_job_abort              (JobManagerJob          *job);
+static void           job_manager_job_revoke             (JobManagerJob          *job);
+static void           job_manager_job_revoke_reply       (GObject                *object,
+                                                          GAsyncResult           *result,
+                                                          gpointer                user_data);
+static void           job_manager_job_free               (JobManagerJob          *job);
+static gboolean       job_manager_error_is_transient     (GError                 *error);
+static void           job_manager_subscriber_cancelled   (GCancellable           *cancellable,
+                                                          JobManagerSubscriber   *subscriber);
+static gboolean       job_manager_subscriber_cancel_idle (gpointer                user_data);
+static void           job_manager_subscriber_finish      (JobManagerSubscriber   *subscriber,
+                                                          const gchar            *result,
+                                                          GError                 *error);
+static void           job_manager_remember_job           (JobManager             *manager,
+                                                          const gchar            *job_name,
+                                                          JobManagerJob          *job);
+static void           job_manager_forget_job             (JobManager             *manager,
+                                                          const gchar            *job_name);
+static void           job_manager_buffer_removal         (JobManager             *manager,
+                                                          const gchar            *job_name,
+                                                          const gchar            *result);
+static void           job_manager_removal_free           (JobManagerRemoval      *removal);
+static void           job_manager_watch_systemd          (JobManager             *manager);
+static void           job_manager_unwatch_systemd        (JobManager             *manager);
+static void           job_manager_connection_closed      (GDBusConnection        *connection,
+                                                          gboolean                remote_peer_vanished,
+                                                          GError                 *error,
+                                                          JobManager             *manager);
+static gboolean       job_manager_reconnect              (gpointer                user_data);
+static void           job_manager_name_owner_changed     (GObject                *object,
+                                                          GParamSpec             *pspec,
+                                                          JobManager             *manager);
+static void           job_manager_subscribe_reply        (GObject                *object,
+                                                          GAsyncResult           *result,
+                                                          gpointer                user_data);
+static void           job_manager_schedule_reconcile     (JobManager             *manager);
+static gboolean       job_manager_reconcile_timeout      (gpointer                user_data);
+static void           job_manager_list_jobs_reply        (GObject                *object,
+                                                          GAsyncResult           *result,
+                                                          gpointer                user_data);
+static void           job_manager_submit_many            (JobManager             *manager,
+                                                          gboolean                start,
+                                                          const gchar *const     *units,
+                                                          const gchar *const     *modes,
+                                                          gpointer               *unit_data,
+                                                          GCancellable           *cancellable,
+                                                          JobManagerCallback      callback,
+                                                          JobManagerBatchCallback batch_callback,
+                                                          gpointer                user_data);
 
 
 
@@ -115,16 +292,115 @@ struct _JobManager
   GDBusConnection *connection;
   SystemdManager  *systemd_manager;
 
+  /* jobs created in systemd by their job names */
   GHashTable      *jobs;
+
+  /* queues of the jobs for each unit; the head of each queue is the
+   * job in flight, the others wait for it to finish */
+  GHashTable      *units;
+
+  /* number of StartUnit and StopUnit calls waiting for a reply */
+  guint            n_pending_calls;
+
+  /* "JobRemoved" signals received before the job was known, in the order
+   * of their arrival and by job name */
+  GQueue          *removals;
+  GHashTable      *removals_by_name;
+  guint64          n_early_removals;
+
+  /* milliseconds a job may take before it is cancelled, or 0, and how
+   * often and after how many milliseconds a failed job is retried */
+  guint            job_timeout;
+  guint            max_retries;
+  guint            retry_delay;
+
+  /* milliseconds between two reconciliations with the jobs in systemd, or
+   * 0, the source ID of the next one and whether one is in progress */
+  guint            reconcile_interval;
+  guint            reconcile_id;
+  gboolean         reconciling;
+
+  /* the source ID of the next attempt to reconnect to systemd */
+  guint            reconnect_id;
+};
+
+struct _JobManagerBatch
+{
+  JobManager             *manager;
+  guint                   n_jobs;
+  guint                   n_finished;
+  guint                   n_failed;
+  JobManagerBatchCallback callback;
+  gpointer                user_data;
+};
+
+struct _JobManagerReconcile
+{
+  JobManager *manager;
+
+  /* names of the jobs known when the jobs were listed */
+  GPtrArray  *job_names;
+};
+
+struct _JobManagerRemoval
+{
+  gchar  *job_name;
+  gchar  *result;
+  gint64  time;
+};
+
+struct _JobManagerRevoke
+{
+  /* the job whose retry waits for the revocation, or NULL once it is gone */
+  JobManagerJob *job;
+  gchar         *unit;
 };
 
 struct _JobManagerJob
 {
-  JobManager        *manager;
-  gchar             *unit;
+  JobManager *manager;
+  gchar      *unit;
+  gboolean    start;
+
+  /* the systemd job mode, e.g. "fail" or "replace" */
+  gchar      *mode;
+
+  /* the units wanted by the transient unit to create, or NULL if the
+   * unit already exists */
+  gchar     **wants;
+
+  /* name of the job in systemd, once it is known */
+  gchar      *job_name;
+
+  /* the requests waiting for this job to finish */
+  GList      *subscribers;
+
+  /* source IDs of the deadline of the current attempt and of the pending
+   * retry, and the number of retries so far */
+  guint       timeout_id;
+  guint       retry_id;
+  guint       attempt;
+
+  /* the revocation of the previous attempt that is still being sent to
+   * systemd, and whether the retry is due and only waits for it */
+  JobManagerRevoke *revoke;
+  gboolean          retry_waiting;
+
+  /* whether the current attempt has missed its deadline, and whether the
+   * job has been given up by all its subscribers */
+  gboolean    timed_out;
+  gboolean    cancelled;
+};
+
+struct _JobManagerSubscriber
+{
+  JobManagerJob     *job;
   GCancellable      *cancellable;
+  gulong             cancelled_id;
+  guint              cancel_id;
   JobManagerCallback callback;
   gpointer           user_data;
+  JobManagerBatch   *batch;
 };
 
 
@@ -163,6 +439,56 @@ job_manager_class_init (JobManagerClass *klass)
                                                         G_PARAM_READWRITE |
                                                         G_PARAM_CONSTRUCT_ONLY |
                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_EARLY_REMOVALS,
+                                   g_param_spec_uint64 ("early-removals",
+                                                        "early-removals",
+                                                        "early-removals",
+                                                        0, G_MAXUINT64, 0,
+                                                        G_PARAM_READABLE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_JOB_TIMEOUT,
+                                   g_param_spec_uint ("job-timeout",
+                                                      "job-timeout",
+                                                      "Milliseconds after which a job"
+                                                      " is cancelled, or 0",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_MAX_RETRIES,
+                                   g_param_spec_uint ("max-retries",
+                                                      "max-retries",
+                                                      "Number of times a failed or"
+                                                      " timed out job is retried",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_RETRY_DELAY,
+                                   g_param_spec_uint ("retry-delay",
+                                                      "retry-delay",
+                                                      "Milliseconds before the first"
+                                                      " retry of a job",
+                                                      0, G_MAXUINT, 1000,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_RECONCILE_INTERVAL,
+                                   g_param_spec_uint ("reconcile-interval",
+                                                      "reconcile-interval",
+                                                      "Milliseconds between two"
+                                                      " reconciliations with the jobs"
+                                                      " in systemd, or 0",
+                                                      0, G_MAXUINT, 30000,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
 }
 
 
@@ -170,11 +496,35 @@ job_manager_class_init (JobManagerClass *klass)
 static void
 job_manager_init (JobManager *manager)
 {
-  /* create a mapping of systemd job names to job objects; we will use this
-   * to remember jobs that we started */
-  manager->jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
-                                        (GDestroyNotify) job_manager_job_unref);
+  GKeyFile *config;
 
+  /* create a mapping of systemd job names to job objects; we will use this
+   * to remember jobs that we started. the jobs are owned by the queues of
+   * their units */
+  manager->jobs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  /* create a mapping of unit names to the queues of their jobs */
+  manager->units = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify) g_queue_free);
+
+  /* create the buffer for "JobRemoved" signals that arrive before the job is
+   * known; the queue owns the removals */
+  manager->removals = g_queue_new ();
+  manager->removals_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
+  /* read the job deadline and the retry policy from the configuration */
+  config = config_file_load ();
+  manager->job_timeout =
+    MAX (config_file_get_integer (config, "JobManager", "JobTimeout", 0), 0);
+  manager->max_retries =
+    MAX (config_file_get_integer (config, "JobManager", "MaxRetries", 0), 0);
+  manager->retry_delay =
+    MAX (config_file_get_integer (config, "JobManager", "RetryDelay", 1000), 0);
+
+  /* read how often to reconcile the jobs with systemd from the configuration */
+  manager->reconcile_interval =
+    MAX (config_file_get_integer (config, "JobManager", "ReconcileInterval", 30000), 0);
+  g_key_file_free (config);
 }
 
 
@@ -184,16 +534,29 @@ job_manager_finalize (GObject *object)
 {
   JobManager *manager = JOB_MANAGER (object);
 
-  /* release all the jobs we have remembered */
+  /* drop the next reconciliation */
+  if (manager->reconcile_id > 0)
+    g_source_remove (manager->reconcile_id);
+
+  /* drop the next attempt to reconnect to systemd */
+  if (manager->reconnect_id > 0)
+    g_source_remove (manager->reconnect_id);
+
+  /* release all the jobs we have remembered; jobs keep the manager alive, so
+   * there are none left at this point */
   g_hash_table_unref (manager->jobs);
+  g_hash_table_unref (manager->units);
+
+  /* release the buffered removals */
+  g_hash_table_unref (manager->removals_by_name);
+  g_queue_foreach (manager->removals, (GFunc) job_manager_removal_free, NULL);
+  g_queue_free (manager->removals);
 
   /* release the D-Bus connection */
   g_object_unref (manager->connection);
 
   /* release the systemd manager */
-  g_signal_handlers_disconnect_matched (manager->systemd_manager,
-                                        G_SIGNAL_MATCH_DATA,
-                                        0, 0, NULL, NULL, manager);
+  job_manager_unwatch_systemd (manager);
   g_object_unref (manager->systemd_manager);
 
   /* chain up to finalize parent class */
@@ -207,10 +570,7 @@ job_manager_constructed (GObject *object)
 {
   JobManager *manager = JOB_MANAGER (object);
 
-  /* connect to systemd's "JobRemoved" signal so that we are notified
-   * whenever a job is finished */
-  g_signal_connect (manager->systemd_manager, "job-removed",
-                    G_CALLBACK (job_manager_job_removed), manager);
+  job_manager_watch_systemd (manager);
 }
 
 
@@ -231,6 +591,21 @@ job_manager_get_property (GObject    *object,
     case PROP_SYSTEMD_MANAGER:
       g_value_set_object (value, manager->systemd_manager);
       break;
+    case PROP_EARLY_REMOVALS:
+      g_value_set_uint64 (value, manager->n_early_removals);
+      break;
+    case PROP_JOB_TIMEOUT:
+      g_value_set_uint (value, manager->job_timeout);
+      break;
+    case PROP_MAX_RETRIES:
+      g_value_set_uint (value, manager->max_retries);
+      break;
+    case PROP_RETRY_DELAY:
+      g_value_set_uint (value, manager->retry_delay);
+      break;
+    case PROP_RECONCILE_INTERVAL:
+      g_value_set_uint (value, manager->reconcile_interval);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -255,6 +630,24 @@ job_manager_set_property (GObject      *object,
     case PROP_SYSTEMD_MANAGER:
       manager->systemd_manager = g_value_dup_object (value);
       break;
+    case PROP_JOB_TIMEOUT:
+      manager->job_timeout = g_value_get_uint (value);
+      break;
+    case PROP_MAX_RETRIES:
+      manager->max_retries = g_value_get_uint (value);
+      break;
+    case PROP_RETRY_DELAY:
+      manager->retry_delay = g_value_get_uint (value);
+      break;
+    case PROP_RECONCILE_INTERVAL:
+      manager->reconcile_interval = g_value_get_uint (value);
+      if (manager->reconcile_id > 0)
+        {
+          g_source_remove (manager->reconcile_id);
+          manager->reconcile_id = 0;
+        }
+      job_manager_schedule_reconcile (manager);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -276,23 +669,22 @@ job_manager_start_unit_reply (GObject       *object,
   g_return_if_fail (G_IS_ASYNC_RESULT (result));
   g_return_if_fail (user_data != NULL);
 
+  job->manager->n_pending_calls--;
+
   /* finish the start unit call */
-  if (!systemd_manager_call_start_unit_finish (job->manager->systemd_manager,
+  if (!systemd_manager_call_start_unit_finish (SYSTEMD_MANAGER (object),
                                                &job_name, result, &error))
     {
-      /* there was an error. notify the caller */
-      job->callback (job->manager, job->unit, "failed", error, job->user_data);
+      /* there was an error. retry the job or finish it and notify the callers */
+      job_manager_job_finish (job, "failed", error);
       g_error_free (error);
       g_free (job_name);
-
-      /* finish the job immediately */
-      job_manager_job_unref (job);
     }
   else
     {
-      /* remember the job so that we can finish it in the "job-removed" signal handler.
-       * the service takes ownership of the job so we don't need to unref it here */
-      job_manager_remember_job (job->manager, job_name, job);
+      /* finish the job or wait for it to be removed */
+      job_manager_job_created (job, job_name);
+      g_free (job_name);
     }
 }
 
@@ -311,23 +703,109 @@ job_manager_stop_unit_reply (GObject       *object,
   g_return_if_fail (G_IS_ASYNC_RESULT (result));
   g_return_if_fail (user_data != NULL);
 
+  job->manager->n_pending_calls--;
+
   /* finish the stop unit call */
-  if (!systemd_manager_call_stop_unit_finish (job->manager->systemd_manager,
+  if (!systemd_manager_call_stop_unit_finish (SYSTEMD_MANAGER (object),
                                               &job_name, result, &error))
     {
-      /* there was an error. notify the caller */
-      job->callback (job->manager, job->unit, "failed", error, job->user_data);
+      /* there was an error. retry the job or finish it and notify the callers */
+      job_manager_job_finish (job, "failed", error);
+      g_error_free (error);
+      g_free (job_name);
+    }
+  else
+    {
+      /* finish the job or wait for it to be removed */
+      job_manager_job_created (job, job_name);
+      g_free (job_name);
+    }
+}
+
+
+
+static void
+job_manager_transient_unit_reply (GObject      *object,
+                                  GAsyncResult *result,
+                                  gpointer      user_data)
+{
+  JobManagerJob *job = user_data;
+  GError        *error = NULL;
+  gchar         *job_name = NULL;
+
+  g_return_if_fail (IS_SYSTEMD_MANAGER (object));
+  g_return_if_fail (G_IS_ASYNC_RESULT (result));
+  g_return_if_fail (user_data != NULL);
+
+  job->manager->n_pending_calls--;
+
+  /* finish the start transient unit call */
+  if (!systemd_manager_call_start_transient_unit_finish (SYSTEMD_MANAGER (object),
+                                                         &job_name, result, &error))
+    {
+      /* there was an error. retry the job or finish it and notify the callers */
+      job_manager_job_finish (job, "failed", error);
       g_error_free (error);
       g_free (job_name);
+    }
+  else
+    {
+      /* finish the job or wait for it to be removed */
+      job_manager_job_created (job, job_name);
+      g_free (job_name);
+    }
+}
+
+
+
+static void
+job_manager_job_created (JobManagerJob *job,
+                         const gchar   *job_name)
+{
+  JobManagerRemoval *removal;
+  JobManager        *manager = job->manager;
 
-      /* finish the job immediately */
-      job_manager_job_unref (job);
+  job->job_name = g_strdup (job_name);
+
+  /* check whether the job has been removed before we knew about it */
+  removal = g_hash_table_lookup (manager->removals_by_name, job_name);
+  if (removal != NULL)
+    {
+      manager->n_early_removals++;
+
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("Job finished before it was known:"),
+               DLT_STRING ("job"), DLT_STRING (job_name),
+               DLT_STRING ("unit"), DLT_STRING (job->unit),
+               DLT_STRING ("early removals"), DLT_UINT64 (manager->n_early_removals));
+
+      /* the removal is consumed by this job */
+      g_hash_table_remove (manager->removals_by_name, job_name);
+      g_queue_remove (manager->removals, removal);
+
+      /* finish the job right away */
+      g_object_ref (manager);
+      job_manager_job_finish (job, removal->result, NULL);
+      job_manager_removal_free (removal);
+      g_object_notify (G_OBJECT (manager), "early-removals");
+      g_object_unref (manager);
+    }
+  else if (job->cancelled)
+    {
+      /* all subscribers have given up the job while the call was in flight */
+      job_manager_job_revoke (job);
+      job_manager_job_complete (job, "canceled", NULL);
+    }
+  else if (job->timed_out)
+    {
+      /* the deadline of the job expired while the call was in flight */
+      job_manager_job_revoke (job);
+      job_manager_job_finish (job, "timeout", NULL);
     }
   else
     {
-      /* remember the job so that we can finish it in the "job-removed" signal handler.
-       * the service takes ownership of the job so we don't need to unref it here */
-      job_manager_remember_job (job->manager, job_name, job);
+      /* remember the job so that we can finish it in the "job-removed" signal handler */
+      job_manager_remember_job (manager, job_name, job);
     }
 }
 
@@ -352,179 +830,1267 @@ job_manager_job_removed (SystemdManager *systemd_manager,
   /* look up the remembered job for this job name */
   job = g_hash_table_lookup (job_manager->jobs, job_name);
 
-  /* if no job is found, ignore this job-removed signal */
+  /* if no job is found, it may belong to a call whose reply has not been
+   * processed yet; otherwise ignore this job-removed signal */
   if (job == NULL)
-    return;
-
-  /* finish the job by notifying the caller */
-  job->callback (job_manager, job->unit, result, NULL, job->user_data);
+    {
+      if (job_manager->n_pending_calls > 0)
+        job_manager_buffer_removal (job_manager, job_name, result);
+      return;
+    }
 
   /* forget about this job */
   job_manager_forget_job (job_manager, job_name);
+
+  /* retry the job or finish it by notifying the callers */
+  job_manager_job_finish (job, result, NULL);
+}
+
+
+
+static void
+job_manager_request (JobManager         *manager,
+                     const gchar        *unit,
+                     gboolean            start,
+                     const gchar        *mode,
+                     const gchar *const *wants,
+                     GCancellable       *cancellable,
+                     JobManagerCallback  callback,
+                     gpointer            user_data,
+                     JobManagerBatch    *batch)
+{
+  JobManagerSubscriber *subscriber;
+  JobManagerJob        *job;
+  GQueue               *queue;
+
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (unit != NULL && *unit != '\0');
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  /* look up the jobs for the unit */
+  queue = g_hash_table_lookup (manager->units, unit);
+  if (queue == NULL)
+    {
+      queue = g_queue_new ();
+      g_hash_table_insert (manager->units, g_strdup (unit), queue);
+    }
+
+  /* join the last job for the unit if it does the same in the same way and is
+   * not about to be revoked, otherwise queue a new job behind it; only the job
+   * at the head of the queue is sent to systemd */
+  job = g_queue_peek_tail (queue);
+  if (job != NULL && job_manager_job_matches (job, start, mode, wants)
+      && !job->cancelled && !job->timed_out)
+    {
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("Coalescing job request:"),
+               DLT_STRING ("unit"), DLT_STRING (unit),
+               DLT_STRING ("operation"), DLT_STRING (start ? "start" : "stop"),
+               DLT_STRING ("mode"), DLT_STRING (job->mode));
+    }
+  else
+    {
+      job = job_manager_job_new (manager, unit, start, mode, wants);
+      g_queue_push_tail (queue, job);
+      if (g_queue_get_length (queue) == 1)
+        job_manager_job_submit (job);
+    }
+
+  /* subscribe to the job */
+  subscriber = g_slice_new0 (JobManagerSubscriber);
+  subscriber->job = job;
+  subscriber->callback = callback;
+  subscriber->user_data = user_data;
+  subscriber->batch = batch;
+  job->subscribers = g_list_append (job->subscribers, subscriber);
+
+  /* unsubscribe the caller when the request is cancelled */
+  if (cancellable != NULL)
+    {
+      subscriber->cancellable = g_object_ref (cancellable);
+      if (g_cancellable_is_cancelled (cancellable))
+        {
+          subscriber->cancel_id =
+            g_idle_add (job_manager_subscriber_cancel_idle, subscriber);
+        }
+      else
+        {
+          subscriber->cancelled_id =
+            g_signal_connect (cancellable, "cancelled",
+                              G_CALLBACK (job_manager_subscriber_cancelled),
+                              subscriber);
+        }
+    }
 }
 
 
 
 static JobManagerJob *
-job_manager_job_new (JobManager        *manager,
-                     const gchar       *unit,
-                     GCancellable      *cancellable,
-                     JobManagerCallback callback,
-                     gpointer           user_data)
+job_manager_job_new (JobManager         *manager,
+                     const gchar        *unit,
+                     gboolean            start,
+                     const gchar        *mode,
+                     const gchar *const *wants)
 {
   JobManagerJob *job;
 
   g_return_val_if_fail (IS_JOB_MANAGER (manager), NULL);
-  g_return_val_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable), NULL);
 
   /* allocate a new job struct */
   job = g_slice_new0 (JobManagerJob);
   job->manager = g_object_ref (manager);
-  job->unit = g_strdup(unit);
-  if (cancellable != NULL)
-    job->cancellable = g_object_ref (cancellable);
-  job->callback = callback;
-  job->user_data = user_data;
+  job->unit = g_strdup (unit);
+  job->start = start;
+  job->mode = g_strdup (mode != NULL ? mode : JOB_MANAGER_DEFAULT_MODE);
+  job->wants = g_strdupv ((gchar **) wants);
 
   return job;
 }
 
 
-static void
-job_manager_job_unref (JobManagerJob *job)
+
+static gboolean
+job_manager_job_matches (JobManagerJob      *job,
+                         gboolean            start,
+                         const gchar        *mode,
+                         const gchar *const *wants)
 {
-  if (job == NULL)
-    return;
+  gboolean equal;
+  guint    n;
 
-  /* release all memory and references held by job */
-  if (job->cancellable != NULL)
-    g_object_unref (job->cancellable);
-  g_free (job->unit);
-  g_object_unref (job->manager);
-  g_slice_free (JobManagerJob, job);
+  /* a job only stands in for a request with the same operation and mode, e.g.
+   * an ignore-dependencies start must not join a start in fail mode */
+  if (job->start != start
+      || g_strcmp0 (job->mode, mode != NULL ? mode : JOB_MANAGER_DEFAULT_MODE) != 0)
+    {
+      return FALSE;
+    }
+
+  /* a transient unit only stands in for a request wanting the same units */
+  if (job->wants == NULL || wants == NULL)
+    return job->wants == NULL && wants == NULL;
+
+  equal = TRUE;
+  for (n = 0; equal && (job->wants[n] != NULL || wants[n] != NULL); n++)
+    equal = g_strcmp0 (job->wants[n], wants[n]) == 0;
+
+  return equal;
 }
 
 
 
 static void
-job_manager_remember_job (JobManager    *manager,
-                          const char    *job_name,
-                          JobManagerJob *job)
+job_manager_job_submit (JobManagerJob *job)
 {
-  JobManagerJob *existing_job;
+  GVariantBuilder properties;
+  JobManager     *manager = job->manager;
 
-  g_return_if_fail (IS_JOB_MANAGER (manager));
-  g_return_if_fail (job_name != NULL && *job_name != '\0');
-  g_return_if_fail (job != NULL);
+  /* ask systemd to start or stop the unit asynchronously; the call is not
+   * cancellable because it may be shared by several requests */
+  manager->n_pending_calls++;
+  if (job->wants != NULL)
+    {
+      /* the transient unit wants the units and is only started once they
+       * have been started, so its job covers all of them */
+      g_variant_builder_init (&properties, G_VARIANT_TYPE ("a(sv)"));
+      g_variant_builder_add (&properties, "(sv)", "Wants",
+                             g_variant_new_strv ((const gchar *const *) job->wants, -1));
+      g_variant_builder_add (&properties, "(sv)", "After",
+                             g_variant_new_strv ((const gchar *const *) job->wants, -1));
+      systemd_manager_call_start_transient_unit (manager->systemd_manager,
+                                                 job->unit, job->mode,
+                                                 g_variant_builder_end (&properties),
+                                                 g_variant_new_array (G_VARIANT_TYPE ("(sa(sv))"),
+                                                                      NULL, 0),
+                                                 NULL, job_manager_transient_unit_reply, job);
+    }
+  else if (job->start)
+    {
+      systemd_manager_call_start_unit (manager->systemd_manager, job->unit, job->mode,
+                                       NULL, job_manager_start_unit_reply, job);
+    }
+  else
+    {
+      systemd_manager_call_stop_unit (manager->systemd_manager, job->unit, job->mode,
+                                      NULL, job_manager_stop_unit_reply, job);
+    }
 
-  /* if the job is already being remembered, there is a programming error that should be
-   * notified */
-  existing_job = g_hash_table_lookup (manager->jobs, job_name);
-  if (existing_job != NULL)
+  /* give the job a deadline to finish */
+  if (manager->job_timeout > 0)
     {
-      g_critical ("Trying to remember the same job twice.");
-      return;
+      job->timeout_id =
+        g_timeout_add (manager->job_timeout, job_manager_job_timeout_expired, job);
     }
-  /* associate the job name with the job */
-  g_hash_table_insert (manager->jobs, g_strdup (job_name), job);
 }
 
 
 
-static void
-job_manager_forget_job (JobManager  *manager,
-                        const gchar *job_name)
+static gboolean
+job_manager_job_timeout_expired (gpointer user_data)
 {
-  g_return_if_fail (IS_JOB_MANAGER (manager));
-  g_return_if_fail (job_name != NULL && *job_name != '\0');
+  JobManagerJob *job = user_data;
+  JobManager    *manager = job->manager;
 
-  g_hash_table_remove (manager->jobs, job_name);
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("Job did not finish in time:"),
+           DLT_STRING ("unit"), DLT_STRING (job->unit),
+           DLT_STRING ("operation"), DLT_STRING (job->start ? "start" : "stop"),
+           DLT_STRING ("timeout ms"), DLT_UINT (manager->job_timeout));
+
+  job->timeout_id = 0;
+  job->timed_out = TRUE;
+
+  /* if the job is not known yet, it is cancelled when the reply arrives */
+  if (job->job_name == NULL)
+    return FALSE;
+
+  /* cancel the job in systemd and retry it or notify the callers */
+  job_manager_forget_job (manager, job->job_name);
+  job_manager_job_revoke (job);
+  job_manager_job_finish (job, "timeout", NULL);
+
+  return FALSE;
 }
 
 
-/**
- * job_manager_new:
- * @connection: A connection to the system bus. 
- * @systemd_manager: An interface to the systemd manager created with 
- * systemd_manager_proxy_new_for_bus_sync()
- * 
- * Creates a new JobManager object.
- * 
- * Returns: A new instance of the #JobManager.
- */
-JobManager *
-job_manager_new (GDBusConnection *connection,
-                 SystemdManager  *systemd_manager)
+
+static gboolean
+job_manager_job_retry (gpointer user_data)
 {
-  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), NULL);
-  g_return_val_if_fail (IS_SYSTEMD_MANAGER (systemd_manager), NULL);
+  JobManagerJob *job = user_data;
 
-  return g_object_new (TYPE_JOB_MANAGER,
-                       "connection", connection,
-                       "systemd-manager", systemd_manager,
-                       NULL);
+  job->retry_id = 0;
+
+  /* do not let the retry collide with the revocation of the previous
+   * attempt; it is retried once systemd has replied to that */
+  job->retry_waiting = job->revoke != NULL;
+  if (job->retry_waiting)
+    return FALSE;
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Retrying job:"),
+           DLT_STRING ("unit"), DLT_STRING (job->unit),
+           DLT_STRING ("operation"), DLT_STRING (job->start ? "start" : "stop"),
+           DLT_STRING ("attempt"), DLT_UINT (job->attempt + 1));
+
+  job_manager_job_submit (job);
+
+  return FALSE;
 }
 
 
 
-/**
- * job_manager_start:
- * @unit: The name of the systemd unit to start.
- * @callback: a #JobManagerCallback that is called after the job is started.
- * @user_data: userdata that is available in the #JobManagerCallback.
- * 
- * Asynchronously starts @unit, and calls @callback with @user_data when it is finished.
- */
-void
-job_manager_start (JobManager        *manager,
-                   const gchar       *unit,
-                   GCancellable      *cancellable,
-                   JobManagerCallback callback,
-                   gpointer           user_data)
+static void
+job_manager_job_finish (JobManagerJob *job,
+                        const gchar   *result,
+                        GError        *error)
 {
-  JobManagerJob *job;
+  JobManager *manager = job->manager;
+  guint64     delay;
 
-  g_return_if_fail (IS_JOB_MANAGER (manager));
-  g_return_if_fail (unit != NULL);
-  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
-  g_return_if_fail (callback != NULL);
+  if (job->timeout_id > 0)
+    {
+      g_source_remove (job->timeout_id);
+      job->timeout_id = 0;
+    }
 
-  /* create a new job object */
-  job = job_manager_job_new (manager, unit, cancellable, callback, user_data);
+  /* notify the callers unless the job has failed or timed out and may be
+   * retried for at least one of them; a call refused by systemd, e.g. for a
+   * unit that does not exist, is only retried if the error is transient */
+  if (job->cancelled
+      || job->subscribers == NULL
+      || job->attempt >= manager->max_retries
+      || (error != NULL && !job_manager_error_is_transient (error))
+      || (g_strcmp0 (result, "failed") != 0 && g_strcmp0 (result, "timeout") != 0))
+    {
+      job_manager_job_complete (job, result, error);
+      return;
+    }
 
-  /* ask systemd to start the unit asynchronously */
-  systemd_manager_call_start_unit (manager->systemd_manager, unit, "fail", cancellable,
-                                   job_manager_start_unit_reply, job);
+  /* double the delay with every retry */
+  delay = (guint64) manager->retry_delay << MIN (job->attempt, JOB_MANAGER_MAX_RETRY_BACKOFF);
+  job->attempt++;
+
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("Job did not succeed, retrying:"),
+           DLT_STRING ("unit"), DLT_STRING (job->unit),
+           DLT_STRING ("result"), DLT_STRING (result),
+           DLT_STRING ("retry"), DLT_UINT (job->attempt),
+           DLT_STRING ("of"), DLT_UINT (manager->max_retries),
+           DLT_STRING ("delay ms"), DLT_UINT64 (delay));
+
+  /* the job stays at the head of the queue of its unit until it is retried */
+  g_free (job->job_name);
+  job->job_name = NULL;
+  job->timed_out = FALSE;
+  job->retry_id = g_timeout_add (MIN (delay, G_MAXUINT), job_manager_job_retry, job);
 }
 
 
 
-/**
- * job_manager_stop:
- * @unit: The name of the systemd unit to stop.
- * @callback: a #JobManagerCallback that is called after the job is stopped.
- * @user_data: userdata that is available in the #JobManagerCallback.
- * 
- * Asynchronously stops @unit, and calls @callback with @user_data when it is finished.
- */
-void
-job_manager_stop (JobManager        *manager,
-                  const gchar       *unit,
-                  GCancellable      *cancellable,
-                  JobManagerCallback callback,
-                  gpointer           user_data)
+static void
+job_manager_job_complete (JobManagerJob *job,
+                          const gchar   *result,
+                          GError        *error)
 {
-  JobManagerJob *job;
+  JobManagerSubscriber *subscriber;
+  JobManager           *manager = g_object_ref (job->manager);
+  GQueue               *queue;
+  GList                *subscribers;
+  GList                *lp;
+
+  /* take the job out of the queue of its unit and send the next job for
+   * the unit to systemd, if there is one; only the job at the head of the
+   * queue can complete */
+  queue = g_hash_table_lookup (manager->units, job->unit);
+  g_queue_pop_head (queue);
+  if (g_queue_is_empty (queue))
+    g_hash_table_remove (manager->units, job->unit);
+  else
+    job_manager_job_submit (g_queue_peek_head (queue));
 
-  g_return_if_fail (IS_JOB_MANAGER (manager));
+  /* notify all subscribers of the job */
+  subscribers = job->subscribers;
+  job->subscribers = NULL;
+  for (lp = subscribers; lp != NULL; lp = lp->next)
+    {
+      subscriber = lp->data;
+      job_manager_subscriber_finish (subscriber, result, error);
+    }
+  g_list_free (subscribers);
+
+  job_manager_job_free (job);
+  g_object_unref (manager);
+}
+
+
+
+static void
+job_manager_job_abort (JobManagerJob *job)
+{
+  JobManager *manager = job->manager;
+  GQueue     *queue;
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Cancelling job:"),
+           DLT_STRING ("unit"), DLT_STRING (job->unit),
+           DLT_STRING ("operation"), DLT_STRING (job->start ? "start" : "stop"));
+
+  /* a job waiting behind the job in flight has not been sent to systemd yet */
+  queue = g_hash_table_lookup (manager->units, job->unit);
+  if (g_queue_peek_head (queue) != job)
+    {
+      g_queue_remove (queue, job);
+      job_manager_job_free (job);
+      return;
+    }
+
+  job->cancelled = TRUE;
+
+  /* if the call is still in flight, the job is cancelled when the reply arrives */
+  if (job->job_name == NULL && job->retry_id == 0 && !job->retry_waiting)
+    return;
+
+  /* cancel the job in systemd, unless it is only waiting to be retried */
+  if (job->job_name != NULL)
+    {
+      job_manager_forget_job (manager, job->job_name);
+      job_manager_job_revoke (job);
+    }
+
+  job_manager_job_complete (job, "canceled", NULL);
+}
+
+
+
+static void
+job_manager_job_revoke (JobManagerJob *job)
+{
+  GDBusConnection  *connection;
+  JobManagerRevoke *revoke;
+  JobManager       *manager = job->manager;
+
+  /* remember the revocation so that a retry of the job can wait for it */
+  revoke = g_slice_new0 (JobManagerRevoke);
+  revoke->job = job;
+  revoke->unit = g_strdup (job->unit);
+  job->revoke = revoke;
+
+  if (job->start)
+    {
+      /* replacing the start job with a stop job also stops whatever the
+       * start job has started already */
+      systemd_manager_call_stop_unit (manager->systemd_manager, job->unit, "replace",
+                                      NULL, job_manager_job_revoke_reply, revoke);
+    }
+  else
+    {
+      /* cancel the stop job itself, on the connection used to create it */
+      connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (manager->systemd_manager));
+      g_dbus_connection_call (connection, systemd_transport_get_bus_name (connection),
+                              job->job_name, "org.freedesktop.systemd1.Job", "Cancel",
+                              NULL, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+                              job_manager_job_revoke_reply, revoke);
+    }
+}
+
+
+
+static void
+job_manager_job_revoke_reply (GObject      *object,
+                              GAsyncResult *result,
+                              gpointer      user_data)
+{
+  JobManagerRevoke *revoke = user_data;
+  JobManagerJob    *job = revoke->job;
+  GVariant         *reply;
+  GError           *error = NULL;
+  gchar            *job_name = NULL;
+
+  /* finish the StopUnit call or the Cancel call of the job */
+  if (IS_SYSTEMD_MANAGER (object))
+    {
+      systemd_manager_call_stop_unit_finish (SYSTEMD_MANAGER (object), &job_name,
+                                             result, &error);
+      g_free (job_name);
+    }
+  else
+    {
+      reply = g_dbus_connection_call_finish (G_DBUS_CONNECTION (object), result, &error);
+      if (reply != NULL)
+        g_variant_unref (reply);
+    }
+
+  /* the job may have finished in the meantime, so this is not fatal */
+  if (error != NULL)
+    {
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Failed to cancel job:"),
+               DLT_STRING ("unit"), DLT_STRING (revoke->unit),
+               DLT_STRING ("error message"), DLT_STRING (error->message));
+      g_error_free (error);
+    }
+
+  g_free (revoke->unit);
+  g_slice_free (JobManagerRevoke, revoke);
+
+  /* retry the job if the retry has only waited for the revocation */
+  if (job != NULL)
+    {
+      job->revoke = NULL;
+      if (job->retry_waiting)
+        job_manager_job_retry (job);
+    }
+}
+
+
+
+static void
+job_manager_job_free (JobManagerJob *job)
+{
+  if (job == NULL)
+    return;
+
+  /* drop the deadline and the pending retry */
+  if (job->timeout_id > 0)
+    g_source_remove (job->timeout_id);
+  if (job->retry_id > 0)
+    g_source_remove (job->retry_id);
+
+  /* the revocation of the job is still sent to systemd, but nothing waits for it */
+  if (job->revoke != NULL)
+    job->revoke->job = NULL;
+
+  /* release all memory and references held by job */
+  g_free (job->job_name);
+  g_strfreev (job->wants);
+  g_free (job->mode);
+  g_free (job->unit);
+  g_object_unref (job->manager);
+  g_slice_free (JobManagerJob, job);
+}
+
+
+
+static gboolean
+job_manager_error_is_transient (GError *error)
+{
+  gboolean transient;
+  gchar   *remote_error;
+
+  /* systemd or the connection to it did not answer in time, or the connection
+   * was closed and is being re-established */
+  if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_NO_REPLY)
+      || g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_TIMEOUT)
+      || g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)
+      || g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CLOSED))
+    {
+      return TRUE;
+    }
+
+  /* a conflicting job, e.g. the revocation of a previous attempt, is still
+   * queued in systemd and will finish eventually */
+  remote_error = g_dbus_error_get_remote_error (error);
+  transient =
+    g_strcmp0 (remote_error, "org.freedesktop.systemd1.TransactionIsDestructive") == 0;
+  g_free (remote_error);
+
+  return transient;
+}
+
+
+
+static void
+job_manager_subscriber_cancelled (GCancellable         *cancellable,
+                                  JobManagerSubscriber *subscriber)
+{
+  /* this is called from within g_cancellable_cancel(), so notify the
+   * caller later, from the main loop */
+  g_signal_handler_disconnect (cancellable, subscriber->cancelled_id);
+  subscriber->cancelled_id = 0;
+  subscriber->cancel_id = g_idle_add (job_manager_subscriber_cancel_idle, subscriber);
+}
+
+
+
+static gboolean
+job_manager_subscriber_cancel_idle (gpointer user_data)
+{
+  JobManagerSubscriber *subscriber = user_data;
+  JobManagerJob        *job = subscriber->job;
+  GError               *error;
+
+  subscriber->cancel_id = 0;
+
+  /* unsubscribe from the job, which keeps running for its other subscribers */
+  job->subscribers = g_list_remove (job->subscribers, subscriber);
+
+  /* notify the caller */
+  error = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                               "Operation was cancelled");
+  job_manager_subscriber_finish (subscriber, "failed", error);
+  g_error_free (error);
+
+  /* cancel the job in systemd once nobody waits for it any more */
+  if (job->subscribers == NULL)
+    job_manager_job_abort (job);
+
+  return FALSE;
+}
+
+
+
+static void
+job_manager_subscriber_finish (JobManagerSubscriber *subscriber,
+                               const gchar          *result,
+                               GError               *error)
+{
+  JobManagerBatch *batch = subscriber->batch;
+  JobManagerJob   *job = subscriber->job;
+  GError          *cancelled = NULL;
+
+  /* a cancelled request reports the cancellation, whatever the result of the job */
+  if (subscriber->cancel_id != 0)
+    {
+      g_source_remove (subscriber->cancel_id);
+      cancelled = g_error_new_literal (G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                                       "Operation was cancelled");
+      result = "failed";
+      error = cancelled;
+    }
+
+  if (subscriber->cancelled_id != 0)
+    g_signal_handler_disconnect (subscriber->cancellable, subscriber->cancelled_id);
+
+  /* notify the caller about this job */
+  if (subscriber->callback != NULL)
+    subscriber->callback (job->manager, job->unit, result, error, subscriber->user_data);
+
+  /* account for the job in the batch of the request */
+  if (batch != NULL)
+    {
+      batch->n_finished++;
+      if (error != NULL || g_strcmp0 (result, "done") != 0)
+        batch->n_failed++;
+
+      /* notify the caller once all jobs of the batch have finished */
+      if (batch->n_finished == batch->n_jobs)
+        {
+          if (batch->callback != NULL)
+            {
+              batch->callback (batch->manager, batch->n_jobs, batch->n_failed,
+                               batch->user_data);
+            }
+          g_object_unref (batch->manager);
+          g_slice_free (JobManagerBatch, batch);
+        }
+    }
+
+  if (cancelled != NULL)
+    g_error_free (cancelled);
+  if (subscriber->cancellable != NULL)
+    g_object_unref (subscriber->cancellable);
+  g_slice_free (JobManagerSubscriber, subscriber);
+}
+
+
+
+static void
+job_manager_remember_job (JobManager    *manager,
+                          const char    *job_name,
+                          JobManagerJob *job)
+{
+  JobManagerJob *existing_job;
+
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (job_name != NULL && *job_name != '\0');
+  g_return_if_fail (job != NULL);
+
+  /* if the job is already being remembered, there is a programming error that should be
+   * notified */
+  existing_job = g_hash_table_lookup (manager->jobs, job_name);
+  if (existing_job != NULL)
+    {
+      g_critical ("Trying to remember the same job twice.");
+      return;
+    }
+  /* associate the job name with the job */
+  g_hash_table_insert (manager->jobs, g_strdup (job_name), job);
+
+  /* make sure the job is reconciled if its removal is never signalled */
+  job_manager_schedule_reconcile (manager);
+}
+
+
+
+static void
+job_manager_forget_job (JobManager  *manager,
+                        const gchar *job_name)
+{
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (job_name != NULL && *job_name != '\0');
+
+  g_hash_table_remove (manager->jobs, job_name);
+}
+
+
+
+static void
+job_manager_buffer_removal (JobManager  *manager,
+                            const gchar *job_name,
+                            const gchar *result)
+{
+  JobManagerRemoval *removal;
+  gint64             now;
+
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (job_name != NULL && *job_name != '\0');
+  g_return_if_fail (result != NULL);
+
+  /* job names are unique, so there is nothing to do if it is buffered already */
+  if (g_hash_table_lookup (manager->removals_by_name, job_name) != NULL)
+    return;
+
+  /* drop the oldest removals if they have expired or the buffer is full */
+  now = g_get_monotonic_time ();
+  while ((removal = g_queue_peek_head (manager->removals)) != NULL
+         && (g_queue_get_length (manager->removals) >= JOB_MANAGER_MAX_EARLY_REMOVALS
+             || now - removal->time > JOB_MANAGER_EARLY_REMOVAL_TIMEOUT * G_USEC_PER_SEC))
+    {
+      g_queue_pop_head (manager->removals);
+      g_hash_table_remove (manager->removals_by_name, removal->job_name);
+      job_manager_removal_free (removal);
+    }
+
+  /* buffer the removal */
+  removal = g_slice_new0 (JobManagerRemoval);
+  removal->job_name = g_strdup (job_name);
+  removal->result = g_strdup (result);
+  removal->time = now;
+  g_queue_push_tail (manager->removals, removal);
+  g_hash_table_insert (manager->removals_by_name, removal->job_name, removal);
+}
+
+
+
+static void
+job_manager_removal_free (JobManagerRemoval *removal)
+{
+  if (removal == NULL)
+    return;
+
+  g_free (removal->job_name);
+  g_free (removal->result);
+  g_slice_free (JobManagerRemoval, removal);
+}
+
+
+
+static void
+job_manager_watch_systemd (JobManager *manager)
+{
+  GDBusConnection *connection;
+
+  /* connect to systemd's "JobRemoved" signal so that we are notified
+   * whenever a job is finished */
+  g_signal_connect (manager->systemd_manager, "job-removed",
+                    G_CALLBACK (job_manager_job_removed), manager);
+
+  /* reconcile the jobs when systemd reappears on the bus, e.g. after it has
+   * been re-executed */
+  g_signal_connect (manager->systemd_manager, "notify::g-name-owner",
+                    G_CALLBACK (job_manager_name_owner_changed), manager);
+
+  /* reconnect when the connection is closed, e.g. because systemd has closed
+   * its private socket while being re-executed */
+  connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (manager->systemd_manager));
+  g_signal_connect (connection, "closed",
+                    G_CALLBACK (job_manager_connection_closed), manager);
+}
+
+
+
+static void
+job_manager_unwatch_systemd (JobManager *manager)
+{
+  GDBusConnection *connection;
+
+  connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (manager->systemd_manager));
+  g_signal_handlers_disconnect_matched (connection, G_SIGNAL_MATCH_DATA,
+                                        0, 0, NULL, NULL, manager);
+  g_signal_handlers_disconnect_matched (manager->systemd_manager,
+                                        G_SIGNAL_MATCH_DATA,
+                                        0, 0, NULL, NULL, manager);
+}
+
+
+
+static void
+job_manager_connection_closed (GDBusConnection *connection,
+                               gboolean         remote_peer_vanished,
+                               GError          *error,
+                               JobManager      *manager)
+{
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("Connection to systemd closed, reconnecting:"),
+           DLT_STRING (error != NULL ? error->message : "closed locally"));
+
+  /* reconnect from the main loop rather than from within the signal emission */
+  if (manager->reconnect_id == 0)
+    manager->reconnect_id = g_idle_add (job_manager_reconnect, manager);
+}
+
+
+
+static gboolean
+job_manager_reconnect (gpointer user_data)
+{
+  SystemdManager *systemd_manager;
+  JobManager     *manager = JOB_MANAGER (user_data);
+  GError         *error = NULL;
+
+  manager->reconnect_id = 0;
+
+  /* connect to systemd again, falling back to the system bus if its private
+   * socket is not available yet */
+  systemd_manager = systemd_transport_connect (&error);
+  if (systemd_manager == NULL)
+    {
+      DLT_LOG (controller_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to reconnect to systemd, trying again later:"),
+               DLT_STRING (error->message));
+      g_error_free (error);
+
+      manager->reconnect_id =
+        g_timeout_add (JOB_MANAGER_RECONNECT_DELAY, job_manager_reconnect, manager);
+      return FALSE;
+    }
+
+  DLT_LOG (controller_context, DLT_LOG_INFO, DLT_STRING ("Reconnected to systemd"));
+
+  job_manager_set_systemd_manager (manager, systemd_manager);
+  g_object_unref (systemd_manager);
+
+  return FALSE;
+}
+
+
+
+static void
+job_manager_name_owner_changed (GObject    *object,
+                                GParamSpec *pspec,
+                                JobManager *manager)
+{
+  gchar *name_owner;
+
+  /* nothing to do while systemd is gone */
+  name_owner = g_dbus_proxy_get_name_owner (G_DBUS_PROXY (object));
+  if (name_owner == NULL)
+    return;
+
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("systemd reappeared on the bus, reconciling jobs:"),
+           DLT_STRING ("name owner"), DLT_STRING (name_owner));
+  g_free (name_owner);
+
+  /* the new instance does not know our subscription, so subscribe again
+   * before checking which of our jobs it still knows */
+  systemd_manager_call_subscribe (manager->systemd_manager, NULL,
+                                  job_manager_subscribe_reply, NULL);
+  job_manager_reconcile (manager);
+}
+
+
+
+static void
+job_manager_subscribe_reply (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  GError *error = NULL;
+
+  if (!systemd_manager_call_subscribe_finish (SYSTEMD_MANAGER (object), result, &error))
+    {
+      DLT_LOG (controller_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to subscribe to the systemd manager:"),
+               DLT_STRING (error->message));
+      g_error_free (error);
+    }
+}
+
+
+
+static void
+job_manager_schedule_reconcile (JobManager *manager)
+{
+  /* reconcile periodically, but only while there are jobs to reconcile */
+  if (manager->reconcile_interval == 0
+      || manager->reconcile_id > 0
+      || g_hash_table_size (manager->jobs) == 0)
+    {
+      return;
+    }
+
+  manager->reconcile_id =
+    g_timeout_add (manager->reconcile_interval, job_manager_reconcile_timeout, manager);
+}
+
+
+
+static gboolean
+job_manager_reconcile_timeout (gpointer user_data)
+{
+  JobManager *manager = JOB_MANAGER (user_data);
+
+  manager->reconcile_id = 0;
+  job_manager_reconcile (manager);
+
+  return FALSE;
+}
+
+
+
+static void
+job_manager_list_jobs_reply (GObject      *object,
+                             GAsyncResult *result,
+                             gpointer      user_data)
+{
+  JobManagerReconcile *reconcile = user_data;
+  JobManagerJob       *job;
+  GVariantIter         iter;
+  JobManager          *manager = reconcile->manager;
+  GHashTable          *listed;
+  GVariant            *jobs = NULL;
+  GError              *error = NULL;
+  const gchar         *job_name;
+  guint                n_vanished = 0;
+  guint                n;
+
+  manager->reconciling = FALSE;
+
+  if (!systemd_manager_call_list_jobs_finish (SYSTEMD_MANAGER (object), &jobs,
+                                              result, &error))
+    {
+      DLT_LOG (controller_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to list the jobs of systemd:"),
+               DLT_STRING (error->message));
+      g_error_free (error);
+    }
+  else if (SYSTEMD_MANAGER (object) != manager->systemd_manager)
+    {
+      /* the jobs were listed by a systemd manager that has been replaced
+       * since; they are reconciled with the current one below */
+      g_variant_unref (jobs);
+    }
+  else
+    {
+      /* collect the names of the jobs that systemd still knows */
+      listed = g_hash_table_new (g_str_hash, g_str_equal);
+      g_variant_iter_init (&iter, jobs);
+      while (g_variant_iter_next (&iter, "(u&s&s&s&o&o)", NULL, NULL, NULL, NULL,
+                                  &job_name, NULL))
+        {
+          g_hash_table_insert (listed, (gpointer) job_name, (gpointer) job_name);
+        }
+
+      /* finish the jobs that were known when the jobs were listed but have
+       * vanished from systemd without a "JobRemoved" signal; jobs created
+       * later may be missing from the list and are left alone */
+      for (n = 0; n < reconcile->job_names->len; n++)
+        {
+          job_name = g_ptr_array_index (reconcile->job_names, n);
+          job = NULL;
+          if (g_hash_table_lookup (listed, job_name) == NULL)
+            job = g_hash_table_lookup (manager->jobs, job_name);
+
+          if (job != NULL)
+            {
+              DLT_LOG (controller_context, DLT_LOG_WARN,
+                       DLT_STRING ("Job vanished from systemd:"),
+                       DLT_STRING ("job"), DLT_STRING (job_name),
+                       DLT_STRING ("unit"), DLT_STRING (job->unit));
+
+              n_vanished++;
+              job_manager_forget_job (manager, job_name);
+              job_manager_job_finish (job, JOB_MANAGER_RESULT_VANISHED, NULL);
+            }
+        }
+
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("Reconciled jobs with systemd:"),
+               DLT_STRING ("checked"), DLT_UINT (reconcile->job_names->len),
+               DLT_STRING ("vanished"), DLT_UINT (n_vanished));
+
+      g_hash_table_unref (listed);
+      g_variant_unref (jobs);
+    }
+
+  /* reconcile the remaining jobs later, or right away with the systemd
+   * manager that has replaced the one the jobs were listed by */
+  if (SYSTEMD_MANAGER (object) != manager->systemd_manager)
+    job_manager_reconcile (manager);
+  else
+    job_manager_schedule_reconcile (manager);
+
+  g_ptr_array_free (reconcile->job_names, TRUE);
+  g_object_unref (reconcile->manager);
+  g_slice_free (JobManagerReconcile, reconcile);
+}
+
+
+
+static void
+job_manager_submit_many (JobManager             *manager,
+                         gboolean                start,
+                         const gchar *const     *units,
+                         const gchar *const     *modes,
+                         gpointer               *unit_data,
+                         GCancellable           *cancellable,
+                         JobManagerCallback      callback,
+                         JobManagerBatchCallback batch_callback,
+                         gpointer                user_data)
+{
+  JobManagerBatch *batch;
+  guint            n;
+
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (units != NULL);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  /* create the batch that collects the results of all its jobs */
+  batch = g_slice_new0 (JobManagerBatch);
+  batch->manager = g_object_ref (manager);
+  batch->n_jobs = g_strv_length ((gchar **) units);
+  batch->callback = batch_callback;
+  batch->user_data = user_data;
+
+  /* an empty batch is finished right away */
+  if (batch->n_jobs == 0)
+    {
+      if (batch_callback != NULL)
+        batch_callback (manager, 0, 0, user_data);
+      g_object_unref (batch->manager);
+      g_slice_free (JobManagerBatch, batch);
+      return;
+    }
+
+  /* send all the calls to systemd without waiting for any of the replies */
+  for (n = 0; units[n] != NULL; n++)
+    {
+      job_manager_request (manager, units[n], start, modes != NULL ? modes[n] : NULL,
+                           NULL, cancellable, callback,
+                           unit_data != NULL ? unit_data[n] : user_data, batch);
+    }
+}
+
+
+
+/**
+ * job_manager_new:
+ * @connection: A connection to the system bus. 
+ * @systemd_manager: An interface to the systemd manager created with 
+ * systemd_transport_connect()
+ * 
+ * Creates a new JobManager object.
+ * 
+ * Returns: A new instance of the #JobManager.
+ */
+JobManager *
+job_manager_new (GDBusConnection *connection,
+                 SystemdManager  *systemd_manager)
+{
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), NULL);
+  g_return_val_if_fail (IS_SYSTEMD_MANAGER (systemd_manager), NULL);
+
+  return g_object_new (TYPE_JOB_MANAGER,
+                       "connection", connection,
+                       "systemd-manager", systemd_manager,
+                       NULL);
+}
+
+
+
+/**
+ * job_manager_start:
+ * @unit: The name of the systemd unit to start.
+ * @mode: The systemd job mode, e.g. "replace" or "ignore-dependencies", or %NULL for
+ * %JOB_MANAGER_DEFAULT_MODE.
+ * @cancellable: A #GCancellable, or %NULL.
+ * @callback: a #JobManagerCallback that is called after the job is started.
+ * @user_data: userdata that is available in the #JobManagerCallback.
+ * 
+ * Asynchronously starts @unit, and calls @callback with @user_data when it is finished.
+ */
+void
+job_manager_start (JobManager        *manager,
+                   const gchar       *unit,
+                   const gchar       *mode,
+                   GCancellable      *cancellable,
+                   JobManagerCallback callback,
+                   gpointer           user_data)
+{
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (unit != NULL);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  g_return_if_fail (callback != NULL);
+
+  /* ask systemd to start the unit asynchronously, unless it is being started already */
+  job_manager_request (manager, unit, TRUE, mode, NULL, cancellable, callback, user_data,
+                       NULL);
+}
+
+
+
+/**
+ * job_manager_stop:
+ * @unit: The name of the systemd unit to stop.
+ * @mode: The systemd job mode, e.g. "replace" or "ignore-dependencies", or %NULL for
+ * %JOB_MANAGER_DEFAULT_MODE.
+ * @cancellable: A #GCancellable, or %NULL.
+ * @callback: a #JobManagerCallback that is called after the job is stopped.
+ * @user_data: userdata that is available in the #JobManagerCallback.
+ * 
+ * Asynchronously stops @unit, and calls @callback with @user_data when it is finished.
+ */
+void
+job_manager_stop (JobManager        *manager,
+                  const gchar       *unit,
+                  const gchar       *mode,
+                  GCancellable      *cancellable,
+                  JobManagerCallback callback,
+                  gpointer           user_data)
+{
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (unit != NULL);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  g_return_if_fail (callback != NULL);
+
+  /* ask systemd to stop the unit asynchronously, unless it is being stopped already */
+  job_manager_request (manager, unit, FALSE, mode, NULL, cancellable, callback, user_data,
+                       NULL);
+}
+
+
+
+/**
+ * job_manager_start_transient:
+ * @unit: The name of the transient systemd unit to create, e.g. "foo.target".
+ * @mode: The systemd job mode, e.g. "replace" or "ignore-dependencies", or %NULL for
+ * %JOB_MANAGER_DEFAULT_MODE.
+ * @wants: A %NULL-terminated array of the names of the systemd units @unit wants.
+ * @cancellable: A #GCancellable, or %NULL.
+ * @callback: a #JobManagerCallback that is called after the job is started.
+ * @user_data: userdata that is available in the #JobManagerCallback.
+ *
+ * Asynchronously creates the transient @unit that wants and is ordered after all the
+ * units in @wants, and starts it. @callback is called with @user_data when @unit has
+ * been started, which is after the jobs of all the units in @wants have finished.
+ * The result only reflects the job of @unit; units in @wants that failed to start
+ * do not make it fail.
+ */
+void
+job_manager_start_transient (JobManager         *manager,
+                             const gchar        *unit,
+                             const gchar        *mode,
+                             const gchar *const *wants,
+                             GCancellable       *cancellable,
+                             JobManagerCallback  callback,
+                             gpointer            user_data)
+{
+  g_return_if_fail (IS_JOB_MANAGER (manager));
   g_return_if_fail (unit != NULL);
+  g_return_if_fail (wants != NULL);
   g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
   g_return_if_fail (callback != NULL);
 
-  /* create a new job object */
-  job = job_manager_job_new (manager, unit, cancellable, callback, user_data);
+  /* ask systemd to create and start the unit asynchronously, unless it is being
+   * started already */
+  job_manager_request (manager, unit, TRUE, mode, wants, cancellable, callback, user_data,
+                       NULL);
+}
+
+
+
+/**
+ * job_manager_start_many:
+ * @units: A %NULL-terminated array of the names of the systemd units to start.
+ * @modes: An array with the systemd job mode for each of the @units, or %NULL to use
+ * %JOB_MANAGER_DEFAULT_MODE for all of them. %NULL entries use the default as well.
+ * @unit_data: An array with the user data to pass to @callback for each of the @units,
+ * or %NULL to pass @user_data for all of them.
+ * @cancellable: A #GCancellable for all the @units, or %NULL.
+ * @callback: A #JobManagerCallback that is called after each job has finished, or %NULL.
+ * @batch_callback: A #JobManagerBatchCallback that is called after all the jobs have
+ * finished, or %NULL.
+ * @user_data: userdata that is available in the #JobManagerBatchCallback.
+ *
+ * Asynchronously starts all @units as one batch, calling @callback for each of them
+ * as it is started and @batch_callback once all of them have been started.
+ */
+void
+job_manager_start_many (JobManager             *manager,
+                        const gchar *const     *units,
+                        const gchar *const     *modes,
+                        gpointer               *unit_data,
+                        GCancellable           *cancellable,
+                        JobManagerCallback      callback,
+                        JobManagerBatchCallback batch_callback,
+                        gpointer                user_data)
+{
+  job_manager_submit_many (manager, TRUE, units, modes, unit_data, cancellable, callback,
+                           batch_callback, user_data);
+}
+
+
+
+/**
+ * job_manager_stop_many:
+ * @units: A %NULL-terminated array of the names of the systemd units to stop.
+ * @modes: An array with the systemd job mode for each of the @units, or %NULL to use
+ * %JOB_MANAGER_DEFAULT_MODE for all of them. %NULL entries use the default as well.
+ * @unit_data: An array with the user data to pass to @callback for each of the @units,
+ * or %NULL to pass @user_data for all of them.
+ * @cancellable: A #GCancellable for all the @units, or %NULL.
+ * @callback: A #JobManagerCallback that is called after each job has finished, or %NULL.
+ * @batch_callback: A #JobManagerBatchCallback that is called after all the jobs have
+ * finished, or %NULL.
+ * @user_data: userdata that is available in the #JobManagerBatchCallback.
+ *
+ * Asynchronously stops all @units as one batch, calling @callback for each of them
+ * as it is stopped and @batch_callback once all of them have been stopped.
+ */
+void
+job_manager_stop_many (JobManager             *manager,
+                       const gchar *const     *units,
+                       const gchar *const     *modes,
+                       gpointer               *unit_data,
+                       GCancellable           *cancellable,
+                       JobManagerCallback      callback,
+                       JobManagerBatchCallback batch_callback,
+                       gpointer                user_data)
+{
+  job_manager_submit_many (manager, FALSE, units, modes, unit_data, cancellable, callback,
+                           batch_callback, user_data);
+}
+
+
+
+/**
+ * job_manager_reconcile:
+ * @manager: A #JobManager object.
+ *
+ * Asynchronously compares the jobs the @manager waits for with the jobs systemd still
+ * knows about, and finishes the jobs that have vanished from systemd with the result
+ * %JOB_MANAGER_RESULT_VANISHED. This is only needed if "JobRemoved" signals may have
+ * been lost, since the @manager reconciles its jobs periodically anyway.
+ */
+void
+job_manager_reconcile (JobManager *manager)
+{
+  JobManagerReconcile *reconcile;
+  GHashTableIter       iter;
+  gpointer             job_name;
+
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+
+  /* nothing to do if there are no jobs or a reconciliation is in progress */
+  if (manager->reconciling || g_hash_table_size (manager->jobs) == 0)
+    return;
+
+  if (manager->reconcile_id > 0)
+    {
+      g_source_remove (manager->reconcile_id);
+      manager->reconcile_id = 0;
+    }
+
+  /* only the jobs known now are reconciled; systemd has created them before
+   * it handles the ListJobs call, so they are listed if they still exist */
+  reconcile = g_slice_new0 (JobManagerReconcile);
+  reconcile->manager = g_object_ref (manager);
+  reconcile->job_names = g_ptr_array_new_with_free_func (g_free);
+  g_hash_table_iter_init (&iter, manager->jobs);
+  while (g_hash_table_iter_next (&iter, &job_name, NULL))
+    g_ptr_array_add (reconcile->job_names, g_strdup (job_name));
+
+  manager->reconciling = TRUE;
+  systemd_manager_call_list_jobs (manager->systemd_manager, NULL,
+                                  job_manager_list_jobs_reply, reconcile);
+}
+
+
+
+/**
+ * job_manager_set_systemd_manager:
+ * @manager: A #JobManager object.
+ * @systemd_manager: An interface to the systemd manager created with
+ * systemd_transport_connect().
+ *
+ * Replaces the #SystemdManager the @manager talks to, e.g. after the connection to
+ * systemd has been re-established. The @manager subscribes to the new
+ * @systemd_manager and reconciles its jobs with it, so jobs whose "JobRemoved" signals
+ * were lost with the old connection are finished.
+ */
+void
+job_manager_set_systemd_manager (JobManager     *manager,
+                                 SystemdManager *systemd_manager)
+{
+  g_return_if_fail (IS_JOB_MANAGER (manager));
+  g_return_if_fail (IS_SYSTEMD_MANAGER (systemd_manager));
+
+  if (manager->systemd_manager == systemd_manager)
+    return;
+
+  /* stop listening to the old systemd manager and start with the new one */
+  job_manager_unwatch_systemd (manager);
+  g_object_unref (manager->systemd_manager);
+  manager->systemd_manager = g_object_ref (systemd_manager);
+  job_manager_watch_systemd (manager);
+
+  g_object_notify (G_OBJECT (manager), "systemd-manager");
 
-  /* ask systemd to stop the unit asynchronously */
-  systemd_manager_call_stop_unit (manager->systemd_manager, unit, "fail", cancellable,
-                                  job_manager_stop_unit_reply, job);
+  /* the new connection has no subscription yet, so subscribe before checking
+   * which of our jobs systemd still knows */
+  systemd_manager_call_subscribe (manager->systemd_manager, NULL,
+                                  job_manager_subscribe_reply, NULL);
+  job_manager_reconcile (manager);
 }
@@ -31,6 +31,22 @@ G_BEGIN_DECLS
 #define IS_JOB_MANAGER_CLASS(klass) (G_TYPE_CHECK_CLASS_TYPE ((klass, TYPE_JOB_MANAGER))
 #define JOB_MANAGER_GET_CLASS(obj)  (G_TYPE_INSTANCE_GET_CLASS ((obj, TYPE_JOB_MANAGER, JobManagerClass))
 
+/**
+ * JOB_MANAGER_DEFAULT_MODE:
+ *
+ * The systemd job mode used for requests that do not specify one. The job fails if it
+ * conflicts with another job that is already queued in systemd.
+ */
+#define JOB_MANAGER_DEFAULT_MODE "fail"
+
+/**
+ * JOB_MANAGER_RESULT_VANISHED:
+ *
+ * The result of a job that has vanished from systemd without its removal being
+ * signalled, e.g. because systemd was re-executed.
+ */
+#define JOB_MANAGER_RESULT_VANISHED "vanished"
+
 typedef struct _JobManagerClass JobManagerClass;
 typedef struct _JobManager      JobManager;
 
@@ -52,19 +68,62 @@ typedef void (*JobManagerCallback) (JobManager  *manager,
                                     GError      *error,
                                     gpointer     user_data);
 
-GType       job_manager_get_type (void) G_GNUC_CONST;
-JobManager *job_manager_new      (GDBusConnection   *connection,
-                                  SystemdManager    *systemd_manager) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
-void        job_manager_start    (JobManager        *manager,
-                                  const gchar       *unit,
-                                  GCancellable      *cancellable,
-                                  JobManagerCallback callback,
-                                  gpointer           user_data);
-void        job_manager_stop     (JobManager        *manager,
-                                  const gchar       *unit,
-                                  GCancellable      *cancellable,
-                                  JobManagerCallback callback,
-                                  gpointer           user_data);
+/**
+ * JobManagerBatchCallback:
+ * @manager:   The #JobManager object.
+ * @n_jobs:    The number of units in the batch.
+ * @n_failed:  The number of units that could not be started or stopped.
+ * @user_data: The user_data passed into the start or stop methods.
+ *
+ * The JobManagerBatchCallback is called when all the jobs of a batch submitted with
+ * job_manager_start_many() or job_manager_stop_many() have finished.
+ */
+typedef void (*JobManagerBatchCallback) (JobManager *manager,
+                                         guint       n_jobs,
+                                         guint       n_failed,
+                                         gpointer    user_data);
+
+GType       job_manager_get_type            (void) G_GNUC_CONST;
+JobManager *job_manager_new                 (GDBusConnection        *connection,
+                                             SystemdManager         *systemd_manager) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+void        job_manager_start               (JobManager             *manager,
+                                             const gchar            *unit,
+                                             const gchar            *mode,
+                                             GCancellable           *cancellable,
+                                             JobManagerCallback      callback,
+                                             gpointer                user_data);
+void        job_manager_stop                (JobManager             *manager,
+                                             const gchar            *unit,
+                                             const gchar            *mode,
+                                             GCancellable           *cancellable,
+                                             JobManagerCallback      callback,
+                                             gpointer                user_data);
+void        job_manager_start_transient     (JobManager             *manager,
+                                             const gchar            *unit,
+                                             const gchar            *mode,
+                                             const gchar *const     *wants,
+                                             GCancellable           *cancellable,
+                                             JobManagerCallback      callback,
+                                             gpointer                user_data);
+void        job_manager_start_many          (JobManager             *manager,
+                                             const gchar *const     *units,
+                                             const gchar *const     *modes,
+                                             gpointer               *unit_data,
+                                             GCancellable           *cancellable,
+                                             JobManagerCallback      callback,
+                                             JobManagerBatchCallback batch_callback,
+                                             gpointer                user_data);
+void        job_manager_stop_many           (JobManager             *manager,
+                                             const gchar *const     *units,
+                                             const gchar *const     *modes,
+                                             gpointer               *unit_data,
+                                             GCancellable           *cancellable,
+                                             JobManagerCallback      callback,
+                                             JobManagerBatchCallback batch_callback,
+                                             gpointer                user_data);
+void        job_manager_reconcile           (JobManager             *manager);
+void        job_manager_set_systemd_manager (JobManager             *manager,
+                                             SystemdManager         *systemd_manager);
 
 G_END_DECLS
 
@@ -21,6 +21,12 @@
 #include <config.h>
 #endif
 
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <signal.h>
+
 #include <glib-object.h>
 #include <gio/gio.h>
 
@@ -29,9 +35,9 @@
 #include <common/la-handler-dbus.h>
 #include <common/nsm-consumer-dbus.h>
 #include <common/nsm-enum-types.h>
-#include <common/shutdown-client.h>
 #include <common/shutdown-consumer-dbus.h>
 
+#include <node-startup-controller/config-file.h>
 #include <node-startup-controller/job-manager.h>
 #include <node-startup-controller/la-handler-service.h>
 
@@ -43,47 +49,80 @@
  * @short_description: Handles registration of legacy apps with the Node State Manager.
  * @stability: Internal
  * 
- * The #LAHandlerService contains two hash tables to map the shutdown clients it
- * registers with the Node State Manager and vice versa.
+ * The #LAHandlerService keeps a compact record for every legacy app it registers with
+ * the Node State Manager as a shutdown client. The records are looked up by unit name
+ * through a hash table and by the index in their object path through an array.
  *
  * The #LAHandlerService class provides an internal D-Bus interface which contains a
  * %Register method for the #legacy-app-handler helper binary to communicate with.
  *
+ * The shutdown consumers of all legacy apps are served by a single D-Bus subtree below
+ * "/org/genivi/NodeStartupController1/ShutdownConsumer", which is registered when the
+ * #LAHandlerService is started. Every legacy app has an object path of the form
+ * "/org/genivi/NodeStartupController1/ShutdownConsumer/&lt;index&gt;" in this
+ * subtree, but no D-Bus object of its own; %LifecycleRequest calls are dispatched to
+ * the record of the app by their object path. This keeps the memory and the
+ * registration cost per legacy app small.
+ *
  * When it receives a %Register method call (which specifies a unit name, shutdown mode
  * and timeout), it handles the "handle-register" signal by doing the following:
  *
- * 1. Looks for a pre-existing #ShutdownClient by its unit name. If it already exists,
- *    it adds the shutdown mode to whatever shutdown modes are already registered and
- *    sets the timeout to the new value.
- *
- * 2. Create a #ShutdownClient with unit name, bus name, object path, shutdown mode,
- *    timeout and a #ShutdownConsumerSkeleton, where the bus name is the Node
- *    Startup Controller's bus name, and the object path is unique and decided by the
- *    #LAHandlerService.
- *
- * 3. Register the "handle-lifecycle-request" signal handler to the
- *    #ShutdownConsumerSkeleton's %LifecycleRequest method, taking the #ShutdownClient as
- *    userdata.
+ * 1. Looks for a pre-existing record by its unit name. If it already exists, it
+ *    re-registers the app with the new shutdown mode and timeout.
  *
- * 4. Export the shutdown client's #ShutdownConsumerSkeleton using the client's object
- *    path.
+ * 2. Otherwise, creates a record with the unit name, shutdown mode, timeout and the
+ *    next free index, which decides the object path of the app in the subtree.
  *
- * 5. Register the #ShutdownClient with the Node State Manager.
+ * 3. Registers the object path of the app with the Node State Manager, with the
+ *    Node Startup Controller's bus name.
  *
  * When it receives a %LifecycleRequest method call, it does the following:
  *
- * 1. Looks up the unit name of the #ShutdownClient passed as userdata. If it is not
- *    found then it returns an error to the Node State Manager.
+ * 1. Looks up the record of the app by the object path the call was made on. If it is
+ *    not found then it returns an error to the Node State Manager.
  *
- * 2. Tells the Job Manager to stop the #ShutdownClient's systemd unit.
+ * 2. Queues the app's systemd unit for being stopped. All units queued
+ *    while handling the lifecycle requests that arrive together are handed over to
+ *    the #JobManager as a single batch with job_manager_stop_many() once the main
+ *    loop becomes idle, so that they are stopped with one pipelined set of D-Bus calls.
  *
  * 3. Returns the #NSMErrorStatus NSM_ERROR_STATUS_PENDING to the Node State Manger,
  *    which tells The Node State Manager to wait %timeout seconds for a replying method
  *    call to the Node State Manager with the %LifecycleRequestComplete method.
  *
  * 4. After the #JobManager has stopped the unit, it checks if the #JobManager failed to
- *    stop the unit and calls the Node State Manager with %LifecycleRequestComplete to
- *    inform it about the success or failure of stopping the unit.
+ *    stop the unit and queues the success or failure of stopping the unit for being
+ *    reported to the Node State Manager. Once the main loop becomes idle, all queued
+ *    results are reported with asynchronous %LifecycleRequestComplete calls that are
+ *    sent at once, so that neither the main loop nor the next stop waits for the
+ *    Node State Manager to reply.
+ *
+ * The units of a %LifecycleRequest for a fast shutdown (%NSM_SHUTDOWN_TYPE_FAST) are
+ * stopped with the "replace-irreversibly" job mode. Their stop jobs ask them to exit
+ * gracefully, but they only get the "fast-kill-delay" to do so: after that, all their
+ * processes are sent the "fast-kill-signal" (%SIGKILL by default), where 0 stops a
+ * unit as gracefully as in a normal shutdown. The time every request takes is logged,
+ * with a warning if it exceeds the "normal-latency-target" or "fast-latency-target" of
+ * its shutdown mode. These properties are initialized from the %FastKillSignal,
+ * %FastKillDelay, %NormalLatencyTarget and %FastLatencyTarget keys in the %LAHandler
+ * group of the configuration file. All four can be overridden for single legacy apps
+ * in groups named "Legacy App &lt;unit&gt;"; the latency targets can be overridden
+ * for shutdown groups in the same way, using the name of the group.
+ *
+ * Legacy apps can be combined into shutdown groups with the %ShutdownGroups group of
+ * the configuration file, which lists the units of the members of each group. All
+ * members of a group share one record and thereby one shutdown consumer, which is
+ * registered with the shutdown modes of all members and the timeout of the slowest
+ * member. A %LifecycleRequest for the group queues all its member units at once, so
+ * they are stopped in parallel instead of one after another, and it is completed
+ * once all members have been stopped or the timeout of the group has expired.
+ *
+ * When the Node Startup Controller shuts down, la_handler_service_deregister_consumers()
+ * unregisters the shutdown consumers of all legacy apps. The UnRegisterShutdownClient
+ * calls are all sent to the Node State Manager at once, and the operation finishes
+ * as soon as the last reply has arrived, or when the "deregistration-deadline"
+ * expires, whichever happens first. The deadline is initialized from the
+ * %DeregistrationDeadline key in the %LAHandler group of the configuration file.
  */
 
 
@@ -98,47 +137,125 @@ enum
   PROP_0,
   PROP_CONNECTION,
   PROP_JOB_MANAGER,
+  PROP_DEREGISTRATION_DEADLINE,
+  PROP_FAST_KILL_SIGNAL,
+  PROP_FAST_KILL_DELAY,
+  PROP_NORMAL_LATENCY_TARGET,
+  PROP_FAST_LATENCY_TARGET,
 };
 
 
 
-typedef struct _LAHandlerServiceData LAHandlerServiceData;
-
-
-
-static void                  la_handler_service_constructed                              (GObject               *object);
-static void                  la_handler_service_finalize                                 (GObject               *object);
-static void                  la_handler_service_get_property                             (GObject               *object,
-                                                                                          guint                  prop_id,
-                                                                                          GValue                *value,
-                                                                                          GParamSpec            *pspec);
-static void                  la_handler_service_set_property                             (GObject               *object,
-                                                                                          guint                  prop_id,
-                                                                                          const GValue          *value,
-                                                                                          GParamSpec            *pspec);
-static gboolean              la_handler_service_handle_register                          (LAHandler             *interface,
-                                                                                          GDBusMethodInvocation *invocation,
-                                                                                          const gchar           *unit,
-                                                                                          NSMShutdownType        mode,
-                                                                                          guint                  timeout,
-                                                                                          LAHandlerService      *service);
-static void                  la_handler_service_handle_register_finish                   (GObject               *object,
-                                                                                          GAsyncResult          *res,
-                                                                                          gpointer               user_data);
-static gboolean              la_handler_service_handle_consumer_lifecycle_request        (ShutdownConsumer      *consumer,
-                                                                                          GDBusMethodInvocation *invocation,
-                                                                                          guint                  request,
-                                                                                          guint                  request_id,
-                                                                                          ShutdownClient        *client);
-static void                  la_handler_service_handle_consumer_lifecycle_request_finish (JobManager            *manager,
-                                                                                          const gchar           *unit,
-                                                                                          const gchar           *result,
-                                                                                          GError                *error,
-                                                                                          gpointer               user_data);
-static LAHandlerServiceData *la_handler_service_data_new                                 (LAHandlerService      *service,
-                                                                                          GDBusMethodInvocation *invocation,
-                                                                                          guint                  request_id);
-static void                  la_handler_service_data_unref                               (LAHandlerServiceData  *data);
+#define LA_HANDLER_SERVICE_BUS_NAME       "org.genivi.NodeStartupController1"
+#define LA_HANDLER_SERVICE_PREFIX         "/org/genivi/NodeStartupController1/ShutdownConsumer"
+#define LA_HANDLER_SERVICE_FAST_STOP_MODE "replace-irreversibly"
+
+
+
+typedef struct _LAHandlerServiceData               LAHandlerServiceData;
+typedef struct _LAHandlerServiceClient             LAHandlerServiceClient;
+typedef struct _LAHandlerServiceCompletion         LAHandlerServiceCompletion;
+typedef struct _LAHandlerServiceDeregistration     LAHandlerServiceDeregistration;
+typedef struct _LAHandlerServiceDeregistrationCall LAHandlerServiceDeregistrationCall;
+typedef struct _LAHandlerServiceKill               LAHandlerServiceKill;
+typedef struct _LAHandlerServicePolicy             LAHandlerServicePolicy;
+
+
+
+static void                        la_handler_service_constructed                              (GObject                        *object);
+static void                        la_handler_service_finalize                                 (GObject                        *object);
+static void                        la_handler_service_get_property                             (GObject                        *object,
+                                                                                                guint                           prop_id,
+                                                                                                GValue                         *value,
+                                                                                                GParamSpec                     *pspec);
+static void                        la_handler_service_set_property                             (GObject                        *object,
+                                                                                                guint                           prop_id,
+                                                                                                const GValue                   *value,
+                                                                                                GParamSpec                     *pspec);
+static void                        la_handler_service_load_groups                              (LAHandlerService               *service,
+                                                                                                GKeyFile                       *config);
+static void                        la_handler_service_load_policies                            (LAHandlerService               *service,
+                                                                                                GKeyFile                       *config);
+static gboolean                    la_handler_service_handle_register                          (LAHandler                      *interface,
+                                                                                                GDBusMethodInvocation          *invocation,
+                                                                                                const gchar                    *unit,
+                                                                                                NSMShutdownType                 mode,
+                                                                                                guint                           timeout,
+                                                                                                LAHandlerService               *service);
+static void                        la_handler_service_handle_register_finish                   (GObject                        *object,
+                                                                                                GAsyncResult                   *res,
+                                                                                                gpointer                        user_data);
+static gchar                     **la_handler_service_subtree_enumerate                        (GDBusConnection                *connection,
+                                                                                                const gchar                    *sender,
+                                                                                                const gchar                    *object_path,
+                                                                                                gpointer                        user_data);
+static GDBusInterfaceInfo        **la_handler_service_subtree_introspect                       (GDBusConnection                *connection,
+                                                                                                const gchar                    *sender,
+                                                                                                const gchar                    *object_path,
+                                                                                                const gchar                    *node,
+                                                                                                gpointer                        user_data);
+static const GDBusInterfaceVTable *la_handler_service_subtree_dispatch                         (GDBusConnection                *connection,
+                                                                                                const gchar                    *sender,
+                                                                                                const gchar                    *object_path,
+                                                                                                const gchar                    *interface_name,
+                                                                                                const gchar                    *node,
+                                                                                                gpointer                       *out_user_data,
+                                                                                                gpointer                        user_data);
+static void                        la_handler_service_handle_consumer_method_call              (GDBusConnection                *connection,
+                                                                                                const gchar                    *sender,
+                                                                                                const gchar                    *object_path,
+                                                                                                const gchar                    *interface_name,
+                                                                                                const gchar                    *method_name,
+                                                                                                GVariant                       *parameters,
+                                                                                                GDBusMethodInvocation          *invocation,
+                                                                                                gpointer                        user_data);
+static LAHandlerServiceClient     *la_handler_service_lookup_client                            (LAHandlerService               *service,
+                                                                                                const gchar                    *node);
+static gint                        la_handler_service_handle_consumer_lifecycle_request        (LAHandlerService               *service,
+                                                                                                LAHandlerServiceClient         *client,
+                                                                                                guint                           request,
+                                                                                                guint                           request_id);
+static void                        la_handler_service_handle_consumer_lifecycle_request_finish (JobManager                     *manager,
+                                                                                                const gchar                    *unit,
+                                                                                                const gchar                    *result,
+                                                                                                GError                         *error,
+                                                                                                gpointer                        user_data);
+static gboolean                    la_handler_service_lifecycle_request_expired                (gpointer                        user_data);
+static void                        la_handler_service_complete_request                         (LAHandlerServiceData           *data);
+static gboolean                    la_handler_service_stop_queued_units                        (gpointer                        user_data);
+static void                        la_handler_service_stop_queued_units_finish                 (JobManager                     *manager,
+                                                                                                guint                           n_jobs,
+                                                                                                guint                           n_failed,
+                                                                                                gpointer                        user_data);
+static gboolean                    la_handler_service_complete_queued_requests                 (gpointer                        user_data);
+static void                        la_handler_service_complete_queued_requests_finish          (GObject                        *object,
+                                                                                                GAsyncResult                   *res,
+                                                                                                gpointer                        user_data);
+static LAHandlerServicePolicy     *la_handler_service_lookup_policy                            (LAHandlerService               *service,
+                                                                                                const gchar                    *name);
+static gint                        la_handler_service_get_fast_kill_signal                     (LAHandlerService               *service,
+                                                                                                const gchar                    *unit);
+static guint                       la_handler_service_get_fast_kill_delay                      (LAHandlerService               *service,
+                                                                                                const gchar                    *unit);
+static guint                       la_handler_service_get_latency_target                       (LAHandlerService               *service,
+                                                                                                const gchar                    *name,
+                                                                                                gboolean                        fast);
+static gboolean                    la_handler_service_kill_unit                                (gpointer                        user_data);
+static void                        la_handler_service_kill_unit_finish                         (GObject                        *object,
+                                                                                                GAsyncResult                   *res,
+                                                                                                gpointer                        user_data);
+static LAHandlerServiceData       *la_handler_service_data_new                                 (LAHandlerService               *service,
+                                                                                                GDBusMethodInvocation          *invocation,
+                                                                                                guint                           request_id);
+static void                        la_handler_service_data_unref                               (LAHandlerServiceData           *data);
+static void                        la_handler_service_client_free                              (LAHandlerServiceClient         *client);
+static void                        la_handler_service_kill_free                                (LAHandlerServiceKill           *kill_data);
+static void                        la_handler_service_policy_free                              (LAHandlerServicePolicy         *policy);
+static void                        la_handler_service_deregister_consumer_finish               (GObject                        *object,
+                                                                                                GAsyncResult                   *res,
+                                                                                                gpointer                        user_data);
+static gboolean                    la_handler_service_deregistration_expired                   (gpointer                        user_data);
+static void                        la_handler_service_deregistration_release                   (LAHandlerServiceDeregistration *deregistration);
 
 
 
@@ -155,15 +272,38 @@ struct _LAHandlerService
   LAHandler       *interface;
   JobManager      *job_manager;
 
-  /* Associations of shutdown clients and their units */
-  GHashTable      *units_to_clients;
-  GHashTable      *clients_to_units;
+  /* records of the registered shutdown consumers by name and by index, and
+   * the ID of the subtree they are served by */
+  GHashTable      *clients;
+  GPtrArray       *clients_by_index;
+  guint            subtree_id;
 
-  const gchar     *prefix;
-  guint            index;
+  /* names of the configured shutdown groups by the units of their members */
+  GHashTable      *groups;
+
+  /* milliseconds to wait for the NSM when unregistering the legacy apps */
+  guint            deregistration_deadline;
+
+  /* the signal sent to the units stopped in a fast shutdown and the grace
+   * period before it is sent, the latency targets of normal and fast
+   * shutdowns, and the overrides of these by unit or group name */
+  gint             fast_kill_signal;
+  guint            fast_kill_delay;
+  guint            normal_latency_target;
+  guint            fast_latency_target;
+  GHashTable      *policies;
 
   /* connection to the NSM consumer interface */
   NSMConsumer     *nsm_consumer;
+
+  /* units queued for being stopped in one batch, with their request data */
+  GPtrArray       *stop_units;
+  GPtrArray       *stop_data;
+  guint            stop_id;
+
+  /* results of lifecycle requests queued for being reported to the NSM */
+  GArray          *completions;
+  guint            completions_id;
 };
 
 struct _LAHandlerServiceData
@@ -171,6 +311,93 @@ struct _LAHandlerServiceData
   GDBusMethodInvocation *invocation;
   LAHandlerService      *service;
   guint                  request_id;
+
+  /* the number of units of the request that are still being stopped, the
+   * status to complete the request with and whether it has been completed */
+  guint                  n_pending;
+  gint                   status;
+  gboolean               completed;
+
+  /* source ID of the timeout of a shutdown group */
+  guint                  timeout_id;
+
+  /* whether this is a fast shutdown, when the request has arrived and how
+   * long it should take at most */
+  gboolean               fast;
+  gint64                 start_time;
+  guint                  latency_target;
+};
+
+struct _LAHandlerServiceCompletion
+{
+  guint request_id;
+  gint  status;
+};
+
+struct _LAHandlerServiceClient
+{
+  /* the unit of the legacy app or the name of the shutdown group, the index in
+   * its object path and the shutdown mode and timeout it is registered with */
+  gchar     *name;
+  guint      index;
+  gint       shutdown_mode;
+  guint      timeout;
+
+  /* the units stopped by the shutdown consumer, more than one for a group */
+  GPtrArray *units;
+  gboolean   group;
+};
+
+struct _LAHandlerServiceDeregistration
+{
+  GSimpleAsyncResult *result;
+
+  /* the number of UnRegisterShutdownClient calls still awaited, plus one as
+   * long as the operation has not completed */
+  guint               n_pending;
+
+  /* source ID of the deadline of the operation */
+  guint               deadline_id;
+};
+
+struct _LAHandlerServiceDeregistrationCall
+{
+  LAHandlerServiceDeregistration *deregistration;
+  gchar                          *name;
+  gchar                          *object_path;
+};
+
+struct _LAHandlerServiceKill
+{
+  LAHandlerService *service;
+  gchar            *unit;
+  gint              signal_number;
+};
+
+struct _LAHandlerServicePolicy
+{
+  /* overrides of the fast kill signal, the grace period and the latency
+   * targets of a unit or a shutdown group, or -1 for the defaults */
+  gint fast_kill_signal;
+  gint fast_kill_delay;
+  gint normal_latency_target;
+  gint fast_latency_target;
+};
+
+
+
+static const GDBusSubtreeVTable la_handler_service_subtree_vtable =
+{
+  la_handler_service_subtree_enumerate,
+  la_handler_service_subtree_introspect,
+  la_handler_service_subtree_dispatch,
+};
+
+static const GDBusInterfaceVTable la_handler_service_consumer_vtable =
+{
+  la_handler_service_handle_consumer_method_call,
+  NULL,
+  NULL,
 };
 
 
@@ -209,6 +436,53 @@ la_handler_service_class_init (LAHandlerServiceClass *klass)
                                                         G_PARAM_READWRITE |
                                                         G_PARAM_CONSTRUCT_ONLY |
                                                         G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_DEREGISTRATION_DEADLINE,
+                                   g_param_spec_uint ("deregistration-deadline",
+                                                      "deregistration-deadline",
+                                                      "Milliseconds to wait for the NSM"
+                                                      " when unregistering the shutdown"
+                                                      " consumers, or 0",
+                                                      0, G_MAXUINT, 2000,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_FAST_KILL_SIGNAL,
+                                   g_param_spec_int ("fast-kill-signal",
+                                                     "fast-kill-signal",
+                                                     "Signal sent to legacy apps"
+                                                     " in a fast shutdown, or 0",
+                                                     0, G_MAXINT, SIGKILL,
+                                                     G_PARAM_READWRITE |
+                                                     G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_FAST_KILL_DELAY,
+                                   g_param_spec_uint ("fast-kill-delay",
+                                                      "fast-kill-delay",
+                                                      "Milliseconds legacy apps are given"
+                                                      " to exit in a fast shutdown before"
+                                                      " they are killed",
+                                                      0, G_MAXUINT, 500,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_NORMAL_LATENCY_TARGET,
+                                   g_param_spec_uint ("normal-latency-target",
+                                                      "normal-latency-target",
+                                                      "Latency target of lifecycle requests"
+                                                      " of normal shutdowns in milliseconds",
+                                                      0, G_MAXUINT, 5000,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class,
+                                   PROP_FAST_LATENCY_TARGET,
+                                   g_param_spec_uint ("fast-latency-target",
+                                                      "fast-latency-target",
+                                                      "Latency target of lifecycle requests"
+                                                      " of fast shutdowns in milliseconds",
+                                                      0, G_MAXUINT, 1000,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
 }
 
 
@@ -239,22 +513,49 @@ la_handler_service_constructed (GObject *object)
 static void
 la_handler_service_init (LAHandlerService *service)
 {
-  service->interface = la_handler_skeleton_new ();
-
-  /* the number that follows the prefix in the shutdown client's object path,
-   * making every shutdown client unique */
-  service->index = 1;
+  GKeyFile *config;
 
-  /* the string that precedes the index in the shutdown client's object path */
-  service->prefix = "/org/genivi/NodeStartupController1/ShutdownConsumer";
+  service->interface = la_handler_skeleton_new ();
 
-  /* initialize the association of shutdown client to units */
-  service->units_to_clients = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                     (GDestroyNotify) g_free,
-                                                     (GDestroyNotify) g_object_unref);
-  service->clients_to_units = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                                     (GDestroyNotify) g_object_unref,
-                                                     (GDestroyNotify) g_free);
+  /* initialize the records of the shutdown consumers; the names are owned by
+   * the records, and the index of a record in its object path is its position
+   * in the array plus one */
+  service->clients =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           NULL, (GDestroyNotify) la_handler_service_client_free);
+  service->clients_by_index = g_ptr_array_new ();
+
+  /* read the deadline for unregistering the legacy apps and the shutdown
+   * groups from the configuration */
+  config = config_file_load ();
+  service->deregistration_deadline =
+    MAX (config_file_get_integer (config, "LAHandler", "DeregistrationDeadline", 2000), 0);
+  service->groups = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  la_handler_service_load_groups (service, config);
+
+  /* read how legacy apps are stopped in fast shutdowns and the latency
+   * targets of both shutdown modes, and their overrides for single legacy
+   * apps and shutdown groups */
+  service->fast_kill_signal =
+    MAX (config_file_get_integer (config, "LAHandler", "FastKillSignal", SIGKILL), 0);
+  service->fast_kill_delay =
+    MAX (config_file_get_integer (config, "LAHandler", "FastKillDelay", 500), 0);
+  service->normal_latency_target =
+    MAX (config_file_get_integer (config, "LAHandler", "NormalLatencyTarget", 5000), 0);
+  service->fast_latency_target =
+    MAX (config_file_get_integer (config, "LAHandler", "FastLatencyTarget", 1000), 0);
+  service->policies =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           g_free, (GDestroyNotify) la_handler_service_policy_free);
+  la_handler_service_load_policies (service, config);
+  g_key_file_free (config);
+
+  /* initialize the queue of units to stop */
+  service->stop_units = g_ptr_array_new_with_free_func (g_free);
+  service->stop_data = g_ptr_array_new ();
+
+  /* initialize the queue of lifecycle request results to report */
+  service->completions = g_array_new (FALSE, FALSE, sizeof (LAHandlerServiceCompletion));
 
   /* implement the Register() handler */
   g_signal_connect (service->interface, "handle-register",
@@ -272,6 +573,10 @@ la_handler_service_finalize (GObject *object)
   /* release the interface skeleton */
   g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (service->interface));
 
+  /* stop serving the shutdown consumers */
+  if (service->subtree_id != 0)
+    g_dbus_connection_unregister_subtree (service->connection, service->subtree_id);
+
   /* release the NSM consumer service object, if there is one */
   if (service->nsm_consumer != NULL)
     g_object_unref (service->nsm_consumer);
@@ -289,9 +594,22 @@ la_handler_service_finalize (GObject *object)
   if (service->connection != NULL)
     g_object_unref (service->connection);
 
-  /* release the shutdown clients */
-  g_hash_table_unref (service->units_to_clients);
-  g_hash_table_unref (service->clients_to_units);
+  /* release the records of the legacy apps */
+  g_ptr_array_free (service->clients_by_index, TRUE);
+  g_hash_table_unref (service->clients);
+  g_hash_table_unref (service->groups);
+  g_hash_table_unref (service->policies);
+
+  /* release the queue of units to stop; queued requests keep the service alive,
+   * so the queue is empty at this point */
+  if (service->stop_id != 0)
+    g_source_remove (service->stop_id);
+  g_ptr_array_free (service->stop_units, TRUE);
+  g_ptr_array_free (service->stop_data, TRUE);
+
+  /* release the queue of lifecycle request results; a pending report keeps the
+   * service alive, so the queue is empty at this point */
+  g_array_free (service->completions, TRUE);
 
   (*G_OBJECT_CLASS (la_handler_service_parent_class)->finalize) (object);
 }
@@ -314,6 +632,21 @@ la_handler_service_get_property (GObject    *object,
     case PROP_JOB_MANAGER:
       g_value_set_object (value, service->job_manager);
       break;
+    case PROP_DEREGISTRATION_DEADLINE:
+      g_value_set_uint (value, service->deregistration_deadline);
+      break;
+    case PROP_FAST_KILL_SIGNAL:
+      g_value_set_int (value, service->fast_kill_signal);
+      break;
+    case PROP_FAST_KILL_DELAY:
+      g_value_set_uint (value, service->fast_kill_delay);
+      break;
+    case PROP_NORMAL_LATENCY_TARGET:
+      g_value_set_uint (value, service->normal_latency_target);
+      break;
+    case PROP_FAST_LATENCY_TARGET:
+      g_value_set_uint (value, service->fast_latency_target);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -338,6 +671,21 @@ la_handler_service_set_property (GObject      *object,
     case PROP_JOB_MANAGER:
       service->job_manager = g_value_dup_object (value);
       break;
+    case PROP_DEREGISTRATION_DEADLINE:
+      service->deregistration_deadline = g_value_get_uint (value);
+      break;
+    case PROP_FAST_KILL_SIGNAL:
+      service->fast_kill_signal = g_value_get_int (value);
+      break;
+    case PROP_FAST_KILL_DELAY:
+      service->fast_kill_delay = g_value_get_uint (value);
+      break;
+    case PROP_NORMAL_LATENCY_TARGET:
+      service->normal_latency_target = g_value_get_uint (value);
+      break;
+    case PROP_FAST_LATENCY_TARGET:
+      service->fast_latency_target = g_value_get_uint (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -346,6 +694,86 @@ la_handler_service_set_property (GObject      *object,
 
 
 
+static void
+la_handler_service_load_groups (LAHandlerService *service,
+                                GKeyFile         *config)
+{
+  const gchar *group;
+  gchar      **keys;
+  gchar      **units;
+  guint        n;
+  guint        m;
+
+  keys = g_key_file_get_keys (config, "ShutdownGroups", NULL, NULL);
+  if (keys == NULL)
+    return;
+
+  for (n = 0; keys[n] != NULL; n++)
+    {
+      units = g_key_file_get_string_list (config, "ShutdownGroups", keys[n],
+                                          NULL, NULL);
+      for (m = 0; units != NULL && units[m] != NULL; m++)
+        {
+          /* a unit can only be stopped by one shutdown group */
+          g_strstrip (units[m]);
+          group = g_hash_table_lookup (service->groups, units[m]);
+          if (group != NULL)
+            {
+              DLT_LOG (la_handler_context, DLT_LOG_WARN,
+                       DLT_STRING ("Ignoring unit listed in several shutdown groups:"),
+                       DLT_STRING ("unit"), DLT_STRING (units[m]),
+                       DLT_STRING ("group"), DLT_STRING (group));
+            }
+          else if (*units[m] != '\0')
+            {
+              g_hash_table_insert (service->groups, g_strdup (units[m]),
+                                   g_strdup (keys[n]));
+            }
+        }
+      g_strfreev (units);
+    }
+
+  g_strfreev (keys);
+}
+
+
+
+static void
+la_handler_service_load_policies (LAHandlerService *service,
+                                  GKeyFile         *config)
+{
+  LAHandlerServicePolicy *policy;
+  const gchar            *name;
+  gchar                 **groups;
+  guint                   n;
+
+  /* look for groups named "Legacy App <name>" with settings for the legacy
+   * app or shutdown group of that name */
+  groups = g_key_file_get_groups (config, NULL);
+  for (n = 0; groups != NULL && groups[n] != NULL; n++)
+    {
+      if (g_str_has_prefix (groups[n], "Legacy App ")
+          && groups[n][sizeof ("Legacy App ") - 1] != '\0')
+        {
+          name = groups[n] + sizeof ("Legacy App ") - 1;
+
+          policy = g_slice_new0 (LAHandlerServicePolicy);
+          policy->fast_kill_signal =
+            config_file_get_integer (config, groups[n], "FastKillSignal", -1);
+          policy->fast_kill_delay =
+            config_file_get_integer (config, groups[n], "FastKillDelay", -1);
+          policy->normal_latency_target =
+            config_file_get_integer (config, groups[n], "NormalLatencyTarget", -1);
+          policy->fast_latency_target =
+            config_file_get_integer (config, groups[n], "FastLatencyTarget", -1);
+          g_hash_table_insert (service->policies, g_strdup (name), policy);
+        }
+    }
+  g_strfreev (groups);
+}
+
+
+
 static gboolean
 la_handler_service_handle_register (LAHandler             *interface,
                                     GDBusMethodInvocation *invocation,
@@ -354,13 +782,11 @@ la_handler_service_handle_register (LAHandler             *interface,
                                     guint                  timeout,
                                     LAHandlerService      *service)
 {
-  ShutdownConsumer *consumer;
-  ShutdownClient   *client;
-  GError           *error = NULL;
-  const gchar      *existing_bus_name;
-  const gchar      *existing_object_path;
-  gchar            *bus_name;
-  gchar            *object_path;
+  LAHandlerServiceClient *client;
+  const gchar            *group;
+  gboolean                known = FALSE;
+  gchar                  *object_path;
+  guint                   n;
 
   g_return_val_if_fail (IS_LA_HANDLER (interface), FALSE);
   g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), FALSE);
@@ -379,83 +805,58 @@ la_handler_service_handle_register (LAHandler             *interface,
       return TRUE;
     }
 
-  /* find out if we have a shutdown client for this unit already */
-  client = g_hash_table_lookup (service->units_to_clients, unit);
-  if (client != NULL)
-    {
-      /* there already is a shutdown client for the unit, so simply
-       * re-register its client with the new shutdown mode and timeout */
+  /* units of a shutdown group share the shutdown consumer of the group */
+  group = g_hash_table_lookup (service->groups, unit);
 
-      /* extract information from the client */
-      existing_bus_name = shutdown_client_get_bus_name (client);
-      existing_object_path = shutdown_client_get_object_path (client);
+  /* find out if we have a record for this unit or its group already; if so,
+   * simply re-register its shutdown consumer with the new shutdown mode and
+   * timeout */
+  client = g_hash_table_lookup (service->clients, group != NULL ? group : unit);
+  if (client == NULL)
+    {
+      /* create a new record for the unit or group; its shutdown consumer is
+       * served by the subtree at the object path with the next free index */
+      client = g_slice_new0 (LAHandlerServiceClient);
+      client->name = g_strdup (group != NULL ? group : unit);
+      client->units = g_ptr_array_new_with_free_func (g_free);
+      client->group = group != NULL;
+      g_ptr_array_add (service->clients_by_index, client);
+      client->index = service->clients_by_index->len;
+      g_hash_table_insert (service->clients, client->name, client);
+    }
 
-      /* temporarily store a reference to the legacy app handler service object
-       * in the invocation object */
-      g_object_set_data_full (G_OBJECT (invocation), "la-handler-service",
-                              g_object_ref (service), (GDestroyNotify) g_object_unref);
+  /* add the unit to the units stopped by the shutdown consumer */
+  for (n = 0; !known && n < client->units->len; n++)
+    known = g_strcmp0 (g_ptr_array_index (client->units, n), unit) == 0;
+  if (!known)
+    g_ptr_array_add (client->units, g_strdup (unit));
 
-      /* re-register the shutdown consumer with the NSM Consumer */
-      nsm_consumer_call_register_shutdown_client (service->nsm_consumer,
-                                                  existing_bus_name, existing_object_path,
-                                                  shutdown_mode, timeout, NULL,
-                                                  la_handler_service_handle_register_finish,
-                                                  invocation);
+  if (client->group)
+    {
+      /* a group is notified in all shutdown modes of its members and waited for
+       * as long as its slowest member */
+      client->shutdown_mode |= shutdown_mode;
+      client->timeout = MAX (client->timeout, timeout);
     }
   else
     {
-      /* create a new shutdown client and consumer for the unit */
-      bus_name = "org.genivi.NodeStartupController1";
-      object_path = g_strdup_printf ("%s/%u", service->prefix, service->index);
-      client = shutdown_client_new (bus_name, object_path, shutdown_mode, timeout);
-      consumer = shutdown_consumer_skeleton_new ();
-      shutdown_client_set_consumer (client, consumer);
-
-      /* remember the legacy app handler service object in shutdown client */
-      g_object_set_data_full (G_OBJECT (client), "la-handler-service",
-                              g_object_ref (service), (GDestroyNotify) g_object_unref);
-
-      /* implement the LifecycleRequest method of the shutdown consumer */
-      g_signal_connect (consumer, "handle-lifecycle-request",
-                        G_CALLBACK (la_handler_service_handle_consumer_lifecycle_request),
-                        client);
-
-      /* associate the shutdown client with the unit name */
-      g_hash_table_insert (service->units_to_clients, g_strdup (unit),
-                           g_object_ref (client));
-      g_hash_table_insert (service->clients_to_units, g_object_ref (client),
-                           g_strdup (unit));
-
-      /* export the shutdown consumer on the bus */
-      g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (consumer),
-                                        service->connection, object_path, &error);
-      if (error != NULL)
-        {
-          DLT_LOG (la_handler_context, DLT_LOG_ERROR,
-                   DLT_STRING ("Failed to export shutdown consumer on the bus:"),
-                   DLT_STRING (error->message));
-          g_error_free (error);
-        }
-
-      /* temporarily store a reference to the legacy app handler service object
-       * in the invocation object */
-      g_object_set_data_full (G_OBJECT (invocation), "la-handler-service",
-                              g_object_ref (service), (GDestroyNotify) g_object_unref);
-
-      /* register the shutdown consumer with the NSM Consumer */
-      nsm_consumer_call_register_shutdown_client (service->nsm_consumer,
-                                                  bus_name, object_path,
-                                                  shutdown_mode, timeout, NULL,
-                                                  la_handler_service_handle_register_finish,
-                                                  invocation);
+      client->shutdown_mode = shutdown_mode;
+      client->timeout = timeout;
+    }
 
-      /* free strings and release the shutdown consumer */
-      g_free (object_path);
-      g_object_unref (consumer);
+  /* temporarily store a reference to the legacy app handler service object
+   * in the invocation object */
+  g_object_set_data_full (G_OBJECT (invocation), "la-handler-service",
+                          g_object_ref (service), (GDestroyNotify) g_object_unref);
 
-      /* increment the counter for our shutdown consumer object paths */
-      service->index++;
-    }
+  /* register the shutdown consumer with the NSM Consumer */
+  object_path = g_strdup_printf ("%s/%u", LA_HANDLER_SERVICE_PREFIX, client->index);
+  nsm_consumer_call_register_shutdown_client (service->nsm_consumer,
+                                              LA_HANDLER_SERVICE_BUS_NAME, object_path,
+                                              client->shutdown_mode, client->timeout, NULL,
+                                              la_handler_service_handle_register_finish,
+                                              invocation);
+  g_free (object_path);
 
   return TRUE;
 }
@@ -497,49 +898,186 @@ la_handler_service_handle_register_finish (GObject      *object,
 
 
 
-static gboolean
-la_handler_service_handle_consumer_lifecycle_request (ShutdownConsumer      *consumer,
-                                                      GDBusMethodInvocation *invocation,
-                                                      guint                  request,
-                                                      guint                  request_id,
-                                                      ShutdownClient        *client)
+static gchar **
+la_handler_service_subtree_enumerate (GDBusConnection *connection,
+                                      const gchar     *sender,
+                                      const gchar     *object_path,
+                                      gpointer         user_data)
 {
-  LAHandlerServiceData *data;
-  LAHandlerService     *service;
-  gchar                *unit_name;
+  LAHandlerService *service = LA_HANDLER_SERVICE (user_data);
+  gchar           **nodes;
+  guint             n;
 
-  g_return_val_if_fail (IS_SHUTDOWN_CONSUMER (consumer), FALSE);
-  g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), FALSE);
-  g_return_val_if_fail (IS_SHUTDOWN_CLIENT (client), FALSE);
+  /* every registered legacy app is a node of the subtree */
+  nodes = g_new0 (gchar *, service->clients_by_index->len + 1);
+  for (n = 0; n < service->clients_by_index->len; n++)
+    nodes[n] = g_strdup_printf ("%u", n + 1);
 
-  /* get the service from the shutdown client */
-  service = g_object_get_data (G_OBJECT (client), "la-handler-service");
+  return nodes;
+}
+
+
+
+static GDBusInterfaceInfo **
+la_handler_service_subtree_introspect (GDBusConnection *connection,
+                                       const gchar     *sender,
+                                       const gchar     *object_path,
+                                       const gchar     *node,
+                                       gpointer         user_data)
+{
+  GDBusInterfaceInfo **interfaces;
+
+  /* the root of the subtree has no interfaces */
+  if (node == NULL)
+    return NULL;
 
-  /* look up the unit name associated with this shutdown client */
-  unit_name = g_hash_table_lookup (service->clients_to_units, client);
+  /* all nodes implement the shutdown consumer interface */
+  interfaces = g_new0 (GDBusInterfaceInfo *, 2);
+  interfaces[0] = g_dbus_interface_info_ref (shutdown_consumer_interface_info ());
 
-  if (unit_name != NULL)
+  return interfaces;
+}
+
+
+
+static const GDBusInterfaceVTable *
+la_handler_service_subtree_dispatch (GDBusConnection *connection,
+                                     const gchar     *sender,
+                                     const gchar     *object_path,
+                                     const gchar     *interface_name,
+                                     const gchar     *node,
+                                     gpointer        *out_user_data,
+                                     gpointer         user_data)
+{
+  if (node == NULL
+      || g_strcmp0 (interface_name, shutdown_consumer_interface_info ()->name) != 0)
     {
-      data = la_handler_service_data_new (service, NULL, request_id);
+      return NULL;
+    }
+
+  /* the record of the app is looked up when the method is called */
+  *out_user_data = user_data;
+  return &la_handler_service_consumer_vtable;
+}
+
+
+
+static void
+la_handler_service_handle_consumer_method_call (GDBusConnection       *connection,
+                                                const gchar           *sender,
+                                                const gchar           *object_path,
+                                                const gchar           *interface_name,
+                                                const gchar           *method_name,
+                                                GVariant              *parameters,
+                                                GDBusMethodInvocation *invocation,
+                                                gpointer               user_data)
+{
+  LAHandlerServiceClient *client;
+  LAHandlerService       *service = LA_HANDLER_SERVICE (user_data);
+  const gchar            *node;
+  guint                   request;
+  guint                   request_id;
+  gint                    status = NSM_ERROR_STATUS_ERROR;
+
+  if (g_strcmp0 (method_name, "LifecycleRequest") != 0)
+    {
+      g_dbus_method_invocation_return_error (invocation, G_DBUS_ERROR,
+                                             G_DBUS_ERROR_UNKNOWN_METHOD,
+                                             "Unknown method %s", method_name);
+      return;
+    }
+
+  g_variant_get (parameters, "(uu)", &request, &request_id);
 
-      /* stop this unit now */
-      job_manager_stop (service->job_manager, unit_name, NULL,
-                        la_handler_service_handle_consumer_lifecycle_request_finish,
-                        data);
+  /* look up the legacy app by the last element of the object path */
+  node = strrchr (object_path, '/') + 1;
+  client = la_handler_service_lookup_client (service, node);
 
-      /* let the NSM know that we are working on this request */
-      shutdown_consumer_complete_lifecycle_request (consumer, invocation,
-                                                    NSM_ERROR_STATUS_RESPONSE_PENDING);
+  if (client != NULL)
+    {
+      status = la_handler_service_handle_consumer_lifecycle_request (service, client,
+                                                                     request,
+                                                                     request_id);
     }
   else
     {
       /* NSM asked us to shutdown a shutdown consumer we did not register;
        * make it aware by returning an error */
-      shutdown_consumer_complete_lifecycle_request (consumer, invocation,
-                                                    NSM_ERROR_STATUS_ERROR);
+      DLT_LOG (la_handler_context, DLT_LOG_ERROR,
+               DLT_STRING ("Lifecycle request for unknown shutdown consumer:"),
+               DLT_STRING (object_path));
     }
 
-  return TRUE;
+  g_dbus_method_invocation_return_value (invocation, g_variant_new ("(i)", status));
+}
+
+
+
+static LAHandlerServiceClient *
+la_handler_service_lookup_client (LAHandlerService *service,
+                                  const gchar      *node)
+{
+  guint64 index;
+  gchar  *end;
+
+  /* the node is the index of the app, counting from one */
+  index = g_ascii_strtoull (node, &end, 10);
+  if (*node == '\0' || *end != '\0' || index == 0
+      || index > service->clients_by_index->len)
+    {
+      return NULL;
+    }
+
+  return g_ptr_array_index (service->clients_by_index, index - 1);
+}
+
+
+
+static gint
+la_handler_service_handle_consumer_lifecycle_request (LAHandlerService       *service,
+                                                      LAHandlerServiceClient *client,
+                                                      guint                   request,
+                                                      guint                   request_id)
+{
+  LAHandlerServiceData *data;
+  guint                 n;
+
+  data = la_handler_service_data_new (service, NULL, request_id);
+  data->fast = (request & NSM_SHUTDOWN_TYPE_FAST) != 0;
+  data->start_time = g_get_monotonic_time ();
+  data->latency_target =
+    la_handler_service_get_latency_target (service, client->name, data->fast);
+
+  /* queue the units of this consumer so that they are stopped together with the
+   * units of all other lifecycle requests that arrive in the meantime; all units
+   * of the consumer share the request, which completes after the last of them */
+  for (n = 0; n < client->units->len; n++)
+    {
+      g_ptr_array_add (service->stop_units,
+                       g_strdup (g_ptr_array_index (client->units, n)));
+      g_ptr_array_add (service->stop_data, data);
+    }
+  data->n_pending = client->units->len;
+  if (service->stop_id == 0)
+    service->stop_id = g_idle_add (la_handler_service_stop_queued_units, service);
+
+  /* do not let a single member hold up the whole group */
+  if (client->group && client->timeout > 0)
+    {
+      data->timeout_id = g_timeout_add (client->timeout,
+                                        la_handler_service_lifecycle_request_expired,
+                                        data);
+    }
+
+  DLT_LOG (la_handler_context, DLT_LOG_INFO,
+           DLT_STRING ("Handling a lifecycle request:"),
+           DLT_STRING ("consumer"), DLT_STRING (client->name),
+           DLT_STRING ("units"), DLT_UINT (client->units->len),
+           DLT_STRING ("mode"), DLT_STRING (data->fast ? "fast" : "normal"),
+           DLT_STRING ("request id"), DLT_UINT (request_id));
+
+  /* let the NSM know that we are working on this request */
+  return NSM_ERROR_STATUS_RESPONSE_PENDING;
 }
 
 
@@ -552,68 +1090,389 @@ la_handler_service_handle_consumer_lifecycle_request_finish (JobManager  *manage
                                                              gpointer     user_data)
 {
   LAHandlerServiceData *data = (LAHandlerServiceData *)user_data;
-  GError               *err = NULL;
-  gint                  error_status = NSM_ERROR_STATUS_OK;
-  gint                  status = NSM_ERROR_STATUS_OK;
 
   g_return_if_fail (IS_JOB_MANAGER (manager));
   g_return_if_fail (unit != NULL && *unit != '\0');
   g_return_if_fail (result != NULL && *result != '\0');
   g_return_if_fail (data != NULL);
 
-  /* log that we are completing a lifecycle request */
-  DLT_LOG (la_handler_context, DLT_LOG_INFO,
-           DLT_STRING ("Completing a lifecycle request:"),
-           DLT_STRING ("request id"), DLT_UINT (data->request_id));
-
   /* log an error if shutting down the consumer has failed */
   if (error != NULL)
     {
       DLT_LOG (la_handler_context, DLT_LOG_ERROR,
                DLT_STRING ("Failed to shut down a shutdown consumer:"),
-               DLT_STRING (error->message));
+               DLT_STRING ("unit"), DLT_STRING (unit),
+               DLT_STRING ("error message"), DLT_STRING (error->message));
 
       /* send an error back to the NSM */
-      status = NSM_ERROR_STATUS_ERROR;
+      data->status = NSM_ERROR_STATUS_ERROR;
     }
 
   /* log an error if systemd failed to stop the consumer */
   if (g_strcmp0 (result, "failed") == 0)
     {
       DLT_LOG (la_handler_context, DLT_LOG_ERROR,
-               DLT_STRING ("Failed to shutdown a shutdown consumer"));
+               DLT_STRING ("Failed to shutdown a shutdown consumer:"),
+               DLT_STRING ("unit"), DLT_STRING (unit));
 
       /* send an error back to the NSM */
-      status = NSM_ERROR_STATUS_ERROR;
+      data->status = NSM_ERROR_STATUS_ERROR;
     }
 
-  /* let the NSM know that we have handled the lifecycle request */
-  if (!nsm_consumer_call_lifecycle_request_complete_sync (data->service->nsm_consumer,
-                                                          data->request_id, status,
-                                                          &error_status, NULL, &err))
+  /* complete the request once the last of its units has been stopped, unless
+   * its timeout has completed it already */
+  data->n_pending--;
+  if (data->n_pending == 0)
+    {
+      if (!data->completed)
+        la_handler_service_complete_request (data);
+      la_handler_service_data_unref (data);
+    }
+}
+
+
+
+static gboolean
+la_handler_service_lifecycle_request_expired (gpointer user_data)
+{
+  LAHandlerServiceData *data = (LAHandlerServiceData *)user_data;
+
+  DLT_LOG (la_handler_context, DLT_LOG_WARN,
+           DLT_STRING ("Timeout of shutdown group expired:"),
+           DLT_STRING ("request id"), DLT_UINT (data->request_id),
+           DLT_STRING ("units still stopping"), DLT_UINT (data->n_pending));
+
+  /* complete the request without waiting for the remaining units; they are
+   * still being stopped and release the request when they are done */
+  data->timeout_id = 0;
+  data->status = NSM_ERROR_STATUS_ERROR;
+  la_handler_service_complete_request (data);
+
+  return FALSE;
+}
+
+
+
+static void
+la_handler_service_complete_request (LAHandlerServiceData *data)
+{
+  LAHandlerServiceCompletion completion;
+  LAHandlerService          *service = data->service;
+  gint64                     latency;
+
+  if (data->timeout_id > 0)
+    g_source_remove (data->timeout_id);
+  data->timeout_id = 0;
+  data->completed = TRUE;
+
+  /* log that we are completing a lifecycle request and how long it took */
+  latency = (g_get_monotonic_time () - data->start_time) / 1000;
+  DLT_LOG (la_handler_context, DLT_LOG_INFO,
+           DLT_STRING ("Completing a lifecycle request:"),
+           DLT_STRING ("request id"), DLT_UINT (data->request_id),
+           DLT_STRING ("mode"), DLT_STRING (data->fast ? "fast" : "normal"),
+           DLT_STRING ("latency ms"), DLT_INT64 (latency));
+
+  /* warn if the request has missed the latency target of its shutdown mode */
+  if (data->latency_target > 0 && latency > data->latency_target)
+    {
+      DLT_LOG (la_handler_context, DLT_LOG_WARN,
+               DLT_STRING ("Lifecycle request missed its latency target:"),
+               DLT_STRING ("request id"), DLT_UINT (data->request_id),
+               DLT_STRING ("mode"), DLT_STRING (data->fast ? "fast" : "normal"),
+               DLT_STRING ("latency ms"), DLT_INT64 (latency),
+               DLT_STRING ("target ms"), DLT_UINT (data->latency_target));
+    }
+
+  /* queue the result so that it is reported to the NSM together with the
+   * results of all other requests that finish in the meantime */
+  completion.request_id = data->request_id;
+  completion.status = data->status;
+  g_array_append_val (service->completions, completion);
+  if (service->completions_id == 0)
+    {
+      service->completions_id =
+        g_idle_add_full (G_PRIORITY_DEFAULT_IDLE,
+                         la_handler_service_complete_queued_requests,
+                         g_object_ref (service), g_object_unref);
+    }
+}
+
+
+
+static gboolean
+la_handler_service_complete_queued_requests (gpointer user_data)
+{
+  LAHandlerServiceCompletion *completion;
+  LAHandlerService           *service = LA_HANDLER_SERVICE (user_data);
+  guint                       n;
+
+  service->completions_id = 0;
+
+  DLT_LOG (la_handler_context, DLT_LOG_INFO,
+           DLT_STRING ("Completing batch of lifecycle requests:"),
+           DLT_STRING ("requests"), DLT_UINT (service->completions->len));
+
+  /* let the NSM know that we have handled the lifecycle requests, without
+   * waiting for one reply before sending the next call */
+  for (n = 0; n < service->completions->len; n++)
+    {
+      completion = &g_array_index (service->completions, LAHandlerServiceCompletion, n);
+      nsm_consumer_call_lifecycle_request_complete (service->nsm_consumer,
+                                                    completion->request_id,
+                                                    completion->status, NULL,
+                                                    la_handler_service_complete_queued_requests_finish,
+                                                    GUINT_TO_POINTER (completion->request_id));
+    }
+
+  /* start over with an empty queue */
+  g_array_set_size (service->completions, 0);
+
+  return FALSE;
+}
+
+
+
+static void
+la_handler_service_complete_queued_requests_finish (GObject      *object,
+                                                    GAsyncResult *res,
+                                                    gpointer      user_data)
+{
+  NSMConsumer *nsm_consumer = NSM_CONSUMER (object);
+  GError      *error = NULL;
+  guint        request_id = GPOINTER_TO_UINT (user_data);
+  gint         error_status = NSM_ERROR_STATUS_OK;
+
+  if (!nsm_consumer_call_lifecycle_request_complete_finish (nsm_consumer, &error_status,
+                                                            res, &error))
     {
       DLT_LOG (la_handler_context, DLT_LOG_ERROR,
                DLT_STRING ("Failed to notify NSM about completed lifecycle request:"),
-               DLT_STRING ("request id"), DLT_UINT (data->request_id),
-               DLT_STRING ("error message"), DLT_STRING (err->message));
-      g_error_free (err);
+               DLT_STRING ("request id"), DLT_UINT (request_id),
+               DLT_STRING ("error message"), DLT_STRING (error->message));
+      g_error_free (error);
     }
   else if (error_status == NSM_ERROR_STATUS_OK)
     {
       DLT_LOG (la_handler_context, DLT_LOG_INFO,
                DLT_STRING ("Successfully notified NSM about completed "
                            "lifecycle request:"),
-               DLT_STRING ("request id"), DLT_UINT (data->request_id));
+               DLT_STRING ("request id"), DLT_UINT (request_id));
     }
   else
     {
       DLT_LOG (la_handler_context, DLT_LOG_ERROR,
                DLT_STRING ("Failed to notify NSM about completed lifecycle request:"),
-               DLT_STRING ("request id"), DLT_UINT (data->request_id),
+               DLT_STRING ("request id"), DLT_UINT (request_id),
                DLT_STRING ("error status"), DLT_INT (error_status));
     }
+}
+
+
+
+static gboolean
+la_handler_service_stop_queued_units (gpointer user_data)
+{
+  LAHandlerServiceData *data;
+  LAHandlerServiceKill *kill_data;
+  LAHandlerService     *service = LA_HANDLER_SERVICE (user_data);
+  const gchar         **modes;
+  const gchar          *unit;
+  guint                 n_fast = 0;
+  guint                 delay;
+  guint                 n;
+  gint                 *signals;
+
+  service->stop_id = 0;
+
+  /* units of fast shutdowns are stopped with a job that cannot be replaced
+   * by later jobs, so that nothing can delay them, and are killed; this is
+   * decided before the jobs are sent, since finishing them frees the data */
+  modes = g_new0 (const gchar *, service->stop_units->len);
+  signals = g_new0 (gint, service->stop_units->len);
+  for (n = 0; n < service->stop_units->len; n++)
+    {
+      data = g_ptr_array_index (service->stop_data, n);
+      if (data->fast)
+        {
+          unit = g_ptr_array_index (service->stop_units, n);
+          modes[n] = LA_HANDLER_SERVICE_FAST_STOP_MODE;
+          signals[n] = la_handler_service_get_fast_kill_signal (service, unit);
+          n_fast++;
+        }
+    }
+
+  DLT_LOG (la_handler_context, DLT_LOG_INFO,
+           DLT_STRING ("Stopping batch of shutdown consumers:"),
+           DLT_STRING ("units"), DLT_UINT (service->stop_units->len),
+           DLT_STRING ("fast"), DLT_UINT (n_fast));
+
+  /* stop all queued units at once; each job finishes its own request */
+  g_ptr_array_add (service->stop_units, NULL);
+  job_manager_stop_many (service->job_manager,
+                         (const gchar *const *) service->stop_units->pdata,
+                         modes, service->stop_data->pdata, NULL,
+                         la_handler_service_handle_consumer_lifecycle_request_finish,
+                         la_handler_service_stop_queued_units_finish, NULL);
+
+  /* instead of waiting for the units of fast shutdowns to exit gracefully,
+   * kill them once they have had a short grace period to exit on their own */
+  for (n = 0; service->stop_units->pdata[n] != NULL; n++)
+    {
+      if (signals[n] != 0)
+        {
+          unit = g_ptr_array_index (service->stop_units, n);
+
+          kill_data = g_slice_new0 (LAHandlerServiceKill);
+          kill_data->service = g_object_ref (service);
+          kill_data->unit = g_strdup (unit);
+          kill_data->signal_number = signals[n];
+
+          delay = la_handler_service_get_fast_kill_delay (service, unit);
+          if (delay > 0)
+            {
+              g_timeout_add_full (G_PRIORITY_DEFAULT, delay,
+                                  la_handler_service_kill_unit, kill_data,
+                                  (GDestroyNotify) la_handler_service_kill_free);
+            }
+          else
+            {
+              la_handler_service_kill_unit (kill_data);
+              la_handler_service_kill_free (kill_data);
+            }
+        }
+    }
+
+  g_free (signals);
+  g_free (modes);
+
+  /* start over with an empty queue */
+  g_ptr_array_set_size (service->stop_units, 0);
+  g_ptr_array_set_size (service->stop_data, 0);
+
+  return FALSE;
+}
+
+
+
+static void
+la_handler_service_stop_queued_units_finish (JobManager *manager,
+                                             guint       n_jobs,
+                                             guint       n_failed,
+                                             gpointer    user_data)
+{
+  DLT_LOG (la_handler_context, DLT_LOG_INFO,
+           DLT_STRING ("Finished stopping batch of shutdown consumers:"),
+           DLT_STRING ("units"), DLT_UINT (n_jobs),
+           DLT_STRING ("failed"), DLT_UINT (n_failed));
+}
+
+
+
+static LAHandlerServicePolicy *
+la_handler_service_lookup_policy (LAHandlerService *service,
+                                  const gchar      *name)
+{
+  return g_hash_table_lookup (service->policies, name);
+}
+
+
+
+static gint
+la_handler_service_get_fast_kill_signal (LAHandlerService *service,
+                                         const gchar      *unit)
+{
+  LAHandlerServicePolicy *policy;
+
+  /* a unit may override the signal it is killed with, 0 for a graceful stop */
+  policy = la_handler_service_lookup_policy (service, unit);
+  if (policy != NULL && policy->fast_kill_signal >= 0)
+    return policy->fast_kill_signal;
+
+  return service->fast_kill_signal;
+}
+
+
+
+static guint
+la_handler_service_get_fast_kill_delay (LAHandlerService *service,
+                                        const gchar      *unit)
+{
+  LAHandlerServicePolicy *policy;
+
+  policy = la_handler_service_lookup_policy (service, unit);
+  if (policy != NULL && policy->fast_kill_delay >= 0)
+    return policy->fast_kill_delay;
+
+  return service->fast_kill_delay;
+}
+
+
+
+static guint
+la_handler_service_get_latency_target (LAHandlerService *service,
+                                       const gchar      *name,
+                                       gboolean          fast)
+{
+  LAHandlerServicePolicy *policy;
+
+  /* a legacy app or a shutdown group may override the targets of both modes */
+  policy = la_handler_service_lookup_policy (service, name);
+  if (fast && policy != NULL && policy->fast_latency_target >= 0)
+    return policy->fast_latency_target;
+  if (!fast && policy != NULL && policy->normal_latency_target >= 0)
+    return policy->normal_latency_target;
+
+  return fast ? service->fast_latency_target : service->normal_latency_target;
+}
+
+
+
+static gboolean
+la_handler_service_kill_unit (gpointer user_data)
+{
+  LAHandlerServiceKill *kill_data = user_data;
+  SystemdManager       *systemd_manager;
+
+  DLT_LOG (la_handler_context, DLT_LOG_INFO,
+           DLT_STRING ("Killing a shutdown consumer:"),
+           DLT_STRING ("unit"), DLT_STRING (kill_data->unit),
+           DLT_STRING ("signal"), DLT_INT (kill_data->signal_number));
+
+  /* killing a unit that has stopped in the meantime does no harm */
+  g_object_get (kill_data->service->job_manager, "systemd-manager", &systemd_manager,
+                NULL);
+  systemd_manager_call_kill_unit (systemd_manager, kill_data->unit, "all",
+                                  kill_data->signal_number, NULL,
+                                  la_handler_service_kill_unit_finish,
+                                  g_strdup (kill_data->unit));
+  g_object_unref (systemd_manager);
+
+  return FALSE;
+}
+
+
+
+static void
+la_handler_service_kill_unit_finish (GObject      *object,
+                                     GAsyncResult *res,
+                                     gpointer      user_data)
+{
+  SystemdManager *systemd_manager = SYSTEMD_MANAGER (object);
+  GError         *error = NULL;
+  gchar          *unit = user_data;
+
+  /* the stop job is still running if the unit could not be killed */
+  if (!systemd_manager_call_kill_unit_finish (systemd_manager, res, &error))
+    {
+      DLT_LOG (la_handler_context, DLT_LOG_WARN,
+               DLT_STRING ("Failed to kill a shutdown consumer:"),
+               DLT_STRING ("unit"), DLT_STRING (unit),
+               DLT_STRING ("error message"), DLT_STRING (error->message));
+      g_error_free (error);
+    }
 
-  la_handler_service_data_unref (data);
+  g_free (unit);
 }
 
 
@@ -631,6 +1490,7 @@ la_handler_service_data_new (LAHandlerService      *service,
   if (invocation != NULL)
     data->invocation = g_object_ref (invocation);
   data->request_id = request_id;
+  data->status = NSM_ERROR_STATUS_OK;
 
   return data;
 }
@@ -652,6 +1512,128 @@ la_handler_service_data_unref (LAHandlerServiceData *data)
 
 
 
+static void
+la_handler_service_client_free (LAHandlerServiceClient *client)
+{
+  if (client == NULL)
+    return;
+
+  g_free (client->name);
+  g_ptr_array_free (client->units, TRUE);
+  g_slice_free (LAHandlerServiceClient, client);
+}
+
+
+
+static void
+la_handler_service_kill_free (LAHandlerServiceKill *kill_data)
+{
+  if (kill_data == NULL)
+    return;
+
+  g_object_unref (kill_data->service);
+  g_free (kill_data->unit);
+  g_slice_free (LAHandlerServiceKill, kill_data);
+}
+
+
+
+static void
+la_handler_service_policy_free (LAHandlerServicePolicy *policy)
+{
+  g_slice_free (LAHandlerServicePolicy, policy);
+}
+
+
+
+static void
+la_handler_service_deregister_consumer_finish (GObject      *object,
+                                               GAsyncResult *res,
+                                               gpointer      user_data)
+{
+  LAHandlerServiceDeregistrationCall *call = user_data;
+  LAHandlerServiceDeregistration     *deregistration = call->deregistration;
+  NSMConsumer                        *nsm_consumer = NSM_CONSUMER (object);
+  GError                             *error = NULL;
+  gint                                error_code = NSM_ERROR_STATUS_OK;
+
+  /* finish unregistering the shutdown client */
+  if (!nsm_consumer_call_un_register_shutdown_client_finish (nsm_consumer, &error_code,
+                                                             res, &error))
+    {
+      DLT_LOG (la_handler_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to unregister shutdown client:"),
+               DLT_STRING ("object path"), DLT_STRING (call->object_path),
+               DLT_STRING ("consumer"), DLT_STRING (call->name),
+               DLT_STRING ("error message"), DLT_STRING (error->message));
+      g_error_free (error);
+    }
+  else if (error_code != NSM_ERROR_STATUS_OK)
+    {
+      DLT_LOG (la_handler_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to unregister shutdown client:"),
+               DLT_STRING ("object path"), DLT_STRING (call->object_path),
+               DLT_STRING ("consumer"), DLT_STRING (call->name),
+               DLT_STRING ("error code"), DLT_INT (error_code));
+    }
+
+  g_free (call->name);
+  g_free (call->object_path);
+  g_slice_free (LAHandlerServiceDeregistrationCall, call);
+
+  /* complete the operation once the last reply has arrived */
+  deregistration->n_pending--;
+  if (deregistration->result == NULL || deregistration->n_pending == 1)
+    la_handler_service_deregistration_release (deregistration);
+}
+
+
+
+static gboolean
+la_handler_service_deregistration_expired (gpointer user_data)
+{
+  LAHandlerServiceDeregistration *deregistration = user_data;
+
+  DLT_LOG (la_handler_context, DLT_LOG_WARN,
+           DLT_STRING ("Deadline for unregistering shutdown clients expired:"),
+           DLT_STRING ("replies missing"), DLT_UINT (deregistration->n_pending - 1));
+
+  /* complete the operation without waiting for the missing replies */
+  deregistration->deadline_id = 0;
+  g_simple_async_result_set_error (deregistration->result, G_IO_ERROR,
+                                   G_IO_ERROR_TIMED_OUT,
+                                   "%u shutdown clients did not reply in time",
+                                   deregistration->n_pending - 1);
+  la_handler_service_deregistration_release (deregistration);
+
+  return FALSE;
+}
+
+
+
+static void
+la_handler_service_deregistration_release (LAHandlerServiceDeregistration *deregistration)
+{
+  /* complete the operation when it is released for the first time */
+  if (deregistration->result != NULL)
+    {
+      if (deregistration->deadline_id > 0)
+        g_source_remove (deregistration->deadline_id);
+      deregistration->deadline_id = 0;
+
+      g_simple_async_result_complete (deregistration->result);
+      g_object_unref (deregistration->result);
+      deregistration->result = NULL;
+      deregistration->n_pending--;
+    }
+
+  /* free the operation once no more replies are awaited */
+  if (deregistration->n_pending == 0)
+    g_slice_free (LAHandlerServiceDeregistration, deregistration);
+}
+
+
+
 /**
  * la_handler_service_new:
  * @connection: A connection to the system bus.
@@ -682,7 +1664,8 @@ la_handler_service_new (GDBusConnection *connection,
  * @error:   Return location for error or %NULL.
  * 
  * Makes @service export its #LAHandler interface so that it is available to the
- * #legacy-app-handler helper binary.
+ * #legacy-app-handler helper binary, and registers the subtree that serves the
+ * shutdown consumers of the legacy apps.
  * 
  * Returns: %TRUE if the interface was exported successfully, otherwise %FALSE with @error
  * set.
@@ -694,6 +1677,14 @@ la_handler_service_start (LAHandlerService *service,
   g_return_val_if_fail (LA_HANDLER_IS_SERVICE (service), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  /* serve the shutdown consumers of all legacy apps */
+  service->subtree_id =
+    g_dbus_connection_register_subtree (service->connection, LA_HANDLER_SERVICE_PREFIX,
+                                        &la_handler_service_subtree_vtable,
+                                        G_DBUS_SUBTREE_FLAGS_NONE, service, NULL, error);
+  if (service->subtree_id == 0)
+    return FALSE;
+
   /* announce the org.genivi.NodeStartupController1.LegacyAppHandler service on the bus */
   return g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (service->interface),
                                            service->connection,
@@ -724,54 +1715,99 @@ la_handler_service_get_nsm_consumer (LAHandlerService *service)
 /**
  * la_handler_service_deregister_consumers:
  * @service: A #LAHandlerService.
+ * @callback: A #GAsyncReadyCallback to call when the consumers are unregistered.
+ * @user_data: Data to pass to @callback.
  * 
- * Unregisters every #ShutdownClient from the Node State Manager.
- * This method is typically used when the #LAHandlerService is about to shut down.
+ * Asynchronously unregisters the shutdown consumers of all legacy apps from the Node
+ * State Manager. All UnRegisterShutdownClient calls are sent at once and @callback is
+ * called as soon as the last reply has arrived, or when the "deregistration-deadline"
+ * expires. Call la_handler_service_deregister_consumers_finish() from @callback to get
+ * the result of the operation. This method is typically used when the
+ * #LAHandlerService is about to shut down.
  */
 void
-la_handler_service_deregister_consumers (LAHandlerService *service)
+la_handler_service_deregister_consumers (LAHandlerService   *service,
+                                         GAsyncReadyCallback callback,
+                                         gpointer            user_data)
 {
-  GHashTableIter  iter;
-  ShutdownClient *client;
-  const gchar    *bus_name;
-  const gchar    *object_path;
-  const gchar    *unit;
-  GError         *error = NULL;
-  gint            error_code;
-  gint            shutdown_mode;
+  LAHandlerServiceDeregistrationCall *call;
+  LAHandlerServiceDeregistration     *deregistration;
+  LAHandlerServiceClient             *client;
+  GHashTableIter                      iter;
+  const gchar                        *name;
 
   g_return_if_fail (LA_HANDLER_IS_SERVICE (service));
 
-  g_hash_table_iter_init (&iter, service->clients_to_units);
-  while (g_hash_table_iter_next (&iter, (gpointer *)&client, (gpointer *)&unit))
-    {
-      /* extract data from the current client */
-      bus_name = shutdown_client_get_bus_name (client);
-      object_path = shutdown_client_get_object_path (client);
-      shutdown_mode = shutdown_client_get_shutdown_mode (client);
+  deregistration = g_slice_new0 (LAHandlerServiceDeregistration);
+  deregistration->result =
+    g_simple_async_result_new (G_OBJECT (service), callback, user_data,
+                               la_handler_service_deregister_consumers);
 
-      /* unregister the shutdown client */
-      nsm_consumer_call_un_register_shutdown_client_sync (service->nsm_consumer,
-                                                          bus_name, object_path,
-                                                          shutdown_mode, &error_code,
-                                                          NULL, &error);
+  /* hold the operation open until all calls have been sent */
+  deregistration->n_pending = 1;
 
-      if (error != NULL)
-        {
-          DLT_LOG (la_handler_context, DLT_LOG_ERROR,
-                   DLT_STRING ("Failed to unregister shutdown client:"),
-                   DLT_STRING ("object path"), DLT_STRING (object_path),
-                   DLT_STRING ("unit"), DLT_STRING (unit),
-                   DLT_STRING ("error message"), DLT_STRING (error->message));
-          g_error_free (error);
-        }
-      else if (error_code != NSM_ERROR_STATUS_OK)
+  if (service->nsm_consumer != NULL)
+    {
+      g_hash_table_iter_init (&iter, service->clients);
+      while (g_hash_table_iter_next (&iter, (gpointer *)&name, (gpointer *)&client))
         {
-          DLT_LOG (la_handler_context, DLT_LOG_ERROR,
-                   DLT_STRING ("Failed to unregister shutdown client:"),
-                   DLT_STRING ("object path"), DLT_STRING (object_path),
-                   DLT_STRING ("unit"), DLT_STRING (unit),
-                   DLT_STRING ("error code"), DLT_INT (error_code));
+          call = g_slice_new0 (LAHandlerServiceDeregistrationCall);
+          call->deregistration = deregistration;
+          call->name = g_strdup (name);
+          call->object_path = g_strdup_printf ("%s/%u", LA_HANDLER_SERVICE_PREFIX,
+                                               client->index);
+
+          /* unregister the shutdown client without waiting for the reply */
+          nsm_consumer_call_un_register_shutdown_client (service->nsm_consumer,
+                                                         LA_HANDLER_SERVICE_BUS_NAME,
+                                                         call->object_path,
+                                                         client->shutdown_mode,
+                                                         NULL,
+                                                         la_handler_service_deregister_consumer_finish,
+                                                         call);
+          deregistration->n_pending++;
         }
     }
+
+  if (deregistration->n_pending == 1)
+    {
+      /* there is nothing to wait for */
+      g_simple_async_result_complete_in_idle (deregistration->result);
+      g_object_unref (deregistration->result);
+      g_slice_free (LAHandlerServiceDeregistration, deregistration);
+    }
+  else if (service->deregistration_deadline > 0)
+    {
+      /* do not wait longer than the deadline for the slowest reply */
+      deregistration->deadline_id =
+        g_timeout_add (service->deregistration_deadline,
+                       la_handler_service_deregistration_expired, deregistration);
+    }
+}
+
+
+
+/**
+ * la_handler_service_deregister_consumers_finish:
+ * @service: A #LAHandlerService.
+ * @res: The #GAsyncResult passed to the callback.
+ * @error: Return location for errors or %NULL.
+ *
+ * Finishes an operation started with la_handler_service_deregister_consumers().
+ *
+ * Returns: %TRUE if the Node State Manager replied to all UnRegisterShutdownClient
+ * calls before the deadline, %FALSE with a %G_IO_ERROR_TIMED_OUT error otherwise.
+ */
+gboolean
+la_handler_service_deregister_consumers_finish (LAHandlerService *service,
+                                                GAsyncResult     *res,
+                                                GError          **error)
+{
+  g_return_val_if_fail (LA_HANDLER_IS_SERVICE (service), FALSE);
+  g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (service),
+                                                        la_handler_service_deregister_consumers),
+                        FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
 }
@@ -38,14 +38,19 @@ G_BEGIN_DECLS
 typedef struct _LAHandlerServiceClass LAHandlerServiceClass;
 typedef struct _LAHandlerService      LAHandlerService;
 
-GType             la_handler_service_get_type             (void) G_GNUC_CONST;
-
-LAHandlerService *la_handler_service_new                  (GDBusConnection    *connection,
-                                                           JobManager         *job_manager) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
-gboolean          la_handler_service_start                (LAHandlerService   *service,
-                                                           GError            **error);
-NSMConsumer      *la_handler_service_get_nsm_consumer     (LAHandlerService   *service);
-void              la_handler_service_deregister_consumers (LAHandlerService   *service);
+GType             la_handler_service_get_type                    (void) G_GNUC_CONST;
+
+LAHandlerService *la_handler_service_new                         (GDBusConnection    *connection,
+                                                                  JobManager         *job_manager) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gboolean          la_handler_service_start                       (LAHandlerService   *service,
+                                                                  GError            **error);
+NSMConsumer      *la_handler_service_get_nsm_consumer            (LAHandlerService   *service);
+void              la_handler_service_deregister_consumers        (LAHandlerService   *service,
+                                                                  GAsyncReadyCallback callback,
+                                                                  gpointer            user_data);
+gboolean          la_handler_service_deregister_consumers_finish (LAHandlerService   *service,
+                                                                  GAsyncResult       *res,
+                                                                  GError            **error);
 
 G_END_DECLS
 
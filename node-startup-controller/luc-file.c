@@ -0,0 +1,286 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <glib.h>
+
+#include <node-startup-controller/luc-file.h>
+
+
+
+/**
+ * SECTION: luc-file
+ * @title: LUC file
+ * @short_description: Reading and writing the file format of the Last User Context.
+ * @stability: Internal
+ *
+ * The Last User Context (LUC) is stored as a serialized #GVariant of type "a{ias}".
+ * Since version 2 of the file format, the serialized #GVariant is preceded by a header
+ * of 16 bytes which consists of the following little-endian fields:
+ *
+ *  * A magic number, the four characters "NSCL".
+ *
+ *  * The version of the file format, which is 2.
+ *
+ *  * The length of the serialized #GVariant in bytes.
+ *
+ *  * The Adler-32 checksum of the serialized #GVariant.
+ *
+ * luc_file_load() maps the file into memory and creates the #GVariant directly on top
+ * of the mapped file, without copying it. The header is validated before, so that a
+ * truncated or corrupted file is detected. Files without a header are loaded as
+ * version 1 files, in which case the #GVariant is checked to be in normal form instead.
+ */
+
+
+
+/* version of the file format written by luc_file_build() */
+#define LUC_FILE_VERSION      2
+
+/* size of the header in bytes */
+#define LUC_FILE_HEADER_SIZE  16
+
+/* the largest number of bytes that can be added up before the
+ * Adler-32 sums have to be reduced to avoid an overflow */
+#define LUC_FILE_ADLER_BLOCK  5552
+#define LUC_FILE_ADLER_BASE   65521
+
+
+
+static const gchar luc_file_magic[4] = { 'N', 'S', 'C', 'L' };
+
+
+
+static guint32 luc_file_adler32    (const guchar *data,
+                                    gsize         length);
+static guint32 luc_file_get_uint32 (const gchar  *data);
+static void    luc_file_set_uint32 (gchar        *data,
+                                    guint32       value);
+
+
+
+static guint32
+luc_file_adler32 (const guchar *data,
+                  gsize         length)
+{
+  guint32 a = 1;
+  guint32 b = 0;
+  gsize   n;
+
+  while (length > 0)
+    {
+      /* add up a block of bytes, then reduce the sums */
+      n = MIN (length, LUC_FILE_ADLER_BLOCK);
+      length -= n;
+      while (n-- > 0)
+        {
+          a += *data++;
+          b += a;
+        }
+      a %= LUC_FILE_ADLER_BASE;
+      b %= LUC_FILE_ADLER_BASE;
+    }
+
+  return (b << 16) | a;
+}
+
+
+
+static guint32
+luc_file_get_uint32 (const gchar *data)
+{
+  guint32 value;
+
+  /* the header is not necessarily aligned */
+  memcpy (&value, data, sizeof (value));
+  return GUINT32_FROM_LE (value);
+}
+
+
+
+static void
+luc_file_set_uint32 (gchar  *data,
+                     guint32 value)
+{
+  value = GUINT32_TO_LE (value);
+  memcpy (data, &value, sizeof (value));
+}
+
+
+
+GQuark
+luc_file_error_quark (void)
+{
+  return g_quark_from_static_string ("luc-file-error-quark");
+}
+
+
+
+/**
+ * luc_file_load:
+ * @path: The path of the LUC file.
+ * @version: Return location for the version of the file format, or %NULL.
+ * @error: The location of the error raised, or %NULL.
+ *
+ * Maps the LUC file at @path into memory and validates it.
+ *
+ * Returns: A #GVariant of the form "a{ias}" which refers to the mapped file, or %NULL
+ * if the file could not be mapped or is invalid, in which case @error is set.
+ */
+GVariant *
+luc_file_load (const gchar *path,
+               guint       *version,
+               GError     **error)
+{
+  GMappedFile *mapped_file;
+  const gchar *contents;
+  const gchar *data;
+  GVariant    *context;
+  guint32      file_version = 1;
+  guint32      data_len;
+  guint32      checksum;
+  gsize        length;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  mapped_file = g_mapped_file_new (path, FALSE, error);
+  if (mapped_file == NULL)
+    return NULL;
+
+  contents = g_mapped_file_get_contents (mapped_file);
+  length = g_mapped_file_get_length (mapped_file);
+
+  if (length >= LUC_FILE_HEADER_SIZE
+      && memcmp (contents, luc_file_magic, sizeof (luc_file_magic)) == 0)
+    {
+      /* validate the header and the contents */
+      file_version = luc_file_get_uint32 (contents + 4);
+      data_len = luc_file_get_uint32 (contents + 8);
+      checksum = luc_file_get_uint32 (contents + 12);
+      data = contents + LUC_FILE_HEADER_SIZE;
+
+      if (file_version != LUC_FILE_VERSION)
+        {
+          g_set_error (error, LUC_FILE_ERROR, LUC_FILE_ERROR_VERSION,
+                       "Unsupported LUC file version %u in \"%s\"", file_version, path);
+          g_mapped_file_unref (mapped_file);
+          return NULL;
+        }
+
+      if (data_len != length - LUC_FILE_HEADER_SIZE)
+        {
+          g_set_error (error, LUC_FILE_ERROR, LUC_FILE_ERROR_INVALID,
+                       "LUC file \"%s\" has %" G_GSIZE_FORMAT " bytes of data instead "
+                       "of %u", path, length - LUC_FILE_HEADER_SIZE, data_len);
+          g_mapped_file_unref (mapped_file);
+          return NULL;
+        }
+
+      if (luc_file_adler32 ((const guchar *) data, data_len) != checksum)
+        {
+          g_set_error (error, LUC_FILE_ERROR, LUC_FILE_ERROR_CHECKSUM,
+                       "Checksum mismatch in LUC file \"%s\"", path);
+          g_mapped_file_unref (mapped_file);
+          return NULL;
+        }
+    }
+  else
+    {
+      /* files of version 1 consist of the serialized GVariant only */
+      data = contents;
+      data_len = length;
+    }
+
+  /* an empty dictionary is serialized to zero bytes, which cannot be mapped */
+  if (data_len == 0)
+    {
+      g_mapped_file_unref (mapped_file);
+      context = g_variant_new_array (G_VARIANT_TYPE ("{ias}"), NULL, 0);
+    }
+  else
+    {
+      /* create the GVariant on top of the mapped file, which is released
+       * together with the GVariant */
+      context = g_variant_new_from_data (G_VARIANT_TYPE ("a{ias}"), data, data_len,
+                                         FALSE, (GDestroyNotify) g_mapped_file_unref,
+                                         mapped_file);
+    }
+  g_variant_ref_sink (context);
+
+  /* without a checksum, make sure that version 1 files are at least well-formed */
+  if (file_version == 1 && !g_variant_is_normal_form (context))
+    {
+      g_set_error (error, LUC_FILE_ERROR, LUC_FILE_ERROR_INVALID,
+                   "LUC file \"%s\" is corrupted", path);
+      g_variant_unref (context);
+      return NULL;
+    }
+
+  if (version != NULL)
+    *version = file_version;
+
+  return context;
+}
+
+
+
+/**
+ * luc_file_build:
+ * @context: A #GVariant of the form "a{ias}".
+ * @length: Return location for the length of the returned data.
+ *
+ * Serializes @context into the current version of the LUC file format.
+ *
+ * Returns: The contents of the LUC file. Free with g_free().
+ */
+gchar *
+luc_file_build (GVariant *context,
+                gsize    *length)
+{
+  gconstpointer data;
+  gchar        *contents;
+  gsize         data_len;
+
+  g_return_val_if_fail (context != NULL, NULL);
+  g_return_val_if_fail (g_variant_is_of_type (context, G_VARIANT_TYPE ("a{ias}")), NULL);
+  g_return_val_if_fail (length != NULL, NULL);
+
+  data = g_variant_get_data (context);
+  data_len = g_variant_get_size (context);
+
+  /* write the header, followed by the serialized context */
+  contents = g_malloc (LUC_FILE_HEADER_SIZE + data_len);
+  memcpy (contents, luc_file_magic, sizeof (luc_file_magic));
+  luc_file_set_uint32 (contents + 4, LUC_FILE_VERSION);
+  luc_file_set_uint32 (contents + 8, data_len);
+  luc_file_set_uint32 (contents + 12, luc_file_adler32 (data, data_len));
+  if (data_len > 0)
+    memcpy (contents + LUC_FILE_HEADER_SIZE, data, data_len);
+
+  *length = LUC_FILE_HEADER_SIZE + data_len;
+  return contents;
+}
@@ -0,0 +1,54 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifndef __LUC_FILE_H__
+#define __LUC_FILE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define LUC_FILE_ERROR (luc_file_error_quark ())
+
+/**
+ * LUCFileError:
+ * @LUC_FILE_ERROR_INVALID: The file is truncated or not a LUC file.
+ * @LUC_FILE_ERROR_VERSION: The file has a version that is not supported.
+ * @LUC_FILE_ERROR_CHECKSUM: The checksum of the file does not match its contents.
+ *
+ * Errors raised when loading a LUC file.
+ */
+typedef enum
+{
+  LUC_FILE_ERROR_INVALID,
+  LUC_FILE_ERROR_VERSION,
+  LUC_FILE_ERROR_CHECKSUM,
+} LUCFileError;
+
+GQuark    luc_file_error_quark (void) G_GNUC_CONST;
+
+GVariant *luc_file_load        (const gchar *path,
+                                guint       *version,
+                                GError     **error) G_GNUC_WARN_UNUSED_RESULT;
+gchar    *luc_file_build       (GVariant    *context,
+                                gsize       *length) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+
+G_END_DECLS
+
+#endif /* !__LUC_FILE_H__ */
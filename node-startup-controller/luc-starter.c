@@ -32,6 +32,7 @@
 
 #include <common/nsm-lifecycle-control-dbus.h>
 
+#include <node-startup-controller/config-file.h>
 #include <node-startup-controller/job-manager.h>
 #include <node-startup-controller/luc-starter.h>
 #include <node-startup-controller/node-startup-controller-service.h>
@@ -51,28 +52,100 @@
  * the LUC applications. To start the LUC applications, the #LUCStarter will do the
  * following in order:
  *
- * 1. Checks with the Node State Manager (NSM) if starting the LUC applications
- *    is required. If it is not required, it notifies the groups of current applications
- *    that the start of the LUC has been processed, which never happens because starting
- *    the LUC is not required.
+ * 1. Asks the Node State Manager (NSM) asynchronously if starting the LUC applications
+ *    is required.
  *
- * If starting the LUC is required:
+ * 2. While the NSM has not answered yet, reads the LUC using the
+ *    node_startup_controller_service_read_luc(), creates the groups and sorts them
+ *    into the start order, so that the first group can be started as soon as the
+ *    answer arrives. If the "preflight" property is set, all LUC units are resolved
+ *    in systemd with a single ListUnitsByNames call before any group is started.
+ *    Units that cannot be loaded, e.g. because they have been uninstalled since they
+ *    were registered, are removed from their groups, so that they never hold up a
+ *    group. The load states are cached for the lifetime of the process, i.e. for the
+ *    current boot. If the "skip-active" property is set, the same call also takes a
+ *    snapshot of the active states of all LUC units. Units that are already active,
+ *    e.g. because they were pulled in by a dependency or through socket activation,
+ *    count as started as soon as their group is started, without a systemd job.
+ *    If the "speculative-start" property is set, the groups of prioritised LUC types
+ *    are started right away. If the NSM does not answer within the "nsm-deadline",
+ *    starting the LUC is assumed to be required.
  *
- * 2. Removes the current user context.
+ * 3. If starting the LUC is not required, cancels any speculatively started apps and
+ *    notifies that the start of the LUC has been processed. If the NSM only answers
+ *    after its deadline has expired, the apps started in the meantime are cancelled
+ *    as well.
  *
- * 3. Reads the LUC using the node_startup_controller_service_read_luc().
+ * If starting the LUC is required:
  *
  * 4. Starts the LUC applications asynchronously and in prioritised groups. The group of
  *    applications, which belong to the most prioritised LUC type, start first and then
- *    the next group of applications are started in the order of the prioritized types
- *    set at build-time, then in numerical order.
- *    When an application is started, the #LUCStarter keeps it in a table, associates
- *    this application with its #GCancellable (so it is possible to cancel each
- *    respective application if the start of the LUC is cancelled), and start the service
- *    calling the start method to #JobManager and passing its #GCancellable.
+ *    the next group of applications are started in the order of the prioritized types,
+ *    then in the order of their weights (higher weights first), then in numerical order.
+ *    Groups are always started in this order, but a group does not necessarily wait
+ *    for the previous group to finish. The next group is started as soon as the
+ *    "release-threshold" percentage of the apps in the previous group has been
+ *    started, or when the "release-deadline" of the previous group expires. By
+ *    default, the threshold is 100% and there is no deadline, so that each group
+ *    waits for the previous one to finish completely.
+ *    The apps of a started group are appended to a ready queue. Apps are taken from
+ *    this queue in order and handed over to the #JobManager as long as the number of
+ *    apps being started does not exceed the "max-in-flight" limit and the limit set
+ *    for the LUC type of the app with luc_starter_set_type_max_in_flight(). Apps of a
+ *    LUC type that has reached its limit do not hold up apps of other types.
+ *    All apps taken from the queue in one go are handed over to the #JobManager as a
+ *    single batch with job_manager_start_many(), so that starting a group costs
+ *    roughly one D-Bus round trip rather than one per app. When an application is
+ *    started, the #LUCStarter keeps it in a table and associates it with the
+ *    #GCancellable of its batch, so that it is possible to cancel the applications if
+ *    the start of the LUC is cancelled.
+ *    An app that has not finished starting within the "app-deadline" is detached from
+ *    its group: the group no longer waits for it and its slot is given to the next app
+ *    in the ready queue, while the job itself keeps running. Likewise, when the
+ *    "group-deadline" of a group expires, all of its apps that have not finished
+ *    starting yet are detached, so that a hanging unit cannot block the start of the
+ *    LUC forever. Every expired deadline is logged with the time elapsed.
+ *    If the "transient-targets" property is set, the apps of a group bypass the ready
+ *    queue. Instead, the group is started with a single job through
+ *    job_manager_start_transient(), which creates a transient target named
+ *    "luc-group-&lt;type&gt;.target" that wants all apps of the group. systemd then
+ *    computes a single transaction for the whole group. When the job of the target
+ *    has finished, the states of the apps are checked with one ListUnitsByNames call
+ *    and apps that are not active are logged as failed. The "max-in-flight" limits
+ *    and the "app-deadline" do not apply to such groups, while the "group-deadline"
+ *    does. The target is started with the start mode of the group, unless that is
+ *    "ignore-dependencies" or "ignore-requirements", which would make systemd ignore
+ *    the apps the target wants; %JOB_MANAGER_DEFAULT_MODE is used then. If systemd
+ *    refuses to create the target, the group and all further groups are started app
+ *    by app instead.
  *
  * 5. Notifies the groups of applications that the start of the LUC has been processed.
- *    
+ *    This happens when all groups have finished starting.
+ *
+ * Apps are started with the systemd job mode given by the "start-mode" property, or
+ * with the "prioritised-start-mode" if their LUC type is prioritised. A mode like
+ * "ignore-dependencies" for prioritised apps makes the transactions systemd has to
+ * compute during the start-up burst smaller, and "replace" lets the start of an app
+ * replace a conflicting job instead of failing. If no mode is set, the #JobManager
+ * uses %JOB_MANAGER_DEFAULT_MODE. Modes read from the configuration file that systemd
+ * does not accept are ignored with a warning.
+ *
+ * The "release-threshold", "release-deadline", "max-in-flight", "app-deadline",
+ * "group-deadline", "nsm-deadline", "speculative-start", "start-mode",
+ * "prioritised-start-mode", "preflight", "skip-active" and "transient-targets"
+ * properties are initialized from the %ReleaseThreshold, %ReleaseDeadline,
+ * %MaxInFlight, %AppDeadline, %GroupDeadline, %NSMDeadline, %SpeculativeStart,
+ * %StartMode, %PrioritisedStartMode, %Preflight, %SkipActive and %TransientTargets
+ * keys in the %LUCStarter group of the configuration file.
+ *
+ * The priority policy is loaded from the configuration file as well. The ordered list
+ * of prioritised LUC types is read from the %PrioritisedTypes key in the %LUCStarter
+ * group; if it is not set, the list defined at build-time with
+ * --with-prioritised-luc-types is used. Groups named "LUC Type &lt;type&gt;" may define
+ * a %Weight, a %MaxInFlight limit and %AppDeadline, %GroupDeadline and %StartMode
+ * values overriding the defaults for the apps of that LUC type. The policy is turned
+ * into a table of #LUCStarterTypePolicy entries once, so that looking up the rank of a
+ * LUC type while sorting the start order is cheap.
  */
 
 
@@ -96,37 +169,114 @@ enum
   PROP_0,
   PROP_JOB_MANAGER,
   PROP_NODE_STARTUP_CONTROLLER,
+  PROP_RELEASE_THRESHOLD,
+  PROP_RELEASE_DEADLINE,
+  PROP_MAX_IN_FLIGHT,
+  PROP_APP_DEADLINE,
+  PROP_GROUP_DEADLINE,
+  PROP_NSM_DEADLINE,
+  PROP_SPECULATIVE_START,
+  PROP_START_MODE,
+  PROP_PRIORITISED_START_MODE,
+  PROP_PREFLIGHT,
+  PROP_SKIP_ACTIVE,
+  PROP_TRANSIENT_TARGETS,
 };
 
 
-static void luc_starter_constructed               (GObject      *object);
-static void luc_starter_finalize                  (GObject      *object);
-static void luc_starter_get_property              (GObject      *object,
-                                                   guint         prop_id,
-                                                   GValue       *value,
-                                                   GParamSpec   *pspec);
-static void luc_starter_set_property              (GObject      *object,
-                                                   guint         prop_id,
-                                                   const GValue *value,
-                                                   GParamSpec   *pspec);
-static gint luc_starter_compare_luc_types         (gconstpointer a,
-                                                   gconstpointer b,
-                                                   gpointer      user_data);
-static void luc_starter_start_next_group          (LUCStarter   *starter);
-static void luc_starter_start_app                 (const gchar  *app,
-                                                   LUCStarter   *starter);
-static void luc_starter_start_app_finish          (JobManager   *manager,
-                                                   const gchar  *unit,
-                                                   const gchar  *result,
-                                                   GError       *error,
-                                                   gpointer      user_data);
-static void luc_starter_cancel_start              (const gchar  *app,
-                                                   GCancellable *cancellable,
-                                                   gpointer      user_data);
-static void luc_starter_check_luc_required_finish (GObject      *object,
-                                                   GAsyncResult *res,
-                                                   gpointer      user_data);
-static void luc_starter_start_groups_for_real     (LUCStarter   *starter);
+
+typedef struct _LUCStarterTypePolicy LUCStarterTypePolicy;
+typedef struct _LUCStarterGroup      LUCStarterGroup;
+typedef struct _LUCStarterApp        LUCStarterApp;
+typedef struct _LUCStarterUnitState  LUCStarterUnitState;
+
+
+
+static void                  luc_starter_constructed               (GObject              *object);
+static void                  luc_starter_finalize                  (GObject              *object);
+static void                  luc_starter_get_property              (GObject              *object,
+                                                                    guint                 prop_id,
+                                                                    GValue               *value,
+                                                                    GParamSpec           *pspec);
+static void                  luc_starter_set_property              (GObject              *object,
+                                                                    guint                 prop_id,
+                                                                    const GValue         *value,
+                                                                    GParamSpec           *pspec);
+static gint                  luc_starter_compare_luc_types         (gconstpointer         a,
+                                                                    gconstpointer         b,
+                                                                    gpointer              user_data);
+static void                  luc_starter_schedule                  (LUCStarter           *starter);
+static gboolean              luc_starter_may_start_next_group      (LUCStarter           *starter);
+static void                  luc_starter_start_next_group          (LUCStarter           *starter);
+static void                  luc_starter_admit                     (LUCStarter           *starter);
+static void                  luc_starter_enqueue_app               (const gchar          *name,
+                                                                    LUCStarterGroup      *group);
+static void                  luc_starter_start_app                 (LUCStarterApp        *app,
+                                                                    GCancellable         *cancellable);
+static void                  luc_starter_start_app_finish          (JobManager           *manager,
+                                                                    const gchar          *unit,
+                                                                    const gchar          *result,
+                                                                    GError               *error,
+                                                                    gpointer              user_data);
+static void                  luc_starter_start_apps_finish         (JobManager           *manager,
+                                                                    guint                 n_jobs,
+                                                                    guint                 n_failed,
+                                                                    gpointer              user_data);
+static void                  luc_starter_cancel_start              (LUCStarterApp        *app,
+                                                                    gpointer              value,
+                                                                    gpointer              user_data);
+static void                  luc_starter_check_luc_required_finish (GObject              *object,
+                                                                    GAsyncResult         *res,
+                                                                    gpointer              user_data);
+static gboolean              luc_starter_nsm_deadline_expired      (gpointer              user_data);
+static void                  luc_starter_nsm_answered              (LUCStarter           *starter,
+                                                                    gboolean              luc_required);
+static void                  luc_starter_prepare_groups            (LUCStarter           *starter);
+static void                  luc_starter_preflight                 (LUCStarter           *starter);
+static void                  luc_starter_preflight_finish          (GObject              *object,
+                                                                    GAsyncResult         *res,
+                                                                    gpointer              user_data);
+static void                  luc_starter_prune_groups              (LUCStarter           *starter);
+static gboolean              luc_starter_unit_is_active            (LUCStarter           *starter,
+                                                                    const gchar          *name);
+static void                  luc_starter_unit_state_free           (LUCStarterUnitState  *state);
+static void                  luc_starter_finish                    (LUCStarter           *starter);
+static LUCStarterGroup      *luc_starter_group_new                 (LUCStarter           *starter,
+                                                                    gint                  type,
+                                                                    gchar               **apps);
+static void                  luc_starter_group_free                (LUCStarterGroup      *group);
+static gboolean              luc_starter_group_is_released         (LUCStarterGroup      *group);
+static void                  luc_starter_group_finished            (LUCStarterGroup      *group);
+static gboolean              luc_starter_group_release_expired     (gpointer              user_data);
+static gboolean              luc_starter_group_deadline_expired    (gpointer              user_data);
+static void                  luc_starter_group_start_target        (LUCStarterGroup      *group,
+                                                                    GPtrArray            *apps);
+static void                  luc_starter_group_target_finish       (JobManager           *manager,
+                                                                    const gchar          *unit,
+                                                                    const gchar          *result,
+                                                                    GError               *error,
+                                                                    gpointer              user_data);
+static void                  luc_starter_group_target_checked      (GObject              *object,
+                                                                    GAsyncResult         *res,
+                                                                    gpointer              user_data);
+static void                  luc_starter_group_target_done         (LUCStarterGroup      *group);
+static void                  luc_starter_app_detach                (LUCStarterApp        *app);
+static gboolean              luc_starter_app_deadline_expired      (gpointer              user_data);
+static void                  luc_starter_app_free                  (LUCStarterApp        *app);
+static void                  luc_starter_load_policy               (LUCStarter           *starter,
+                                                                    GKeyFile             *config);
+static gchar                *luc_starter_load_start_mode           (GKeyFile             *config,
+                                                                    const gchar          *group,
+                                                                    const gchar          *key);
+static LUCStarterTypePolicy *luc_starter_get_policy                (LUCStarter           *starter,
+                                                                    gint                  type);
+static guint                 luc_starter_get_app_deadline          (LUCStarter           *starter,
+                                                                    gint                  type);
+static guint                 luc_starter_get_group_deadline        (LUCStarter           *starter,
+                                                                    gint                  type);
+static const gchar          *luc_starter_get_start_mode            (LUCStarter           *starter,
+                                                                    gint                  type);
+static void                  luc_starter_type_policy_free          (LUCStarterTypePolicy *policy);
 
 
 
@@ -143,12 +293,133 @@ struct _LUCStarter
   NodeStartupControllerService  *node_startup_controller;
   NSMLifecycleControl           *nsm_lifecycle_control;
 
-  GArray                        *prioritised_types;
+  /* mapping of LUC types to their LUCStarterTypePolicy */
+  GHashTable                    *policies;
 
+  /* percentage of a group that has to be started before the next
+   * group is released, and the deadline after which it is released anyway */
+  guint                          release_threshold;
+  guint                          release_deadline;
+
+  /* ordered LUC types and the mapping of LUC types to LUCStarterGroups */
   GArray                        *start_order;
   GHashTable                    *start_groups;
 
-  GHashTable                    *cancellables;
+  /* index of the next group in the start order to be started */
+  guint                          next_group;
+  guint                          n_groups_finished;
+  gboolean                       finished;
+
+  /* queue of LUCStarterApps waiting to be started */
+  GQueue                        *ready;
+
+  /* set of LUCStarterApps that are currently being started, and the set of
+   * detached LUCStarterApps whose jobs are still running */
+  GHashTable                    *starting;
+  GHashTable                    *stragglers;
+
+  /* global limit for the number of apps being started; limits per
+   * LUC type are part of the policies */
+  guint                          max_in_flight;
+
+  /* milliseconds after which an app or a whole group is detached, or 0 */
+  guint                          app_deadline;
+  guint                          group_deadline;
+
+  /* whether the answer of the NSM is still awaited, whether its deadline
+   * has expired, and the source ID of the deadline */
+  gboolean                       nsm_pending;
+  gboolean                       nsm_timed_out;
+  guint                          nsm_deadline;
+  guint                          nsm_deadline_id;
+
+  /* whether prioritised groups are started before the NSM has answered */
+  gboolean                       speculative_start;
+
+  /* systemd job modes for starting apps and prioritised apps, or NULL */
+  gchar                         *start_mode;
+  gchar                         *prioritised_start_mode;
+
+  /* whether LUC units are resolved before the groups are started, whether
+   * units that are already active are skipped, the units being resolved
+   * and the cached LUCStarterUnitStates by unit name */
+  gboolean                       preflight;
+  gboolean                       skip_active;
+  GPtrArray                     *preflight_units;
+  GHashTable                    *unit_states;
+
+  /* whether groups are started through a transient target */
+  gboolean                       transient_targets;
+
+  gboolean                       cancelled;
+};
+
+struct _LUCStarterTypePolicy
+{
+  /* position in the list of prioritised types, or G_MAXINT */
+  gint   rank;
+
+  /* order of types with the same rank; higher weights start first */
+  gint   weight;
+
+  /* limit for the number of apps being started, or 0 */
+  guint  max_in_flight;
+
+  /* start deadlines overriding the defaults, or -1 */
+  gint   app_deadline;
+  gint   group_deadline;
+
+  /* systemd job mode overriding the defaults, or NULL */
+  gchar *start_mode;
+};
+
+struct _LUCStarterGroup
+{
+  LUCStarter   *starter;
+  gint          type;
+
+  /* all apps of the group, the number of apps that have been started
+   * and the number of apps that are currently being started */
+  GPtrArray    *apps;
+  guint         n_finished;
+  guint         n_in_flight;
+
+  /* whether the next group may be started, and the source ID of the
+   * timeout that releases the next group when the deadline expires */
+  gboolean      released;
+  guint         release_id;
+
+  /* source ID of the start deadline and the time the group was started */
+  guint         deadline_id;
+  gint64        start_time;
+
+  /* the apps started through the transient target of the group, the
+   * cancellable of its job and whether the group stopped waiting for it */
+  gchar       **targeted;
+  GCancellable *cancellable;
+  gboolean      target_detached;
+};
+
+struct _LUCStarterUnitState
+{
+  /* the load state of the unit in systemd, e.g. "loaded" or "not-found",
+   * and its active state when the LUC was last started, e.g. "active" */
+  gchar *load_state;
+  gchar *active_state;
+};
+
+struct _LUCStarterApp
+{
+  LUCStarter      *starter;
+  LUCStarterGroup *group;
+  gchar           *name;
+  GCancellable    *cancellable;
+
+  /* whether the group no longer waits for the app, the source ID of
+   * its start deadline and the time the app was started */
+  gboolean         detached;
+  guint            deadline_id;
+  gint64           start_time;
 };
 
 
@@ -193,6 +464,135 @@ luc_starter_class_init (LUCStarterClass *klass)
                                                         G_PARAM_CONSTRUCT_ONLY |
                                                         G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (gobject_class,
+                                   PROP_RELEASE_THRESHOLD,
+                                   g_param_spec_uint ("release-threshold",
+                                                      "release-threshold",
+                                                      "Percentage of a group that has to"
+                                                      " be started before the next group"
+                                                      " is started",
+                                                      0, 100, 100,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_RELEASE_DEADLINE,
+                                   g_param_spec_uint ("release-deadline",
+                                                      "release-deadline",
+                                                      "Milliseconds after which the next"
+                                                      " group is started, or 0",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_MAX_IN_FLIGHT,
+                                   g_param_spec_uint ("max-in-flight",
+                                                      "max-in-flight",
+                                                      "Maximum number of apps being"
+                                                      " started at the same time, or 0",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_APP_DEADLINE,
+                                   g_param_spec_uint ("app-deadline",
+                                                      "app-deadline",
+                                                      "Milliseconds after which an app"
+                                                      " that is being started is"
+                                                      " detached from its group, or 0",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_GROUP_DEADLINE,
+                                   g_param_spec_uint ("group-deadline",
+                                                      "group-deadline",
+                                                      "Milliseconds after which all"
+                                                      " unfinished apps of a group are"
+                                                      " detached from it, or 0",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_NSM_DEADLINE,
+                                   g_param_spec_uint ("nsm-deadline",
+                                                      "nsm-deadline",
+                                                      "Milliseconds after which the LUC"
+                                                      " is started if the NSM has not"
+                                                      " answered, or 0",
+                                                      0, G_MAXUINT, 0,
+                                                      G_PARAM_READWRITE |
+                                                      G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_SPECULATIVE_START,
+                                   g_param_spec_boolean ("speculative-start",
+                                                         "speculative-start",
+                                                         "Whether prioritised groups are"
+                                                         " started before the NSM has"
+                                                         " answered",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_START_MODE,
+                                   g_param_spec_string ("start-mode",
+                                                        "start-mode",
+                                                        "Systemd job mode for starting"
+                                                        " apps, or NULL",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_PRIORITISED_START_MODE,
+                                   g_param_spec_string ("prioritised-start-mode",
+                                                        "prioritised-start-mode",
+                                                        "Systemd job mode for starting"
+                                                        " apps of prioritised LUC types,"
+                                                        " or NULL",
+                                                        NULL,
+                                                        G_PARAM_READWRITE |
+                                                        G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_PREFLIGHT,
+                                   g_param_spec_boolean ("preflight",
+                                                         "preflight",
+                                                         "Whether LUC units that cannot"
+                                                         " be loaded are removed before"
+                                                         " the groups are started",
+                                                         TRUE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_SKIP_ACTIVE,
+                                   g_param_spec_boolean ("skip-active",
+                                                         "skip-active",
+                                                         "Whether LUC units that are"
+                                                         " already active are not started"
+                                                         " again",
+                                                         TRUE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (gobject_class,
+                                   PROP_TRANSIENT_TARGETS,
+                                   g_param_spec_boolean ("transient-targets",
+                                                         "transient-targets",
+                                                         "Whether each LUC group is"
+                                                         " started through a transient"
+                                                         " target",
+                                                         FALSE,
+                                                         G_PARAM_READWRITE |
+                                                         G_PARAM_STATIC_STRINGS));
+
   luc_starter_signals[SIGNAL_LUC_GROUPS_STARTED] =
     g_signal_new ("luc-groups-started",
                   TYPE_LUC_STARTER,
@@ -207,14 +607,74 @@ luc_starter_class_init (LUCStarterClass *klass)
 static void
 luc_starter_init (LUCStarter *starter)
 {
+  GKeyFile *config;
+
   /* allocate data structures for the start order and groups */
   starter->start_order = g_array_new (FALSE, TRUE, sizeof (gint));
-  starter->start_groups = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                                 NULL, (GDestroyNotify) g_ptr_array_free);
-
-  /* allocate a mapping of app names to correspoding cancellables */
-  starter->cancellables = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                 g_free, (GDestroyNotify) g_object_unref);
+  starter->start_groups =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                           NULL, (GDestroyNotify) luc_starter_group_free);
+
+  /* allocate the queue of apps waiting to be started, the set of apps being
+   * started and the set of detached apps; the apps of a batch share a cancellable */
+  starter->ready = g_queue_new ();
+  starter->starting = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             (GDestroyNotify) luc_starter_app_free, NULL);
+  starter->stragglers = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                               (GDestroyNotify) luc_starter_app_free, NULL);
+
+  /* allocate the cache of the states of LUC units */
+  starter->unit_states =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           g_free, (GDestroyNotify) luc_starter_unit_state_free);
+
+  /* allocate the mapping of LUC types to their policies */
+  starter->policies =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                           NULL, (GDestroyNotify) luc_starter_type_policy_free);
+
+  /* read the pipelining parameters from the configuration */
+  config = config_file_load ();
+  starter->release_threshold =
+    CLAMP (config_file_get_integer (config, "LUCStarter", "ReleaseThreshold", 100), 0, 100);
+  starter->release_deadline =
+    MAX (config_file_get_integer (config, "LUCStarter", "ReleaseDeadline", 0), 0);
+
+  /* read the admission control limits from the configuration */
+  starter->max_in_flight =
+    MAX (config_file_get_integer (config, "LUCStarter", "MaxInFlight", 0), 0);
+
+  /* read the start deadlines from the configuration */
+  starter->app_deadline =
+    MAX (config_file_get_integer (config, "LUCStarter", "AppDeadline", 0), 0);
+  starter->group_deadline =
+    MAX (config_file_get_integer (config, "LUCStarter", "GroupDeadline", 0), 0);
+
+  /* read how to overlap the start with the NSM query from the configuration */
+  starter->nsm_deadline =
+    MAX (config_file_get_integer (config, "LUCStarter", "NSMDeadline", 0), 0);
+  starter->speculative_start =
+    config_file_get_boolean (config, "LUCStarter", "SpeculativeStart", FALSE);
+
+  /* read the systemd job modes for starting apps from the configuration */
+  starter->start_mode =
+    luc_starter_load_start_mode (config, "LUCStarter", "StartMode");
+  starter->prioritised_start_mode =
+    luc_starter_load_start_mode (config, "LUCStarter", "PrioritisedStartMode");
+
+  /* read whether to resolve the LUC units first from the configuration */
+  starter->preflight =
+    config_file_get_boolean (config, "LUCStarter", "Preflight", TRUE);
+  starter->skip_active =
+    config_file_get_boolean (config, "LUCStarter", "SkipActive", TRUE);
+
+  /* read whether groups are started through transient targets */
+  starter->transient_targets =
+    config_file_get_boolean (config, "LUCStarter", "TransientTargets", FALSE);
+
+  /* read the priority policy and the per-type settings */
+  luc_starter_load_policy (starter, config);
+  g_key_file_free (config);
 }
 
 
@@ -224,9 +684,6 @@ luc_starter_constructed (GObject *object)
 {
   LUCStarter *starter = LUC_STARTER (object);
   GError     *error = NULL;
-  gchar     **types;
-  guint       n;
-  gint        type;
 
   /* connect to the node state manager */
   starter->nsm_lifecycle_control =
@@ -242,16 +699,6 @@ luc_starter_constructed (GObject *object)
                DLT_STRING (error->message));
       g_error_free (error);
     }
-
-  /* parse the prioritised LUC types defined at build-time */
-  types = g_strsplit (PRIORITISED_LUC_TYPES, ",", -1);
-  starter->prioritised_types = g_array_new (FALSE, TRUE, sizeof (gint));
-  for (n = 0; types != NULL && types[n] != NULL; n++)
-    {
-      type = strtol (types[n], NULL, 10);
-      g_array_append_val (starter->prioritised_types, type);
-    }
-  g_strfreev (types);
 }
 
 
@@ -261,6 +708,10 @@ luc_starter_finalize (GObject *object)
 {
   LUCStarter *starter = LUC_STARTER (object);
 
+  /* drop the NSM deadline */
+  if (starter->nsm_deadline_id > 0)
+    g_source_remove (starter->nsm_deadline_id);
+
   /* release NSMLifecycleControl */
   if (starter->nsm_lifecycle_control != NULL)
     g_object_unref (starter->nsm_lifecycle_control);
@@ -269,11 +720,21 @@ luc_starter_finalize (GObject *object)
   g_array_free (starter->start_order, TRUE);
   g_hash_table_unref (starter->start_groups);
 
-  /* release the cancellables */
-  g_hash_table_unref (starter->cancellables);
+  /* release the apps waiting to be started, being started and detached */
+  g_queue_foreach (starter->ready, (GFunc) luc_starter_app_free, NULL);
+  g_queue_free (starter->ready);
+  g_hash_table_unref (starter->starting);
+  g_hash_table_unref (starter->stragglers);
 
-  /* free the prioritised types array */
-  g_array_free (starter->prioritised_types, TRUE);
+  /* release the priority policy and the job modes */
+  g_hash_table_unref (starter->policies);
+  g_free (starter->start_mode);
+  g_free (starter->prioritised_start_mode);
+
+  /* release the units being resolved and the cached unit states */
+  if (starter->preflight_units != NULL)
+    g_ptr_array_free (starter->preflight_units, TRUE);
+  g_hash_table_unref (starter->unit_states);
 
   /* release the job manager */
   g_object_unref (starter->job_manager);
@@ -302,6 +763,42 @@ luc_starter_get_property (GObject    *object,
     case PROP_NODE_STARTUP_CONTROLLER:
       g_value_set_object (value, starter->node_startup_controller);
       break;
+    case PROP_RELEASE_THRESHOLD:
+      g_value_set_uint (value, starter->release_threshold);
+      break;
+    case PROP_RELEASE_DEADLINE:
+      g_value_set_uint (value, starter->release_deadline);
+      break;
+    case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint (value, starter->max_in_flight);
+      break;
+    case PROP_APP_DEADLINE:
+      g_value_set_uint (value, starter->app_deadline);
+      break;
+    case PROP_GROUP_DEADLINE:
+      g_value_set_uint (value, starter->group_deadline);
+      break;
+    case PROP_NSM_DEADLINE:
+      g_value_set_uint (value, starter->nsm_deadline);
+      break;
+    case PROP_SPECULATIVE_START:
+      g_value_set_boolean (value, starter->speculative_start);
+      break;
+    case PROP_START_MODE:
+      g_value_set_string (value, starter->start_mode);
+      break;
+    case PROP_PRIORITISED_START_MODE:
+      g_value_set_string (value, starter->prioritised_start_mode);
+      break;
+    case PROP_PREFLIGHT:
+      g_value_set_boolean (value, starter->preflight);
+      break;
+    case PROP_SKIP_ACTIVE:
+      g_value_set_boolean (value, starter->skip_active);
+      break;
+    case PROP_TRANSIENT_TARGETS:
+      g_value_set_boolean (value, starter->transient_targets);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -326,6 +823,45 @@ luc_starter_set_property (GObject      *object,
     case PROP_NODE_STARTUP_CONTROLLER:
       starter->node_startup_controller = g_value_dup_object (value);
       break;
+    case PROP_RELEASE_THRESHOLD:
+      starter->release_threshold = g_value_get_uint (value);
+      break;
+    case PROP_RELEASE_DEADLINE:
+      starter->release_deadline = g_value_get_uint (value);
+      break;
+    case PROP_MAX_IN_FLIGHT:
+      starter->max_in_flight = g_value_get_uint (value);
+      luc_starter_admit (starter);
+      break;
+    case PROP_APP_DEADLINE:
+      starter->app_deadline = g_value_get_uint (value);
+      break;
+    case PROP_GROUP_DEADLINE:
+      starter->group_deadline = g_value_get_uint (value);
+      break;
+    case PROP_NSM_DEADLINE:
+      starter->nsm_deadline = g_value_get_uint (value);
+      break;
+    case PROP_SPECULATIVE_START:
+      starter->speculative_start = g_value_get_boolean (value);
+      break;
+    case PROP_START_MODE:
+      g_free (starter->start_mode);
+      starter->start_mode = g_value_dup_string (value);
+      break;
+    case PROP_PRIORITISED_START_MODE:
+      g_free (starter->prioritised_start_mode);
+      starter->prioritised_start_mode = g_value_dup_string (value);
+      break;
+    case PROP_PREFLIGHT:
+      starter->preflight = g_value_get_boolean (value);
+      break;
+    case PROP_SKIP_ACTIVE:
+      starter->skip_active = g_value_get_boolean (value);
+      break;
+    case PROP_TRANSIENT_TARGETS:
+      starter->transient_targets = g_value_get_boolean (value);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
       break;
@@ -339,37 +875,102 @@ luc_starter_compare_luc_types (gconstpointer a,
                                gconstpointer b,
                                gpointer      user_data)
 {
-  LUCStarter *starter = LUC_STARTER (user_data);
-  guint       n;
-  gint        type;
-  gint        type_a = *(gint *)a;
-  gint        type_b = *(gint *)b;
-  gint        pos_a = G_MAXINT;
-  gint        pos_b = G_MAXINT;
+  LUCStarterTypePolicy *policy_a;
+  LUCStarterTypePolicy *policy_b;
+  LUCStarter           *starter = LUC_STARTER (user_data);
+  gint                  type_a = *(gint *)a;
+  gint                  type_b = *(gint *)b;
+  gint                  rank_a;
+  gint                  rank_b;
+  gint                  weight_a;
+  gint                  weight_b;
+
+  /* look up the precomputed policies of both types */
+  policy_a = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (type_a));
+  policy_b = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (type_b));
+  rank_a = policy_a != NULL ? policy_a->rank : G_MAXINT;
+  rank_b = policy_b != NULL ? policy_b->rank : G_MAXINT;
+  weight_a = policy_a != NULL ? policy_a->weight : 0;
+  weight_b = policy_b != NULL ? policy_b->weight : 0;
+
+  /* prioritised types come first, in the order they were listed */
+  if (rank_a != rank_b)
+    return rank_a < rank_b ? -1 : 1;
+
+  /* types with the same rank are ordered by weight, higher weights first */
+  if (weight_a != weight_b)
+    return weight_a > weight_b ? -1 : 1;
+
+  /* fall back to the numerical order of the types */
+  return type_a < type_b ? -1 : (type_a > type_b ? 1 : 0);
+}
+
+
+
+static void
+luc_starter_schedule (LUCStarter *starter)
+{
+  g_return_if_fail (IS_LUC_STARTER (starter));
+
+  /* do not start anything once the start of the LUC has been cancelled */
+  if (starter->cancelled)
+    return;
+
+  /* start groups in order for as long as the most recently started
+   * group permits the next group to be started */
+  while (luc_starter_may_start_next_group (starter))
+    luc_starter_start_next_group (starter);
+
+  /* start as many of the queued apps as the limits allow */
+  luc_starter_admit (starter);
+
+  /* check if all groups have been started and have finished */
+  if (!starter->nsm_pending
+      && starter->preflight_units == NULL
+      && starter->next_group == starter->start_order->len
+      && starter->n_groups_finished == starter->start_order->len)
+    {
+      /* we are finished; notify others */
+      luc_starter_finish (starter);
+    }
+}
+
+
+
+static gboolean
+luc_starter_may_start_next_group (LUCStarter *starter)
+{
+  LUCStarterTypePolicy *policy;
+  LUCStarterGroup      *previous;
+  gint                  type;
+
+  /* no group is started before the LUC units have been resolved */
+  if (starter->preflight_units != NULL
+      || starter->next_group >= starter->start_order->len)
+    {
+      return FALSE;
+    }
 
-  /* try to find the first type in the prioritised types list */
-  for (n = 0; pos_a == G_MAXINT && n < starter->prioritised_types->len; n++)
+  /* the most recently started group must have been released */
+  if (starter->next_group > 0)
     {
-      type = g_array_index (starter->prioritised_types, gint, n);
-      if (type == type_a)
-        pos_a = n;
+      type = g_array_index (starter->start_order, gint, starter->next_group - 1);
+      previous = g_hash_table_lookup (starter->start_groups, GINT_TO_POINTER (type));
+      if (previous != NULL && !luc_starter_group_is_released (previous))
+        return FALSE;
     }
 
-  /* try to find the second type in the prioritised types list */
-  for (n = 0; pos_b == G_MAXINT && n < starter->prioritised_types->len; n++)
+  /* until the NSM has answered, only prioritised groups may be started,
+   * and only if speculative starts are enabled */
+  if (starter->nsm_pending)
     {
-      type = g_array_index (starter->prioritised_types, gint, n);
-      if (type == type_b)
-        pos_b = n;
+      type = g_array_index (starter->start_order, gint, starter->next_group);
+      policy = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (type));
+      if (!starter->speculative_start || policy == NULL || policy->rank == G_MAXINT)
+        return FALSE;
     }
 
-  /* this statement has the following effect when sorting:
-   * - a and b are prioritised     -> prioritization order is preserved
-   * - a is prioritised, b isn't   -> negative return value, a comes first
-   * - b is prioritised, a isn't   -> positive return value, b comes first
-   * - neither a nor b prioritised -> return value is 0, arbitrary order
-   */
-  return pos_a - pos_b;
+  return TRUE;
 }
 
 
@@ -377,52 +978,216 @@ luc_starter_compare_luc_types (gconstpointer a,
 static void
 luc_starter_start_next_group (LUCStarter *starter)
 {
-  GPtrArray *apps;
-  gint       group;
+  LUCStarterGroup *group;
+  const gchar     *name;
+  GPtrArray       *targeted = NULL;
+  guint            deadline;
+  guint            n;
+  gint             type;
 
   g_return_if_fail (IS_LUC_STARTER (starter));
-  g_return_if_fail (starter->start_order->len > 0);
+  g_return_if_fail (starter->next_group < starter->start_order->len);
 
   /* fetch the next group */
-  group = g_array_index (starter->start_order, gint, 0);
+  type = g_array_index (starter->start_order, gint, starter->next_group);
+  starter->next_group++;
 
   DLT_LOG (controller_context, DLT_LOG_INFO,
-           DLT_STRING ("Starting LUC group:"), DLT_INT (group));
+           DLT_STRING ("Starting LUC group:"), DLT_INT (type));
 
   /* look up the apps for the group */
-  apps = g_hash_table_lookup (starter->start_groups, GINT_TO_POINTER (group));
-  if (apps != NULL)
+  group = g_hash_table_lookup (starter->start_groups, GINT_TO_POINTER (type));
+  if (group == NULL)
+    {
+      starter->n_groups_finished++;
+      return;
+    }
+
+  /* empty groups are finished right away */
+  if (group->apps->len == 0)
+    {
+      luc_starter_group_finished (group);
+      return;
+    }
+
+  /* release the next group after the deadline even if this group is slow */
+  if (starter->release_deadline > 0)
+    {
+      group->release_id =
+        g_timeout_add (starter->release_deadline,
+                       luc_starter_group_release_expired, group);
+    }
+
+  /* detach the apps that are still being started when the group deadline expires */
+  group->start_time = g_get_monotonic_time ();
+  deadline = luc_starter_get_group_deadline (starter, type);
+  if (deadline > 0)
+    {
+      group->deadline_id =
+        g_timeout_add (deadline, luc_starter_group_deadline_expired, group);
+    }
+
+  /* queue all the applications in the group for being started, or collect
+   * them for the transient target of the group, except for those that were
+   * already active when the LUC was resolved */
+  if (starter->transient_targets)
+    targeted = g_ptr_array_new ();
+  for (n = 0; n < group->apps->len; n++)
     {
-      /* launch all the applications in the group asynchronously */
-      g_ptr_array_foreach (apps, (GFunc) luc_starter_start_app, starter);
+      name = g_ptr_array_index (group->apps, n);
+      if (luc_starter_unit_is_active (starter, name))
+        {
+          DLT_LOG (controller_context, DLT_LOG_INFO,
+                   DLT_STRING ("LUC app is already active:"), DLT_STRING (name));
+          group->n_finished++;
+        }
+      else if (targeted != NULL)
+        {
+          g_ptr_array_add (targeted, (gpointer) name);
+        }
+      else
+        {
+          luc_starter_enqueue_app (name, group);
+        }
     }
+
+  /* the group is finished right away if all its apps are active */
+  if (group->n_finished == group->apps->len)
+    luc_starter_group_finished (group);
+  else if (targeted != NULL)
+    luc_starter_group_start_target (group, targeted);
+
+  if (targeted != NULL)
+    g_ptr_array_free (targeted, TRUE);
 }
 
 
 
 static void
-luc_starter_start_app (const gchar *app,
-                       LUCStarter  *starter)
+luc_starter_admit (LUCStarter *starter)
 {
-  GCancellable *cancellable;
+  LUCStarterTypePolicy *policy;
+  LUCStarterApp        *app;
+  GCancellable         *cancellable = NULL;
+  GPtrArray            *units;
+  GPtrArray            *modes;
+  GPtrArray            *apps;
+  const gchar          *mode;
+  GList                *lp;
+  GList                *next;
 
-  g_return_if_fail (app != NULL && *app != '\0');
   g_return_if_fail (IS_LUC_STARTER (starter));
 
-  DLT_LOG (controller_context, DLT_LOG_INFO,
-           DLT_STRING ("Starting LUC app:"), DLT_STRING (app));
+  if (starter->cancelled)
+    return;
+
+  units = g_ptr_array_new ();
+  modes = g_ptr_array_new ();
+  apps = g_ptr_array_new ();
+
+  /* walk the ready queue in order until the global limit has been reached,
+   * skipping apps whose LUC type is at its limit */
+  for (lp = starter->ready->head;
+       lp != NULL
+       && (starter->max_in_flight == 0
+           || g_hash_table_size (starter->starting) < starter->max_in_flight);
+       lp = next)
+    {
+      next = lp->next;
+
+      /* take the app out of the queue and add it to the batch, unless its
+       * LUC type has reached its limit */
+      app = lp->data;
+      policy = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (app->group->type));
+      if (policy == NULL
+          || policy->max_in_flight == 0
+          || app->group->n_in_flight < policy->max_in_flight)
+        {
+          if (cancellable == NULL)
+            cancellable = g_cancellable_new ();
+          g_queue_delete_link (starter->ready, lp);
+          luc_starter_start_app (app, cancellable);
+          g_ptr_array_add (units, app->name);
+          mode = luc_starter_get_start_mode (starter, app->group->type);
+          g_ptr_array_add (modes, (gpointer) mode);
+          g_ptr_array_add (apps, app);
+        }
+    }
+
+  /* start all admitted apps as one batch; the batch keeps the LUCStarter alive
+   * in addition to the reference held for each app */
+  if (apps->len > 0)
+    {
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("Starting batch of LUC apps:"),
+               DLT_STRING ("apps"), DLT_UINT (apps->len));
+
+      g_ptr_array_add (units, NULL);
+      job_manager_start_many (starter->job_manager,
+                              (const gchar *const *) units->pdata,
+                              (const gchar *const *) modes->pdata,
+                              apps->pdata, cancellable,
+                              luc_starter_start_app_finish,
+                              luc_starter_start_apps_finish,
+                              g_object_ref (starter));
+    }
+
+  if (cancellable != NULL)
+    g_object_unref (cancellable);
+  g_ptr_array_free (apps, TRUE);
+  g_ptr_array_free (modes, TRUE);
+  g_ptr_array_free (units, TRUE);
+}
 
-  /* create the new cancellable */
-  cancellable = g_cancellable_new ();
 
-  /* store an association between each app and its cancellable, so that it is possible to
-   * call g_cancellable_cancel() for each respective app. */
-  g_hash_table_insert (starter->cancellables, g_strdup (app), cancellable);
 
-  /* start the service, passing the cancellable */
-  job_manager_start (starter->job_manager, app, cancellable,
-                     luc_starter_start_app_finish,
-                     g_object_ref (starter));
+static void
+luc_starter_enqueue_app (const gchar     *name,
+                         LUCStarterGroup *group)
+{
+  LUCStarterApp *app;
+
+  g_return_if_fail (name != NULL && *name != '\0');
+  g_return_if_fail (group != NULL);
+
+  /* create the app; it is given a cancellable when it is started */
+  app = g_slice_new0 (LUCStarterApp);
+  app->starter = group->starter;
+  app->group = group;
+  app->name = g_strdup (name);
+
+  g_queue_push_tail (group->starter->ready, app);
+}
+
+
+
+static void
+luc_starter_start_app (LUCStarterApp *app,
+                       GCancellable  *cancellable)
+{
+  LUCStarter *starter = app->starter;
+  guint       deadline;
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Starting LUC app:"), DLT_STRING (app->name));
+
+  /* remember the app so that it is possible to call g_cancellable_cancel()
+   * for each respective app */
+  app->cancellable = g_object_ref (cancellable);
+  g_hash_table_insert (starter->starting, app, NULL);
+  app->group->n_in_flight++;
+
+  /* detach the app from its group if it takes too long to start */
+  app->start_time = g_get_monotonic_time ();
+  deadline = luc_starter_get_app_deadline (starter, app->group->type);
+  if (deadline > 0)
+    {
+      app->deadline_id =
+        g_timeout_add (deadline, luc_starter_app_deadline_expired, app);
+    }
+
+  /* keep the LUCStarter alive until the job has finished */
+  g_object_ref (starter);
 }
 
 
@@ -434,19 +1199,21 @@ luc_starter_start_app_finish (JobManager  *manager,
                               GError      *error,
                               gpointer     user_data)
 {
-  LUCStarter *starter = LUC_STARTER (user_data);
-  GPtrArray  *apps;
-  gboolean    app_found = FALSE;
-  guint       n;
-  gint        group;
+  LUCStarterGroup *group;
+  LUCStarterApp   *app = user_data;
+  LUCStarter      *starter;
 
   g_return_if_fail (IS_JOB_MANAGER (manager));
   g_return_if_fail (unit != NULL && *unit != '\0');
-  g_return_if_fail (IS_LUC_STARTER (user_data));
-  g_return_if_fail (starter->start_order->len > 0);
+  g_return_if_fail (app != NULL);
+
+  starter = app->starter;
+  group = app->group;
 
   DLT_LOG (controller_context, DLT_LOG_INFO,
-           DLT_STRING ("Finished starting LUC app:"), DLT_STRING (unit));
+           DLT_STRING ("Finished starting LUC app:"), DLT_STRING (unit),
+           DLT_STRING ("elapsed ms"),
+           DLT_UINT ((g_get_monotonic_time () - app->start_time) / 1000));
 
   /* respond to errors */
   if (error != NULL)
@@ -457,65 +1224,58 @@ luc_starter_start_app_finish (JobManager  *manager,
                DLT_STRING ("error message"), DLT_STRING (error->message));
     }
 
-  /* get the current start group */
-  group = g_array_index (starter->start_order, gint, 0);
+  /* the app has finished starting, so it cannot be cancelled any more; detached
+   * apps have already given up their slot */
+  if (g_hash_table_steal (starter->starting, app))
+    group->n_in_flight--;
+  else
+    g_hash_table_steal (starter->stragglers, app);
 
-  /* look up the apps for this group */
-  apps = g_hash_table_lookup (starter->start_groups, GINT_TO_POINTER (group));
-  if (apps != NULL)
+  /* check if this was the last app in the group to be started, unless the
+   * group has already stopped waiting for it */
+  if (!app->detached)
     {
-      /* try to find the current app in the group */
-      for (n = 0; !app_found && n < apps->len; n++)
-        {
-          if (g_strcmp0 (unit, g_ptr_array_index (apps, n)) == 0)
-            app_found = TRUE;
-        }
+      group->n_finished++;
+      if (group->n_finished == group->apps->len)
+        luc_starter_group_finished (group);
+    }
 
-      /* remove the app from the group */
-      if (app_found)
-        g_ptr_array_remove_index (apps, n-1);
+  luc_starter_app_free (app);
 
-      /* check if this was the last app in the group to be started */
-      if (apps->len == 0)
-        {
-          DLT_LOG (controller_context, DLT_LOG_INFO,
-                   DLT_STRING ("Finished starting LUC group:"), DLT_INT (group));
+  /* start further groups and apps if possible */
+  luc_starter_schedule (starter);
 
-          /* remove the group from the groups and the order */
-          g_hash_table_remove (starter->start_groups, GINT_TO_POINTER (group));
-          g_array_remove_index (starter->start_order, 0);
+  /* release the LUCStarter because the operation is finished */
+  g_object_unref (starter);
+}
 
-          /* check if we have more groups to start */
-          if (starter->start_order->len > 0)
-            {
-              /* we do, so start the next group now */
-              luc_starter_start_next_group (starter);
-            }
-          else
-            {
-              /* no, we are finished; notify others */
-              g_signal_emit (starter, luc_starter_signals[SIGNAL_LUC_GROUPS_STARTED],
-                             0, NULL);
-            }
-        }
-    }
 
-  /* remove the association between an app and its cancellable, because the app has
-   * finished starting, so cannot be cancelled any more */
-  g_hash_table_remove (starter->cancellables, unit);
 
-  /* release the LUCStarter because the operation is finished */
+static void
+luc_starter_start_apps_finish (JobManager *manager,
+                               guint       n_jobs,
+                               guint       n_failed,
+                               gpointer    user_data)
+{
+  LUCStarter *starter = LUC_STARTER (user_data);
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Finished starting batch of LUC apps:"),
+           DLT_STRING ("apps"), DLT_UINT (n_jobs),
+           DLT_STRING ("failed"), DLT_UINT (n_failed));
+
+  /* release the LUCStarter because the batch is finished */
   g_object_unref (starter);
 }
 
 
 
 static void
-luc_starter_cancel_start (const gchar  *app,
-                          GCancellable *cancellable,
-                          gpointer      user_data)
+luc_starter_cancel_start (LUCStarterApp *app,
+                          gpointer       value,
+                          gpointer       user_data)
 {
-  g_cancellable_cancel (cancellable);
+  g_cancellable_cancel (app->cancellable);
 }
 
 
@@ -546,41 +1306,88 @@ luc_starter_check_luc_required_finish (GObject      *object,
       DLT_LOG (controller_context, DLT_LOG_INFO,
                DLT_STRING ("Assuming that we should start the LUC"));
 
-      /* start all the LUC groups now */
-      luc_starter_start_groups_for_real (starter);
+      luc_required = TRUE;
+    }
+
+  luc_starter_nsm_answered (starter, luc_required);
+
+  /* release the LUCStarter because the NSM call is finished */
+  g_object_unref (starter);
+}
+
+
+
+static gboolean
+luc_starter_nsm_deadline_expired (gpointer user_data)
+{
+  LUCStarter *starter = LUC_STARTER (user_data);
+
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("NSM did not answer within"), DLT_UINT (starter->nsm_deadline),
+           DLT_STRING ("ms, assuming that we should start the LUC"));
+
+  /* start the LUC without waiting for the NSM any longer */
+  starter->nsm_deadline_id = 0;
+  starter->nsm_pending = FALSE;
+  starter->nsm_timed_out = TRUE;
+  luc_starter_schedule (starter);
+
+  return FALSE;
+}
+
+
+
+static void
+luc_starter_nsm_answered (LUCStarter *starter,
+                          gboolean    luc_required)
+{
+  g_return_if_fail (IS_LUC_STARTER (starter));
+
+  if (starter->nsm_deadline_id > 0)
+    {
+      g_source_remove (starter->nsm_deadline_id);
+      starter->nsm_deadline_id = 0;
+    }
+
+  /* check whether we need to start the LUC or not */
+  if (luc_required)
+    {
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("LUC is required, starting it now"));
+
+      /* start the groups that are waiting for the NSM, unless this
+       * has already happened because the NSM deadline expired */
+      starter->nsm_pending = FALSE;
+      luc_starter_schedule (starter);
     }
   else
     {
-      /* check whether we need to start the LUC or not */
-      if (luc_required)
-        {
-          DLT_LOG (controller_context, DLT_LOG_INFO,
-                   DLT_STRING ("LUC is required, starting it now"));
+      /* LUC is not required, log this information */
+      DLT_LOG (controller_context, DLT_LOG_INFO, DLT_STRING ("LUC is not required"));
 
-          /* start all the LUC groups now */
-          luc_starter_start_groups_for_real (starter);
-        }
-      else
+      if (starter->nsm_timed_out)
         {
-          /* LUC is not required, log this information */
-          DLT_LOG (controller_context, DLT_LOG_INFO, DLT_STRING ("LUC is not required"));
-
-          /* notify others that we have started the LUC groups; we haven't
-           * in this case but the call of luc_starter_start_groups() may
-           * still want to be notified that the call has been processed */
-          g_signal_emit (starter, luc_starter_signals[SIGNAL_LUC_GROUPS_STARTED],
-                         0, NULL);
+          DLT_LOG (controller_context, DLT_LOG_WARN,
+                   DLT_STRING ("Cancelling the LUC apps started after the NSM deadline"));
         }
+
+      /* drop the prepared groups and cancel the apps that have already been started */
+      starter->nsm_pending = FALSE;
+      luc_starter_cancel (starter);
+
+      /* notify others that we have started the LUC groups; we haven't
+       * in this case but the call of luc_starter_start_groups() may
+       * still want to be notified that the call has been processed */
+      luc_starter_finish (starter);
     }
 }
 
 
 
 static void
-luc_starter_start_groups_for_real (LUCStarter *starter)
+luc_starter_prepare_groups (LUCStarter *starter)
 {
   GVariantIter iter;
-  GPtrArray   *group_apps;
   GVariant    *context;
   GError      *error = NULL;
   GList       *groups;
@@ -592,23 +1399,15 @@ luc_starter_start_groups_for_real (LUCStarter *starter)
 
   g_return_if_fail (IS_LUC_STARTER (starter));
 
-  /* log prioritised LUC types */
-  DLT_LOG (controller_context, DLT_LOG_INFO, DLT_STRING ("Prioritised LUC types:"));
-  for (n = 0; n < starter->prioritised_types->len; n++)
-    {
-      DLT_LOG (controller_context, DLT_LOG_INFO,
-               DLT_INT (g_array_index (starter->prioritised_types, gint, n)));
-    }
-
   /* clear the start order */
   if (starter->start_order->len > 0)
     g_array_remove_range (starter->start_order, 0, starter->start_order->len);
 
   /* clear the start groups */
   g_hash_table_remove_all (starter->start_groups);
-
-  /* clear the mapping between apps and their cancellables */
-  g_hash_table_remove_all (starter->cancellables);
+  starter->next_group = 0;
+  starter->n_groups_finished = 0;
+  starter->finished = FALSE;
 
   /* get the current last user context */
   context = node_startup_controller_service_read_luc (starter->node_startup_controller,
@@ -622,8 +1421,7 @@ luc_starter_start_groups_for_real (LUCStarter *starter)
 
       /* notify others that we are finished starting the groups, even if
        * that failed */
-      g_signal_emit (starter, luc_starter_signals[SIGNAL_LUC_GROUPS_STARTED],
-                     0, NULL);
+      luc_starter_finish (starter);
 
       return;
     }
@@ -632,19 +1430,15 @@ luc_starter_start_groups_for_real (LUCStarter *starter)
   g_variant_iter_init (&iter, context);
   while (g_variant_iter_loop (&iter, "{i^as}", &type, &apps))
     {
-      group_apps = g_ptr_array_new_with_free_func (g_free);
-
-      for (n = 0; apps != NULL && apps[n] != NULL; n++)
-        g_ptr_array_add (group_apps, g_strdup (apps[n]));
-
-      g_hash_table_insert (starter->start_groups, GINT_TO_POINTER (type), group_apps);
+      g_hash_table_insert (starter->start_groups, GINT_TO_POINTER (type),
+                           luc_starter_group_new (starter, type, apps));
     }
 
   /* release the last user context */
   g_variant_unref (context);
 
   /* generate the start order by sorting the LUC types according to
-   * the prioritised types */
+   * the priority policy */
   groups = g_hash_table_get_keys (starter->start_groups);
   for (lp = groups; lp != NULL; lp = lp->next)
     {
@@ -660,42 +1454,861 @@ luc_starter_start_groups_for_real (LUCStarter *starter)
                DLT_INT (g_array_index (starter->start_order, gint, n)));
     }
 
-  if (starter->start_order->len > 0)
-    luc_starter_start_next_group (starter);
+  /* resolve the LUC units in systemd before starting any group */
+  luc_starter_preflight (starter);
+
+  /* start the first group(s), or only the prioritised ones if the NSM has
+   * not answered yet and speculative starts are enabled */
+  luc_starter_schedule (starter);
 }
 
 
 
-/**
- * luc_starter_new:
- * @job_manager: A #JobManager object.
- * @node_startup_controller: A #NodeStartupControllerService object.
- *
- * Creates a new #LUCStarter object.
- *
- * Returns: A new instance of the #LUCStarter.
- */
-LUCStarter *
-luc_starter_new (JobManager                   *job_manager,
-                 NodeStartupControllerService *node_startup_controller)
+static void
+luc_starter_preflight (LUCStarter *starter)
 {
-  g_return_val_if_fail (IS_JOB_MANAGER (job_manager), NULL);
-  g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (node_startup_controller), NULL);
+  LUCStarterGroup *group;
+  SystemdManager  *systemd_manager;
+  GHashTableIter   iter;
+  GHashTable      *seen;
+  const gchar     *name;
+  guint            n;
 
-  return g_object_new (TYPE_LUC_STARTER,
-                       "job-manager", job_manager,
-                       "node-startup-controller", node_startup_controller,
-                       NULL);
-}
+  g_return_if_fail (IS_LUC_STARTER (starter));
 
+  if ((!starter->preflight && !starter->skip_active) || starter->preflight_units != NULL)
+    return;
 
+  /* collect the units that have not been resolved during this boot yet; the
+   * active states are needed for all units, since they change over time */
+  starter->preflight_units = g_ptr_array_new_with_free_func (g_free);
+  seen = g_hash_table_new (g_str_hash, g_str_equal);
+  g_hash_table_iter_init (&iter, starter->start_groups);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &group))
+    {
+      for (n = 0; n < group->apps->len; n++)
+        {
+          name = g_ptr_array_index (group->apps, n);
+          if ((starter->skip_active
+               || g_hash_table_lookup (starter->unit_states, name) == NULL)
+              && g_hash_table_lookup (seen, name) == NULL)
+            {
+              g_hash_table_insert (seen, (gpointer) name, (gpointer) name);
+              g_ptr_array_add (starter->preflight_units, g_strdup (name));
+            }
+        }
+    }
+  g_hash_table_unref (seen);
 
-/**
+  /* all units are known already, so only apply the cached states */
+  if (starter->preflight_units->len == 0)
+    {
+      g_ptr_array_free (starter->preflight_units, TRUE);
+      starter->preflight_units = NULL;
+      luc_starter_prune_groups (starter);
+      return;
+    }
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Resolving LUC units:"),
+           DLT_STRING ("units"), DLT_UINT (starter->preflight_units->len));
+
+  /* resolve all units with one call; the groups are held back until the
+   * reply arrives */
+  g_object_get (starter->job_manager, "systemd-manager", &systemd_manager, NULL);
+  g_ptr_array_add (starter->preflight_units, NULL);
+  systemd_manager_call_list_units_by_names (systemd_manager,
+                                            (const gchar *const *) starter->preflight_units->pdata,
+                                            NULL, luc_starter_preflight_finish,
+                                            g_object_ref (starter));
+  g_object_unref (systemd_manager);
+}
+
+
+
+static void
+luc_starter_preflight_finish (GObject      *object,
+                              GAsyncResult *res,
+                              gpointer      user_data)
+{
+  LUCStarterUnitState *state;
+  GVariantIter         iter;
+  LUCStarter          *starter = LUC_STARTER (user_data);
+  const gchar         *active_state;
+  const gchar         *load_state;
+  const gchar         *name;
+  GVariant            *units = NULL;
+  GError              *error = NULL;
+  guint                n = 0;
+
+  if (!systemd_manager_call_list_units_by_names_finish (SYSTEMD_MANAGER (object), &units,
+                                                        res, &error))
+    {
+      /* older versions of systemd do not support this call; start all units */
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Failed to resolve the LUC units, starting all of them:"),
+               DLT_STRING (error->message));
+      g_error_free (error);
+    }
+  else
+    {
+      /* the units are listed in the order they were asked for; remember
+       * their states for the rest of the boot */
+      g_variant_iter_init (&iter, units);
+      while (g_variant_iter_next (&iter, "(&s&s&s&s&s&s&ou&s&o)", NULL, NULL,
+                                  &load_state, &active_state,
+                                  NULL, NULL, NULL, NULL, NULL, NULL)
+             && n + 1 < starter->preflight_units->len)
+        {
+          name = g_ptr_array_index (starter->preflight_units, n++);
+          state = g_slice_new0 (LUCStarterUnitState);
+          state->load_state = g_strdup (load_state);
+          state->active_state = g_strdup (active_state);
+          g_hash_table_insert (starter->unit_states, g_strdup (name), state);
+        }
+      g_variant_unref (units);
+    }
+
+  g_ptr_array_free (starter->preflight_units, TRUE);
+  starter->preflight_units = NULL;
+
+  /* drop the units that cannot be started and start the groups */
+  luc_starter_prune_groups (starter);
+  luc_starter_schedule (starter);
+
+  /* release the LUCStarter because the call is finished */
+  g_object_unref (starter);
+}
+
+
+
+static void
+luc_starter_prune_groups (LUCStarter *starter)
+{
+  LUCStarterUnitState *state;
+  LUCStarterGroup     *group;
+  GHashTableIter       iter;
+  const gchar         *name;
+  guint                n;
+
+  g_return_if_fail (IS_LUC_STARTER (starter));
+
+  if (!starter->preflight)
+    return;
+
+  /* remove the units that systemd cannot load from groups that have not been
+   * started yet, so that they do not hold up the group barriers */
+  g_hash_table_iter_init (&iter, starter->start_groups);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &group))
+    {
+      for (n = group->apps->len; n > 0; n--)
+        {
+          name = g_ptr_array_index (group->apps, n - 1);
+          state = g_hash_table_lookup (starter->unit_states, name);
+          if (state != NULL && g_strcmp0 (state->load_state, "loaded") != 0)
+            {
+              DLT_LOG (controller_context, DLT_LOG_WARN,
+                       DLT_STRING ("Not starting LUC app that cannot be loaded:"),
+                       DLT_STRING (name),
+                       DLT_STRING ("load state"), DLT_STRING (state->load_state),
+                       DLT_STRING ("LUC type"), DLT_INT (group->type));
+
+              g_ptr_array_remove_index (group->apps, n - 1);
+            }
+        }
+    }
+}
+
+
+
+static gboolean
+luc_starter_unit_is_active (LUCStarter  *starter,
+                            const gchar *name)
+{
+  LUCStarterUnitState *state;
+
+  if (!starter->skip_active)
+    return FALSE;
+
+  /* units that are reloading are running as well */
+  state = g_hash_table_lookup (starter->unit_states, name);
+  return state != NULL
+    && (g_strcmp0 (state->active_state, "active") == 0
+        || g_strcmp0 (state->active_state, "reloading") == 0);
+}
+
+
+
+static void
+luc_starter_unit_state_free (LUCStarterUnitState *state)
+{
+  if (state == NULL)
+    return;
+
+  g_free (state->load_state);
+  g_free (state->active_state);
+  g_slice_free (LUCStarterUnitState, state);
+}
+
+
+
+static void
+luc_starter_finish (LUCStarter *starter)
+{
+  g_return_if_fail (IS_LUC_STARTER (starter));
+
+  /* notify others only once */
+  if (starter->finished)
+    return;
+
+  starter->finished = TRUE;
+  g_signal_emit (starter, luc_starter_signals[SIGNAL_LUC_GROUPS_STARTED], 0, NULL);
+}
+
+
+
+static LUCStarterGroup *
+luc_starter_group_new (LUCStarter *starter,
+                       gint        type,
+                       gchar     **apps)
+{
+  LUCStarterGroup *group;
+  guint            n;
+
+  group = g_slice_new0 (LUCStarterGroup);
+  group->starter = starter;
+  group->type = type;
+  group->apps = g_ptr_array_new_with_free_func (g_free);
+
+  for (n = 0; apps != NULL && apps[n] != NULL; n++)
+    g_ptr_array_add (group->apps, g_strdup (apps[n]));
+
+  return group;
+}
+
+
+
+static void
+luc_starter_group_free (LUCStarterGroup *group)
+{
+  if (group == NULL)
+    return;
+
+  if (group->release_id > 0)
+    g_source_remove (group->release_id);
+
+  if (group->deadline_id > 0)
+    g_source_remove (group->deadline_id);
+
+  if (group->cancellable != NULL)
+    g_object_unref (group->cancellable);
+  g_strfreev (group->targeted);
+
+  g_ptr_array_free (group->apps, TRUE);
+  g_slice_free (LUCStarterGroup, group);
+}
+
+
+
+static gboolean
+luc_starter_group_is_released (LUCStarterGroup *group)
+{
+  LUCStarter *starter = group->starter;
+
+  /* the group is released if its deadline has expired or if enough
+   * of its apps have finished starting */
+  return group->released
+    || group->n_finished * 100 >= starter->release_threshold * group->apps->len;
+}
+
+
+
+static void
+luc_starter_group_finished (LUCStarterGroup *group)
+{
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Finished starting LUC group:"), DLT_INT (group->type));
+
+  /* a finished group always releases the next group */
+  group->released = TRUE;
+  if (group->release_id > 0)
+    {
+      g_source_remove (group->release_id);
+      group->release_id = 0;
+    }
+
+  /* the group deadline is no longer needed either */
+  if (group->deadline_id > 0)
+    {
+      g_source_remove (group->deadline_id);
+      group->deadline_id = 0;
+    }
+
+  group->starter->n_groups_finished++;
+}
+
+
+
+static gboolean
+luc_starter_group_release_expired (gpointer user_data)
+{
+  LUCStarterGroup *group = user_data;
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Release deadline of LUC group expired:"), DLT_INT (group->type),
+           DLT_STRING ("apps started"), DLT_UINT (group->n_finished),
+           DLT_STRING ("of"), DLT_UINT (group->apps->len));
+
+  /* let the next group start even though this group is not complete */
+  group->released = TRUE;
+  group->release_id = 0;
+
+  luc_starter_schedule (group->starter);
+
+  return FALSE;
+}
+
+
+
+static gboolean
+luc_starter_group_deadline_expired (gpointer user_data)
+{
+  LUCStarterGroup *group = user_data;
+  LUCStarterApp   *app;
+  LUCStarter      *starter = group->starter;
+  GList           *apps;
+  GList           *lp;
+
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("Start deadline of LUC group expired:"), DLT_INT (group->type),
+           DLT_STRING ("elapsed ms"),
+           DLT_UINT ((g_get_monotonic_time () - group->start_time) / 1000),
+           DLT_STRING ("apps started"), DLT_UINT (group->n_finished),
+           DLT_STRING ("of"), DLT_UINT (group->apps->len));
+
+  group->deadline_id = 0;
+
+  /* detach the apps of the group that are still being started */
+  apps = g_hash_table_get_keys (starter->starting);
+  for (lp = apps; lp != NULL; lp = lp->next)
+    {
+      app = lp->data;
+      if (app->group == group && !app->detached)
+        {
+          DLT_LOG (controller_context, DLT_LOG_WARN,
+                   DLT_STRING ("Detaching LUC app from its group:"),
+                   DLT_STRING (app->name),
+                   DLT_STRING ("elapsed ms"),
+                   DLT_UINT ((g_get_monotonic_time () - app->start_time) / 1000));
+
+          luc_starter_app_detach (app);
+        }
+    }
+  g_list_free (apps);
+
+  /* detach the apps of the group that are still queued; they are started
+   * nevertheless, but the group does not wait for them */
+  for (lp = starter->ready->head; lp != NULL; lp = lp->next)
+    {
+      app = lp->data;
+      if (app->group == group && !app->detached)
+        luc_starter_app_detach (app);
+    }
+
+  /* stop waiting for the transient target of the group; its job keeps running */
+  if (group->targeted != NULL && !group->target_detached)
+    {
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Detaching the transient target from its LUC group:"),
+               DLT_INT (group->type));
+
+      group->target_detached = TRUE;
+      group->n_finished += g_strv_length (group->targeted);
+      if (group->n_finished == group->apps->len)
+        luc_starter_group_finished (group);
+    }
+
+  luc_starter_schedule (starter);
+
+  return FALSE;
+}
+
+
+
+static void
+luc_starter_group_start_target (LUCStarterGroup *group,
+                                GPtrArray       *apps)
+{
+  const gchar *mode;
+  LUCStarter  *starter = group->starter;
+  gchar       *target;
+  guint        n;
+
+  target = g_strdup_printf ("luc-group-%d.target", group->type);
+
+  /* systemd ignores the Wants= and After= of the target in the ignore-* modes
+   * and would start none of the apps, so the target keeps its dependencies */
+  mode = luc_starter_get_start_mode (starter, group->type);
+  if (mode != NULL && g_str_has_prefix (mode, "ignore-"))
+    mode = NULL;
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Starting LUC group through transient target:"),
+           DLT_STRING (target), DLT_STRING ("apps"), DLT_UINT (apps->len));
+
+  /* remember the apps so that their states can be checked afterwards */
+  group->targeted = g_new0 (gchar *, apps->len + 1);
+  for (n = 0; n < apps->len; n++)
+    group->targeted[n] = g_strdup (g_ptr_array_index (apps, n));
+  group->cancellable = g_cancellable_new ();
+
+  /* start all apps with a single job; keep the LUCStarter alive until the
+   * job has finished */
+  g_object_ref (starter);
+  job_manager_start_transient (starter->job_manager, target, mode,
+                               (const gchar *const *) group->targeted,
+                               group->cancellable, luc_starter_group_target_finish,
+                               group);
+
+  g_free (target);
+}
+
+
+
+static void
+luc_starter_group_target_finish (JobManager  *manager,
+                                 const gchar *unit,
+                                 const gchar *result,
+                                 GError      *error,
+                                 gpointer     user_data)
+{
+  LUCStarterGroup *group = user_data;
+  SystemdManager  *systemd_manager;
+  LUCStarterApp   *app;
+  LUCStarter      *starter = group->starter;
+  guint            n;
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Finished starting transient target:"), DLT_STRING (unit),
+           DLT_STRING ("result"), DLT_STRING (result),
+           DLT_STRING ("elapsed ms"),
+           DLT_UINT ((g_get_monotonic_time () - group->start_time) / 1000));
+
+  if (error != NULL && !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)
+      && !starter->cancelled)
+    {
+      /* systemd refused to create the target; fall back to starting the apps
+       * one by one, for this and all further groups */
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Failed to create transient target, starting apps one by one:"),
+               DLT_STRING (unit), DLT_STRING ("error message"),
+               DLT_STRING (error->message));
+
+      starter->transient_targets = FALSE;
+      for (n = 0; group->targeted[n] != NULL; n++)
+        {
+          luc_starter_enqueue_app (group->targeted[n], group);
+
+          /* the group has already stopped waiting for the apps of a detached target */
+          app = g_queue_peek_tail (starter->ready);
+          app->detached = group->target_detached;
+        }
+
+      g_strfreev (group->targeted);
+      group->targeted = NULL;
+
+      luc_starter_schedule (starter);
+      g_object_unref (starter);
+      return;
+    }
+
+  /* the target does not fail if some of the apps fail, so check their states
+   * unless the start of the LUC has been cancelled */
+  if (error != NULL || starter->cancelled)
+    {
+      luc_starter_group_target_done (group);
+      return;
+    }
+
+  g_object_get (starter->job_manager, "systemd-manager", &systemd_manager, NULL);
+  systemd_manager_call_list_units_by_names (systemd_manager,
+                                            (const gchar *const *) group->targeted,
+                                            NULL, luc_starter_group_target_checked,
+                                            group);
+  g_object_unref (systemd_manager);
+}
+
+
+
+static void
+luc_starter_group_target_checked (GObject      *object,
+                                  GAsyncResult *res,
+                                  gpointer      user_data)
+{
+  LUCStarterGroup *group = user_data;
+  GVariantIter     iter;
+  const gchar     *active_state;
+  const gchar     *name;
+  GVariant        *units = NULL;
+  GError          *error = NULL;
+
+  if (!systemd_manager_call_list_units_by_names_finish (SYSTEMD_MANAGER (object), &units,
+                                                        res, &error))
+    {
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Failed to check the LUC apps of transient target:"),
+               DLT_INT (group->type), DLT_STRING ("error message"),
+               DLT_STRING (error->message));
+      g_error_free (error);
+    }
+  else
+    {
+      /* log the apps that the target did not manage to start */
+      g_variant_iter_init (&iter, units);
+      while (g_variant_iter_next (&iter, "(&s&s&s&s&s&s&ou&s&o)", &name, NULL, NULL,
+                                  &active_state, NULL, NULL, NULL, NULL, NULL, NULL))
+        {
+          if (g_strcmp0 (active_state, "active") != 0
+              && g_strcmp0 (active_state, "reloading") != 0)
+            {
+              DLT_LOG (controller_context, DLT_LOG_ERROR,
+                       DLT_STRING ("Failed to start LUC application:"),
+                       DLT_STRING ("unit"), DLT_STRING (name),
+                       DLT_STRING ("active state"), DLT_STRING (active_state));
+            }
+        }
+      g_variant_unref (units);
+    }
+
+  luc_starter_group_target_done (group);
+}
+
+
+
+static void
+luc_starter_group_target_done (LUCStarterGroup *group)
+{
+  LUCStarter *starter = group->starter;
+
+  /* all apps of the target have finished starting, unless the group has
+   * already stopped waiting for them */
+  if (!group->target_detached)
+    {
+      group->n_finished += g_strv_length (group->targeted);
+      if (group->n_finished == group->apps->len)
+        luc_starter_group_finished (group);
+    }
+
+  /* start further groups and apps if possible */
+  luc_starter_schedule (starter);
+
+  /* release the LUCStarter because the job is finished */
+  g_object_unref (starter);
+}
+
+
+
+static void
+luc_starter_app_detach (LUCStarterApp *app)
+{
+  LUCStarterGroup *group = app->group;
+  LUCStarter      *starter = app->starter;
+
+  /* give the slot of the app to the next app in the ready queue; the app itself
+   * is kept until its job has finished */
+  if (g_hash_table_steal (starter->starting, app))
+    {
+      group->n_in_flight--;
+      g_hash_table_insert (starter->stragglers, app, NULL);
+    }
+
+  /* stop waiting for the app in its group */
+  if (!app->detached)
+    {
+      app->detached = TRUE;
+      group->n_finished++;
+      if (group->n_finished == group->apps->len)
+        luc_starter_group_finished (group);
+    }
+}
+
+
+
+static gboolean
+luc_starter_app_deadline_expired (gpointer user_data)
+{
+  LUCStarterApp *app = user_data;
+  LUCStarter    *starter = app->starter;
+
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("Start deadline of LUC app expired:"), DLT_STRING (app->name),
+           DLT_STRING ("elapsed ms"),
+           DLT_UINT ((g_get_monotonic_time () - app->start_time) / 1000));
+
+  app->deadline_id = 0;
+
+  /* let the group and the next apps proceed while the job keeps running */
+  luc_starter_app_detach (app);
+  luc_starter_schedule (starter);
+
+  return FALSE;
+}
+
+
+
+static void
+luc_starter_app_free (LUCStarterApp *app)
+{
+  if (app == NULL)
+    return;
+
+  if (app->deadline_id > 0)
+    g_source_remove (app->deadline_id);
+
+  if (app->cancellable != NULL)
+    g_object_unref (app->cancellable);
+  g_free (app->name);
+  g_slice_free (LUCStarterApp, app);
+}
+
+
+
+static void
+luc_starter_load_policy (LUCStarter *starter,
+                         GKeyFile   *config)
+{
+  LUCStarterTypePolicy *policy;
+  const gchar          *number;
+  gchar               **groups;
+  gchar               **types;
+  gchar                *end;
+  gsize                 n_types;
+  guint                 n;
+  gint                 *prioritised;
+  gint                  limit;
+  gint                  rank = 0;
+  gint                  type;
+
+  /* read the prioritised LUC types from the configuration, falling back
+   * to the list defined at build-time */
+  prioritised = g_key_file_get_integer_list (config, "LUCStarter", "PrioritisedTypes",
+                                             &n_types, NULL);
+  if (prioritised == NULL)
+    {
+      types = g_strsplit (PRIORITISED_LUC_TYPES, ",", -1);
+      n_types = g_strv_length (types);
+      prioritised = g_new0 (gint, MAX (n_types, 1));
+      for (n = 0; n < n_types; n++)
+        prioritised[n] = strtol (types[n], NULL, 10);
+      g_strfreev (types);
+    }
+
+  /* precompute the rank of each prioritised type; if a type is listed
+   * more than once, its first position counts */
+  DLT_LOG (controller_context, DLT_LOG_INFO, DLT_STRING ("Prioritised LUC types:"));
+  for (n = 0; n < n_types; n++)
+    {
+      policy = luc_starter_get_policy (starter, prioritised[n]);
+      if (policy->rank == G_MAXINT)
+        {
+          policy->rank = rank++;
+          DLT_LOG (controller_context, DLT_LOG_INFO, DLT_INT (prioritised[n]));
+        }
+    }
+  g_free (prioritised);
+
+  /* look for groups named "LUC Type <type>" with settings for that type */
+  groups = g_key_file_get_groups (config, NULL);
+  for (n = 0; groups != NULL && groups[n] != NULL; n++)
+    {
+      /* ignore the group unless the rest of its name is a valid type */
+      type = -1;
+      end = NULL;
+      number = NULL;
+      if (g_str_has_prefix (groups[n], "LUC Type "))
+        {
+          number = groups[n] + sizeof ("LUC Type ") - 1;
+          type = strtol (number, &end, 10);
+        }
+
+      if (number != NULL && end != number && *end == '\0')
+        {
+          policy = luc_starter_get_policy (starter, type);
+          policy->weight = config_file_get_integer (config, groups[n], "Weight", 0);
+          policy->app_deadline =
+            config_file_get_integer (config, groups[n], "AppDeadline", -1);
+          policy->group_deadline =
+            config_file_get_integer (config, groups[n], "GroupDeadline", -1);
+
+          limit = config_file_get_integer (config, groups[n], "MaxInFlight", 0);
+          policy->max_in_flight = MAX (limit, 0);
+
+          g_free (policy->start_mode);
+          policy->start_mode =
+            luc_starter_load_start_mode (config, groups[n], "StartMode");
+        }
+    }
+  g_strfreev (groups);
+}
+
+
+
+static gchar *
+luc_starter_load_start_mode (GKeyFile    *config,
+                             const gchar *group,
+                             const gchar *key)
+{
+  static const gchar *modes[] =
+  {
+    "replace",
+    "fail",
+    "ignore-dependencies",
+    "ignore-requirements",
+    "replace-irreversibly",
+  };
+  gboolean            valid = FALSE;
+  gchar              *mode;
+  guint               n;
+
+  g_return_val_if_fail (config != NULL, NULL);
+  g_return_val_if_fail (group != NULL && *group != '\0', NULL);
+  g_return_val_if_fail (key != NULL && *key != '\0', NULL);
+
+  mode = g_key_file_get_string (config, group, key, NULL);
+  if (mode == NULL)
+    return NULL;
+
+  /* only pass job modes on to systemd that it accepts; "isolate" is left out
+   * because it would stop all units the app does not pull in */
+  for (n = 0; !valid && n < G_N_ELEMENTS (modes); n++)
+    valid = g_strcmp0 (mode, modes[n]) == 0;
+
+  if (valid)
+    return mode;
+
+  /* fall back to the default if the mode is invalid */
+  DLT_LOG (controller_context, DLT_LOG_WARN,
+           DLT_STRING ("Ignoring invalid systemd job mode:"), DLT_STRING (mode),
+           DLT_STRING ("group"), DLT_STRING (group),
+           DLT_STRING ("key"), DLT_STRING (key));
+  g_free (mode);
+  return NULL;
+}
+
+
+
+static LUCStarterTypePolicy *
+luc_starter_get_policy (LUCStarter *starter,
+                        gint        type)
+{
+  LUCStarterTypePolicy *policy;
+
+  policy = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (type));
+  if (policy == NULL)
+    {
+      /* types without a policy are not prioritised and use the defaults */
+      policy = g_slice_new0 (LUCStarterTypePolicy);
+      policy->rank = G_MAXINT;
+      policy->app_deadline = -1;
+      policy->group_deadline = -1;
+      g_hash_table_insert (starter->policies, GINT_TO_POINTER (type), policy);
+    }
+
+  return policy;
+}
+
+
+
+static guint
+luc_starter_get_app_deadline (LUCStarter *starter,
+                              gint        type)
+{
+  LUCStarterTypePolicy *policy;
+
+  policy = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (type));
+  if (policy != NULL && policy->app_deadline >= 0)
+    return policy->app_deadline;
+
+  return starter->app_deadline;
+}
+
+
+
+static guint
+luc_starter_get_group_deadline (LUCStarter *starter,
+                                gint        type)
+{
+  LUCStarterTypePolicy *policy;
+
+  policy = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (type));
+  if (policy != NULL && policy->group_deadline >= 0)
+    return policy->group_deadline;
+
+  return starter->group_deadline;
+}
+
+
+
+static const gchar *
+luc_starter_get_start_mode (LUCStarter *starter,
+                            gint        type)
+{
+  LUCStarterTypePolicy *policy;
+
+  /* a mode set for the type wins over the mode for prioritised types,
+   * which wins over the mode for all apps */
+  policy = g_hash_table_lookup (starter->policies, GINT_TO_POINTER (type));
+  if (policy != NULL && policy->start_mode != NULL)
+    return policy->start_mode;
+
+  if (policy != NULL && policy->rank != G_MAXINT && starter->prioritised_start_mode != NULL)
+    return starter->prioritised_start_mode;
+
+  return starter->start_mode;
+}
+
+
+
+static void
+luc_starter_type_policy_free (LUCStarterTypePolicy *policy)
+{
+  g_free (policy->start_mode);
+  g_slice_free (LUCStarterTypePolicy, policy);
+}
+
+
+
+/**
+ * luc_starter_new:
+ * @job_manager: A #JobManager object.
+ * @node_startup_controller: A #NodeStartupControllerService object.
+ *
+ * Creates a new #LUCStarter object.
+ *
+ * Returns: A new instance of the #LUCStarter.
+ */
+LUCStarter *
+luc_starter_new (JobManager                   *job_manager,
+                 NodeStartupControllerService *node_startup_controller)
+{
+  g_return_val_if_fail (IS_JOB_MANAGER (job_manager), NULL);
+  g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (node_startup_controller), NULL);
+
+  return g_object_new (TYPE_LUC_STARTER,
+                       "job-manager", job_manager,
+                       "node-startup-controller", node_startup_controller,
+                       NULL);
+}
+
+
+
+/**
  * luc_starter_start_groups:
  * @starter: A #LUCStarter object.
  *
  * Checks with the NSM whether to start the LUC applications or not. If it is required to
- * start the LUC or the NSM is unavailable, it will start the LUC.
+ * start the LUC or the NSM is unavailable, it will start the LUC. The LUC is read and
+ * the groups are prepared while the NSM is being asked.
  */
 void
 luc_starter_start_groups (LUCStarter *starter)
@@ -705,19 +2318,29 @@ luc_starter_start_groups (LUCStarter *starter)
   /* check whether the NSMLifecycleProxy is available or not */
   if (starter->nsm_lifecycle_control != NULL)
     {
-      /* check with NSM whether to start the LUC */
+      /* check with NSM whether to start the LUC; the groups are held back
+       * until the answer arrives or the deadline expires */
+      starter->nsm_pending = TRUE;
+      starter->nsm_timed_out = FALSE;
       nsm_lifecycle_control_call_check_luc_required (starter->nsm_lifecycle_control, NULL,
                                                      luc_starter_check_luc_required_finish,
-                                                     starter);
+                                                     g_object_ref (starter));
+
+      if (starter->nsm_deadline > 0)
+        {
+          starter->nsm_deadline_id =
+            g_timeout_add (starter->nsm_deadline, luc_starter_nsm_deadline_expired,
+                           starter);
+        }
     }
   else
     {
       DLT_LOG (controller_context, DLT_LOG_WARN,
                DLT_STRING ("NSM unavailable, starting the LUC unconditionally"));
-
-      /* start all the LUC groups now */
-      luc_starter_start_groups_for_real (starter);
     }
+
+  /* read the LUC and prepare the groups while the NSM query is in flight */
+  luc_starter_prepare_groups (starter);
 }
 
 
@@ -726,11 +2349,63 @@ luc_starter_start_groups (LUCStarter *starter)
  * luc_starter_cancel:
  * @starter: A #LUCStarter object.
  *
- * Cancel the start of the LUC.
- *
+ * Cancel the start of the LUC. Apps that have not been started yet are dropped, and
+ * the jobs of the apps that are being started are cancelled in systemd, so that the
+ * resources they hold are freed right away instead of letting their activation complete.
  */
 void
 luc_starter_cancel (LUCStarter *starter)
 {
-  g_hash_table_foreach (starter->cancellables, (GHFunc) luc_starter_cancel_start, NULL);
+  LUCStarterGroup *group;
+  GHashTableIter   iter;
+
+  g_return_if_fail (IS_LUC_STARTER (starter));
+
+  /* make sure no further groups or apps are started */
+  starter->cancelled = TRUE;
+
+  /* drop all apps that have not been started yet */
+  g_queue_foreach (starter->ready, (GFunc) luc_starter_app_free, NULL);
+  g_queue_clear (starter->ready);
+
+  /* cancel the apps being started, including the detached ones; the #JobManager
+   * cancels their jobs in systemd and stops the units started so far */
+  g_hash_table_foreach (starter->starting, (GHFunc) luc_starter_cancel_start, NULL);
+  g_hash_table_foreach (starter->stragglers, (GHFunc) luc_starter_cancel_start, NULL);
+
+  /* cancel the transient targets being started */
+  g_hash_table_iter_init (&iter, starter->start_groups);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &group))
+    {
+      if (group->cancellable != NULL)
+        g_cancellable_cancel (group->cancellable);
+    }
+}
+
+
+
+/**
+ * luc_starter_set_type_max_in_flight:
+ * @starter: A #LUCStarter object.
+ * @type: A LUC type.
+ * @max_in_flight: The maximum number of apps of @type being started at the same time,
+ *                 or 0 for no limit.
+ *
+ * Limits the number of apps of the LUC @type that are started at the same time. The
+ * limit can be changed at any time and takes effect immediately.
+ */
+void
+luc_starter_set_type_max_in_flight (LUCStarter *starter,
+                                    gint        type,
+                                    guint       max_in_flight)
+{
+  LUCStarterTypePolicy *policy;
+
+  g_return_if_fail (IS_LUC_STARTER (starter));
+
+  policy = luc_starter_get_policy (starter, type);
+  policy->max_in_flight = max_in_flight;
+
+  /* raising a limit may allow more apps to be started */
+  luc_starter_admit (starter);
 }
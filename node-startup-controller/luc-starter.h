@@ -35,12 +35,15 @@ G_BEGIN_DECLS
 typedef struct _LUCStarterClass LUCStarterClass;
 typedef struct _LUCStarter      LUCStarter;
 
-GType       luc_starter_get_type     (void) G_GNUC_CONST;
-
-LUCStarter *luc_starter_new          (JobManager                   *job_manager,
-                                      NodeStartupControllerService *node_startup_controller) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
-void        luc_starter_start_groups (LUCStarter                   *starter);
-void        luc_starter_cancel       (LUCStarter                   *starter);
+GType       luc_starter_get_type               (void) G_GNUC_CONST;
+
+LUCStarter *luc_starter_new                    (JobManager                   *job_manager,
+                                                NodeStartupControllerService *node_startup_controller) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+void        luc_starter_start_groups           (LUCStarter                   *starter);
+void        luc_starter_cancel                 (LUCStarter                   *starter);
+void        luc_starter_set_type_max_in_flight (LUCStarter                   *starter,
+                                                gint                          type,
+                                                guint                         max_in_flight);
 
 G_END_DECLS
 
@@ -35,6 +35,7 @@
 #include <node-startup-controller/node-startup-controller-dbus.h>
 #include <node-startup-controller/node-startup-controller-service.h>
 #include <node-startup-controller/systemd-manager-dbus.h>
+#include <node-startup-controller/systemd-transport.h>
 #include <node-startup-controller/target-startup-monitor.h>
 
 
@@ -54,6 +55,22 @@ unregister_dlt (void)
 
 
 
+static void
+systemd_manager_changed (JobManager           *job_manager,
+                         GParamSpec           *pspec,
+                         TargetStartupMonitor *target_startup_monitor)
+{
+  SystemdManager *systemd_manager;
+
+  /* the job manager has reconnected to systemd; let the target startup
+   * monitor use the new connection as well */
+  g_object_get (job_manager, "systemd-manager", &systemd_manager, NULL);
+  target_startup_monitor_set_systemd_manager (target_startup_monitor, systemd_manager);
+  g_object_unref (systemd_manager);
+}
+
+
+
 int
 main (int    argc,
       char **argv)
@@ -97,13 +114,8 @@ main (int    argc,
       return EXIT_FAILURE;
     }
 
-  /* attempt to connect to the systemd manager */
-  systemd_manager =
-    systemd_manager_proxy_new_for_bus_sync (G_BUS_TYPE_SYSTEM,
-                                            G_DBUS_PROXY_FLAGS_NONE,
-                                            "org.freedesktop.systemd1",
-                                            "/org/freedesktop/systemd1",
-                                            NULL, &error);
+  /* attempt to connect to the systemd manager, directly if this is enabled */
+  systemd_manager = systemd_transport_connect (&error);
   if (systemd_manager == NULL)
     {
       DLT_LOG (controller_context, DLT_LOG_FATAL,
@@ -179,6 +191,8 @@ main (int    argc,
 
   /* create the target startup monitor */
   target_startup_monitor = target_startup_monitor_new (systemd_manager);
+  g_signal_connect (job_manager, "notify::systemd-manager",
+                    G_CALLBACK (systemd_manager_changed), target_startup_monitor);
 
   /* create and run the main application */
   application = node_startup_controller_application_new (main_loop, connection,
@@ -191,6 +205,8 @@ main (int    argc,
 
   /* release allocated objects */
   g_object_unref (application);
+  g_signal_handlers_disconnect_by_func (job_manager, systemd_manager_changed,
+                                        target_startup_monitor);
   g_object_unref (target_startup_monitor);
   g_object_unref (systemd_manager);
   g_object_unref (job_manager);
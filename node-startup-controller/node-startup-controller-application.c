@@ -86,7 +86,14 @@ static void     node_startup_controller_application_set_property
 static void     node_startup_controller_application_luc_groups_started           (LUCStarter                       *starter,
                                                                                   NodeStartupControllerApplication *application);
 static gboolean node_startup_controller_application_handle_sigterm               (gpointer                          user_data);
+static void     node_startup_controller_application_flush_luc                    (NodeStartupControllerApplication *application);
+static void     node_startup_controller_application_flush_luc_finish             (GObject                          *object,
+                                                                                  GAsyncResult                     *res,
+                                                                                  gpointer                          user_data);
 static void     node_startup_controller_application_unregister_shutdown_consumer (NodeStartupControllerApplication *application);
+static void     node_startup_controller_application_deregister_consumers_finish  (GObject                          *object,
+                                                                                  GAsyncResult                     *res,
+                                                                                  gpointer                          user_data);
 static void     node_startup_controller_application_bus_name_acquired            (GDBusConnection                  *connection,
                                                                                   const gchar                      *name,
                                                                                   gpointer                          user_data);
@@ -172,6 +179,11 @@ struct _NodeStartupControllerApplication
 
   /* source ID for the SIGTERM handler */
   guint                         sigterm_id;
+
+  /* whether the application is shutting down, and the lifecycle request
+   * to complete once the last user context has been written */
+  gboolean                      shutting_down;
+  GDBusMethodInvocation        *lifecycle_invocation;
 };
 
 
@@ -338,6 +350,10 @@ node_startup_controller_application_finalize (GObject *object)
   if (application->sigterm_id > 0)
     g_source_remove (application->sigterm_id);
 
+  /* release a lifecycle request that was never completed */
+  if (application->lifecycle_invocation != NULL)
+    g_object_unref (application->lifecycle_invocation);
+
   (*G_OBJECT_CLASS (node_startup_controller_application_parent_class)->finalize) (object);
 }
 
@@ -508,15 +524,18 @@ node_startup_controller_application_handle_lifecycle_request (ShutdownConsumer
   /* cancel the LUC startup */
   luc_starter_cancel (application->luc_starter);
 
-  /* deregister the shutdown consumers */
-  la_handler_service_deregister_consumers (application->la_handler);
-
-  /* deregister the shutdown consumer of the application itself */
-  node_startup_controller_application_unregister_shutdown_consumer (application);
+  if (application->shutting_down)
+    {
+      /* we are shutting down already, so there is nothing left to do */
+      shutdown_consumer_complete_lifecycle_request (consumer, invocation,
+                                                    NSM_ERROR_STATUS_OK);
+      return TRUE;
+    }
 
-  /* let the NSM know that we have handled the lifecycle request */
-  shutdown_consumer_complete_lifecycle_request (consumer, invocation,
-                                                NSM_ERROR_STATUS_OK);
+  /* write the last user context before it is too late; the lifecycle request is
+   * completed and the shutdown consumers are deregistered once it is written */
+  application->lifecycle_invocation = g_object_ref (invocation);
+  node_startup_controller_application_flush_luc (application);
 
   return TRUE;
 }
@@ -617,11 +636,10 @@ node_startup_controller_application_handle_sigterm (gpointer user_data)
   /* cancel the LUC startup */
   luc_starter_cancel (application->luc_starter);
 
-  /* deregister the shutdown consumers of legacy applications */
-  la_handler_service_deregister_consumers (application->la_handler);
-
-  /* unregister the shutdown client for the app itself */
-  node_startup_controller_application_unregister_shutdown_consumer (application);
+  /* write the last user context before it is too late, then deregister the
+   * shutdown consumers, unless a lifecycle request is doing that already */
+  if (!application->shutting_down)
+    node_startup_controller_application_flush_luc (application);
 
   /* reset the source ID */
   application->sigterm_id = 0;
@@ -631,6 +649,63 @@ node_startup_controller_application_handle_sigterm (gpointer user_data)
 
 
 
+static void
+node_startup_controller_application_flush_luc (NodeStartupControllerApplication *application)
+{
+  g_return_if_fail (IS_NODE_STARTUP_CONTROLLER_APPLICATION (application));
+
+  application->shutting_down = TRUE;
+
+  /* write a last user context that is still waiting to be written */
+  node_startup_controller_service_write_luc (application->node_startup_controller,
+                                             node_startup_controller_application_flush_luc_finish,
+                                             application);
+}
+
+
+
+static void
+node_startup_controller_application_flush_luc_finish (GObject      *object,
+                                                      GAsyncResult *res,
+                                                      gpointer      user_data)
+{
+  NodeStartupControllerApplication *application = NODE_STARTUP_CONTROLLER_APPLICATION (user_data);
+  ShutdownConsumer                 *consumer;
+  GError                           *error = NULL;
+
+  g_return_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (object));
+  g_return_if_fail (G_IS_ASYNC_RESULT (res));
+  g_return_if_fail (IS_NODE_STARTUP_CONTROLLER_APPLICATION (application));
+
+  if (!node_startup_controller_service_write_luc_finish (NODE_STARTUP_CONTROLLER_SERVICE (object),
+                                                         res, &error))
+    {
+      DLT_LOG (controller_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to write the LUC before shutting down:"),
+               DLT_STRING (error->message));
+      g_error_free (error);
+    }
+
+  /* let the NSM know that we have handled the lifecycle request */
+  if (application->lifecycle_invocation != NULL)
+    {
+      consumer = shutdown_client_get_consumer (application->client);
+      shutdown_consumer_complete_lifecycle_request (consumer,
+                                                    application->lifecycle_invocation,
+                                                    NSM_ERROR_STATUS_OK);
+      g_object_unref (application->lifecycle_invocation);
+      application->lifecycle_invocation = NULL;
+    }
+
+  /* deregister the shutdown consumers of legacy applications and, once that
+   * is done, the shutdown client for the app itself */
+  la_handler_service_deregister_consumers (application->la_handler,
+                                           node_startup_controller_application_deregister_consumers_finish,
+                                           application);
+}
+
+
+
 static void
 node_startup_controller_application_unregister_shutdown_consumer (NodeStartupControllerApplication *application)
 {
@@ -654,6 +729,33 @@ node_startup_controller_application_unregister_shutdown_consumer (NodeStartupCon
 
 
 
+static void
+node_startup_controller_application_deregister_consumers_finish (GObject      *object,
+                                                                 GAsyncResult *res,
+                                                                 gpointer      user_data)
+{
+  NodeStartupControllerApplication *application = NODE_STARTUP_CONTROLLER_APPLICATION (user_data);
+  GError                           *error = NULL;
+
+  g_return_if_fail (LA_HANDLER_IS_SERVICE (object));
+  g_return_if_fail (G_IS_ASYNC_RESULT (res));
+  g_return_if_fail (IS_NODE_STARTUP_CONTROLLER_APPLICATION (application));
+
+  if (!la_handler_service_deregister_consumers_finish (LA_HANDLER_SERVICE (object),
+                                                       res, &error))
+    {
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Failed to deregister all shutdown consumers:"),
+               DLT_STRING (error->message));
+      g_error_free (error);
+    }
+
+  /* unregister the shutdown client for the app itself */
+  node_startup_controller_application_unregister_shutdown_consumer (application);
+}
+
+
+
 static void
 node_startup_controller_application_bus_name_acquired (GDBusConnection *connection,
                                                        const gchar     *name,
@@ -27,7 +27,9 @@
 
 #include <dlt/dlt.h>
 
+#include <node-startup-controller/config-file.h>
 #include <node-startup-controller/glib-extensions.h>
+#include <node-startup-controller/luc-file.h>
 #include <node-startup-controller/node-startup-controller-dbus.h>
 #include <node-startup-controller/node-startup-controller-service.h>
 
@@ -55,22 +57,33 @@
  * #gdbus-org.genivi.NodeStartupController1.NodeStartupController.
  *
  * When the #NodeStartupControllerService receives a "handle-begin-luc-registration"
- * signal, it creates an empty #GVariant (of type "a{ias}", a dictionary of LUC types as
- * integers to groups of units as string arrays) which it uses to contain the new
- * candidate for the Last User Context, and allows other methods to be called
- * successfully.
+ * signal, it creates an empty candidate for the Last User Context, and allows other
+ * methods to be called successfully. The candidate is kept as an index that maps each
+ * LUC type to an ordered set of interned unit names, so that registrations can be
+ * applied incrementally without copying the units that are already registered.
  *
  * When it receives a "handle-register-with-luc" signal and it has already handled
  * "handle-begin-lucregistration", it adds the #GVariant that it received with the signal
  * to the new candidate. If a new LUC type is specified, it will add the whole group,
  * and if new units are added to an existing group, they get added at the end. If a unit
  * exists in both the received #GVariant and in the new candidate then the unit will be
- * added at the end.
+ * moved to the end.
  *
  * When it receives a "handle-finish-lucregistration" and it has already handled
- * "handle-begin-lucregistration", it writes the new candidate by calling
- * node_startup_controller_service_write_luc(), then deletes the candidate so that
+ * "handle-begin-lucregistration", it converts the candidate into a #GVariant (of type
+ * "a{ias}", a dictionary of LUC types as integers to groups of units as string arrays),
+ * queues it for being written, then deletes the candidate so that
  * "handle-begin-lucregistration" can be called again.
+ *
+ * The Last User Context is written behind: a queued context is only written after the
+ * %WriteDelay (in milliseconds) from the %LUCPersistence group of the configuration file
+ * has passed, so that several registrations in a row result in a single write. A
+ * context that is identical to the one written last is not written again, and the
+ * file is replaced asynchronously so that the main loop is not blocked. With a
+ * %WriteDelay of 0, the context is written synchronously before the
+ * FinishLUCRegistration call returns. node_startup_controller_service_write_luc()
+ * asynchronously writes a queued context right away, after a write in progress has
+ * finished, which is used when the system is shutting down.
  */
 
 
@@ -88,25 +101,50 @@ enum
 
 
 
-static void     node_startup_controller_service_finalize                       (GObject                      *object);
-static void     node_startup_controller_service_get_property                   (GObject                      *object,
-                                                                                guint                         prop_id,
-                                                                                GValue                       *value,
-                                                                                GParamSpec                   *pspec);
-static void     node_startup_controller_service_set_property                   (GObject                      *object,
-                                                                                guint                         prop_id,
-                                                                                const GValue                 *value,
-                                                                                GParamSpec                   *pspec);
-static gboolean node_startup_controller_service_handle_begin_luc_registration  (NodeStartupController        *interface,
-                                                                                GDBusMethodInvocation        *invocation,
-                                                                                NodeStartupControllerService *service);
-static gboolean node_startup_controller_service_handle_finish_luc_registration (NodeStartupController        *interface,
-                                                                                GDBusMethodInvocation        *invocation,
-                                                                                NodeStartupControllerService *service);
-static gboolean node_startup_controller_service_handle_register_with_luc       (NodeStartupController        *interface,
-                                                                                GDBusMethodInvocation        *invocation,
-                                                                                GVariant                     *apps,
-                                                                                NodeStartupControllerService *service);
+typedef struct _LUCTypeUnits LUCTypeUnits;
+
+
+
+static void          node_startup_controller_service_finalize                       (GObject                      *object);
+static void          node_startup_controller_service_get_property                   (GObject                      *object,
+                                                                                     guint                         prop_id,
+                                                                                     GValue                       *value,
+                                                                                     GParamSpec                   *pspec);
+static void          node_startup_controller_service_set_property                   (GObject                      *object,
+                                                                                     guint                         prop_id,
+                                                                                     const GValue                 *value,
+                                                                                     GParamSpec                   *pspec);
+static gboolean      node_startup_controller_service_handle_begin_luc_registration  (NodeStartupController        *interface,
+                                                                                     GDBusMethodInvocation        *invocation,
+                                                                                     NodeStartupControllerService *service);
+static gboolean      node_startup_controller_service_handle_finish_luc_registration (NodeStartupController        *interface,
+                                                                                     GDBusMethodInvocation        *invocation,
+                                                                                     NodeStartupControllerService *service);
+static gboolean      node_startup_controller_service_handle_register_with_luc       (NodeStartupController        *interface,
+                                                                                     GDBusMethodInvocation        *invocation,
+                                                                                     GVariant                     *apps,
+                                                                                     NodeStartupControllerService *service);
+static GVariant     *node_startup_controller_service_build_luc                      (NodeStartupControllerService *service);
+static gchar        *node_startup_controller_service_get_luc_path                   (void);
+static void          node_startup_controller_service_queue_luc                      (NodeStartupControllerService *service,
+                                                                                     GVariant                     *context);
+static gboolean      node_startup_controller_service_write_luc_timeout              (gpointer                      user_data);
+static gboolean      node_startup_controller_service_write_luc_async                (NodeStartupControllerService *service,
+                                                                                     GError                      **error);
+static void          node_startup_controller_service_write_luc_async_finish         (GObject                      *object,
+                                                                                     GAsyncResult                 *res,
+                                                                                     gpointer                      user_data);
+static gboolean      node_startup_controller_service_write_luc_sync                 (NodeStartupControllerService *service,
+                                                                                     GVariant                     *context,
+                                                                                     GError                      **error);
+static void          node_startup_controller_service_complete_flushes               (NodeStartupControllerService *service,
+                                                                                     const GError                 *error);
+static gboolean      node_startup_controller_service_make_luc_dir                   (GFile                        *luc_file,
+                                                                                     GError                      **error);
+static LUCTypeUnits *luc_type_units_new                                             (void);
+static void          luc_type_units_free                                            (LUCTypeUnits                 *units);
+static void          luc_type_units_add                                             (LUCTypeUnits                 *units,
+                                                                                     const gchar                  *unit);
 
 
 
@@ -122,8 +160,37 @@ struct _NodeStartupControllerService
   GDBusConnection       *connection;
   NodeStartupController *interface;
 
-  GVariant              *current_user_context;
+  /* the candidate for the new last user context, mapping LUC types
+   * to LUCTypeUnits */
+  GHashTable            *luc_candidate;
   gboolean               started_registration;
+
+  /* the last user context waiting to be written, the one being written
+   * and its file contents, and the checksum of the most recently queued
+   * last user context */
+  GVariant              *pending_luc;
+  GVariant              *writing_luc;
+  gchar                 *writing_data;
+  gchar                 *luc_checksum;
+
+  /* milliseconds to wait before writing, and the source ID of the timeout */
+  guint                  write_delay;
+  guint                  write_id;
+
+  /* results of node_startup_controller_service_write_luc() calls waiting
+   * for the last user context to be written */
+  GList                 *flushes;
+
+  /* whether the directory of the last user context is known to exist */
+  gboolean               luc_dir_exists;
+};
+
+struct _LUCTypeUnits
+{
+  /* interned unit names in the order of registration, and the
+   * mapping of each name to its link in the queue */
+  GQueue      queue;
+  GHashTable *links;
 };
 
 
@@ -160,13 +227,23 @@ node_startup_controller_service_class_init (NodeStartupControllerServiceClass *k
 static void
 node_startup_controller_service_init (NodeStartupControllerService *service)
 {
+  GKeyFile *config;
+
   service->interface = node_startup_controller_skeleton_new ();
 
   /* initially, no registration is assumed to have been started */
   service->started_registration = FALSE;
 
-  /* reset current user context */
-  service->current_user_context = NULL;
+  /* allocate the candidate index */
+  service->luc_candidate =
+    g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                           NULL, (GDestroyNotify) luc_type_units_free);
+
+  /* read the write-behind delay from the configuration */
+  config = config_file_load ();
+  service->write_delay =
+    MAX (config_file_get_integer (config, "LUCPersistence", "WriteDelay", 1000), 0);
+  g_key_file_free (config);
 
   /* implement the RegisterWithLUC() handler */
   g_signal_connect (service->interface, "handle-register-with-luc",
@@ -201,9 +278,13 @@ node_startup_controller_service_finalize (GObject *object)
   g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (service->interface));
   g_object_unref (service->interface);
 
-  /* release the current user context */
-  if (service->current_user_context != NULL)
-    g_variant_unref (service->current_user_context);
+  /* release the candidate index and the last user context not written yet */
+  g_hash_table_unref (service->luc_candidate);
+  if (service->write_id > 0)
+    g_source_remove (service->write_id);
+  if (service->pending_luc != NULL)
+    g_variant_unref (service->pending_luc);
+  g_free (service->luc_checksum);
 
   (*G_OBJECT_CLASS (node_startup_controller_service_parent_class)->finalize) (object);
 }
@@ -257,8 +338,6 @@ node_startup_controller_service_handle_begin_luc_registration (NodeStartupContro
                                                                GDBusMethodInvocation        *invocation,
                                                                NodeStartupControllerService *service)
 {
-  GVariantBuilder builder;
-
   g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER (interface), FALSE);
   g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), FALSE);
   g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (service), FALSE);
@@ -266,9 +345,8 @@ node_startup_controller_service_handle_begin_luc_registration (NodeStartupContro
   /* mark the last user context registration as started */
   service->started_registration = TRUE;
 
-  /* initialize the current user context */
-  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ias}"));
-  service->current_user_context = g_variant_builder_end (&builder);
+  /* initialize the candidate for the new last user context */
+  g_hash_table_remove_all (service->luc_candidate);
 
   /* notify the caller that we have handled the method call */
   g_dbus_method_invocation_return_value (invocation, NULL);
@@ -282,7 +360,8 @@ node_startup_controller_service_handle_finish_luc_registration (NodeStartupContr
                                                                 GDBusMethodInvocation        *invocation,
                                                                 NodeStartupControllerService *service)
 {
-  GError *error = NULL;
+  GVariant *context;
+  gchar    *debug_text;
 
   g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER (interface), FALSE);
   g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), FALSE);
@@ -300,22 +379,24 @@ node_startup_controller_service_handle_finish_luc_registration (NodeStartupContr
       return TRUE;
     }
 
-  /* write the last user context in a file */
-  node_startup_controller_service_write_luc (service, &error);
-  if (error != NULL)
-   {
-     DLT_LOG (controller_context, DLT_LOG_ERROR,
-              DLT_STRING ("Failed to finish the LUC registration:"),
-              DLT_STRING (error->message));
-     g_error_free (error);
-   }
+  /* serialize the candidate into the new last user context */
+  context = node_startup_controller_service_build_luc (service);
+
+  /* log the new last user context */
+  debug_text = g_variant_print (context, TRUE);
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Finished LUC registration:"), DLT_STRING (debug_text));
+  g_free (debug_text);
+
+  /* write the last user context in a file, or queue it to be written later */
+  node_startup_controller_service_queue_luc (service, context);
+  g_variant_unref (context);
 
   /* mark the last user context registration as finished */
   service->started_registration = FALSE;
 
-  /* clear the current user context */
-  g_variant_unref (service->current_user_context);
-  service->current_user_context = NULL;
+  /* clear the candidate */
+  g_hash_table_remove_all (service->luc_candidate);
 
   /* notify the caller that we have handled the register request */
   g_dbus_method_invocation_return_value (invocation, NULL);
@@ -330,21 +411,12 @@ node_startup_controller_service_handle_register_with_luc (NodeStartupController
                                                           GVariant                     *apps,
                                                           NodeStartupControllerService *service)
 {
-  GVariantBuilder dict_builder;
-  GHashTableIter  hiter;
-  GVariantIter    viter;
-  GHashTable     *table;
-  GPtrArray      *apps_array;
-  GVariant       *current_context;
-  GVariant       *current_apps;
-  GVariant       *new_apps;
-  gpointer        key;
-  GList          *lp;
-  GList          *luc_types;
-  gchar          *app;
-  gchar          *debug_text = NULL;
-  guint           n;
-  gint            luc_type;
+  LUCTypeUnits *units;
+  GVariantIter  viter;
+  GVariantIter *aiter;
+  gchar        *app;
+  guint         n_apps;
+  gint          luc_type;
 
   g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER (interface), FALSE);
   g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), FALSE);
@@ -362,119 +434,431 @@ node_startup_controller_service_handle_register_with_luc (NodeStartupController
       return TRUE;
     }
 
-  /* create a hash table to merge the current context and the newly registered apps */
-  table = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-                                 NULL, (GDestroyNotify) g_ptr_array_unref);
+  /* apply the newly registered apps to the candidate, LUC type by LUC type */
+  g_variant_iter_init (&viter, apps);
+  while (g_variant_iter_next (&viter, "{ias}", &luc_type, &aiter))
+    {
+      /* look up the units of the LUC type, adding the LUC type if it is new */
+      units = g_hash_table_lookup (service->luc_candidate, GINT_TO_POINTER (luc_type));
+      if (units == NULL)
+        {
+          units = luc_type_units_new ();
+          g_hash_table_insert (service->luc_candidate, GINT_TO_POINTER (luc_type), units);
+        }
 
-  /* obtain the current content of the last user context */
-  current_context = g_variant_ref (service->current_user_context);
+      /* add the apps in order; apps that are registered already are moved to
+       * the end so that they are "prioritized" */
+      n_apps = 0;
+      while (g_variant_iter_loop (aiter, "&s", &app))
+        {
+          luc_type_units_add (units, app);
+          n_apps++;
+        }
+      g_variant_iter_free (aiter);
+
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("Updated LUC type:"), DLT_INT (luc_type),
+               DLT_STRING ("apps registered"), DLT_UINT (n_apps),
+               DLT_STRING ("apps in total"), DLT_UINT (units->queue.length));
+    }
+
+  /* notify the caller that we have handled the register request */
+  g_dbus_method_invocation_return_value (invocation, NULL);
 
-  /* prepare app lists for all LUC types present in the current context */
-  g_variant_iter_init (&viter, current_context);
-  while (g_variant_iter_loop (&viter, "{ias}", &luc_type, NULL))
+  return TRUE;
+}
+
+
+
+static GVariant *
+node_startup_controller_service_build_luc (NodeStartupControllerService *service)
+{
+  GVariantBuilder builder;
+  LUCTypeUnits   *units;
+  GList          *luc_types;
+  GList          *lp;
+  GList          *up;
+
+  /* construct a new dictionary variant for the new LUC */
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{ias}"));
+
+  /* copy LUC types and corresponding apps over to the new context.
+   * make sure the order in which we add LUC types to the context
+   * dict is always the same. this is helpful for testing */
+  luc_types = g_hash_table_get_keys (service->luc_candidate);
+  luc_types = g_list_sort (luc_types, (GCompareFunc) g_int_pointer_compare);
+  for (lp = luc_types; lp != NULL; lp = lp->next)
     {
-      g_hash_table_insert (table, GINT_TO_POINTER (luc_type),
-                           g_ptr_array_new_with_free_func (g_free));
+      units = g_hash_table_lookup (service->luc_candidate, lp->data);
+
+      /* add the LUC type and its apps to the new context */
+      g_variant_builder_open (&builder, G_VARIANT_TYPE ("{ias}"));
+      g_variant_builder_add (&builder, "i", GPOINTER_TO_INT (lp->data));
+      g_variant_builder_open (&builder, G_VARIANT_TYPE_STRING_ARRAY);
+      for (up = units->queue.head; up != NULL; up = up->next)
+        g_variant_builder_add (&builder, "s", up->data);
+      g_variant_builder_close (&builder);
+      g_variant_builder_close (&builder);
     }
+  g_list_free (luc_types);
 
-  /* add app lists for LUC types that are needed for the newly registered apps */
-  g_variant_iter_init (&viter, apps);
-  while (g_variant_iter_loop (&viter, "{ias}", &luc_type, NULL))
+  return g_variant_ref_sink (g_variant_builder_end (&builder));
+}
+
+
+
+static gchar *
+node_startup_controller_service_get_luc_path (void)
+{
+  const gchar *luc_path;
+
+  /* check which configuration file to use; the LUC_PATH environment variable
+   * has priority over the build-time LUC_PATH definition */
+  luc_path = g_getenv ("LUC_PATH");
+  if (luc_path == NULL)
+    luc_path = LUC_PATH;
+
+  return g_strdup (luc_path);
+}
+
+
+
+static void
+node_startup_controller_service_queue_luc (NodeStartupControllerService *service,
+                                           GVariant                     *context)
+{
+  GError *error = NULL;
+  gchar  *checksum;
+
+  g_return_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (service));
+  g_return_if_fail (context != NULL);
+
+  /* skip the write if the last user context has not changed */
+  checksum = g_compute_checksum_for_data (G_CHECKSUM_SHA1, g_variant_get_data (context),
+                                          g_variant_get_size (context));
+  if (g_strcmp0 (checksum, service->luc_checksum) == 0)
+    {
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("LUC is unchanged, not writing it"));
+      g_free (checksum);
+      return;
+    }
+  g_free (service->luc_checksum);
+  service->luc_checksum = checksum;
+
+  /* without a delay, the context is written before the registration is finished,
+   * unless a write is in progress; then it is queued and written after it */
+  if (service->write_delay == 0 && service->writing_luc == NULL)
+    {
+      if (service->write_id > 0)
+        {
+          g_source_remove (service->write_id);
+          service->write_id = 0;
+        }
+      if (service->pending_luc != NULL)
+        {
+          g_variant_unref (service->pending_luc);
+          service->pending_luc = NULL;
+        }
+
+      if (!node_startup_controller_service_write_luc_sync (service, context, &error))
+        {
+          DLT_LOG (controller_context, DLT_LOG_ERROR,
+                   DLT_STRING ("Failed to write the LUC:"), DLT_STRING (error->message));
+          g_error_free (error);
+
+          /* make sure the same context is not skipped the next time */
+          g_free (service->luc_checksum);
+          service->luc_checksum = NULL;
+        }
+      return;
+    }
+
+  /* replace any last user context that has not been written yet */
+  if (service->pending_luc != NULL)
+    g_variant_unref (service->pending_luc);
+  service->pending_luc = g_variant_ref (context);
+
+  /* write after the delay, unless a write is scheduled or in progress already;
+   * in that case, the pending context is picked up when it is finished */
+  if (service->write_id == 0 && service->writing_luc == NULL)
     {
-      g_hash_table_insert (table, GINT_TO_POINTER (luc_type),
-                           g_ptr_array_new_with_free_func (g_free));
+      service->write_id =
+        g_timeout_add (service->write_delay,
+                       node_startup_controller_service_write_luc_timeout, service);
+    }
+}
+
+
+
+static gboolean
+node_startup_controller_service_write_luc_timeout (gpointer user_data)
+{
+  NodeStartupControllerService *service = NODE_STARTUP_CONTROLLER_SERVICE (user_data);
+  GError                       *error = NULL;
+
+  service->write_id = 0;
+  if (!node_startup_controller_service_write_luc_async (service, &error))
+    {
+      DLT_LOG (controller_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to write the LUC:"), DLT_STRING (error->message));
+      g_error_free (error);
     }
 
-  /* we now have a hash table that has all LUC types involved in the
-   * current context and in the newly registered apps */
+  return FALSE;
+}
+
+
+
+static gboolean
+node_startup_controller_service_write_luc_async (NodeStartupControllerService *service,
+                                                 GError                      **error)
+{
+  GFile *luc_file;
+  gchar *luc_path;
+  gsize  length;
+
+  g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (service), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
-  /* fill the app lists for each LUC type involved, make sure that newly registered
-   * apps are added at the end so that they are "prioritized" */
-  g_hash_table_iter_init (&hiter, table);
-  while (g_hash_table_iter_next (&hiter, (gpointer) &key, (gpointer) &apps_array))
+  if (service->pending_luc == NULL || service->writing_luc != NULL)
+    return TRUE;
+
+  luc_path = node_startup_controller_service_get_luc_path ();
+  luc_file = g_file_new_for_path (luc_path);
+  g_free (luc_path);
+
+  /* make sure the last user context's directory exists; this only has to be
+   * checked once */
+  if (!service->luc_dir_exists)
     {
-      /* get apps currently registered for the LUC type */
-      current_apps = g_variant_lookup_value_with_int_key (current_context,
-                                                          GPOINTER_TO_INT (key),
-                                                          G_VARIANT_TYPE_STRING_ARRAY);
-
-      /* get apps to be registered for the LUC type now */
-      new_apps = g_variant_lookup_value_with_int_key (apps,
-                                                      GPOINTER_TO_INT (key),
-                                                      G_VARIANT_TYPE_STRING_ARRAY);
-
-      /* add all currently registered apps unless they are to be registered now.
-       * this is because we want apps to be registered now to be moved to the end
-       * of the lists */
-      for (n = 0; current_apps != NULL && n < g_variant_n_children (current_apps); n++)
+      if (!node_startup_controller_service_make_luc_dir (luc_file, error))
         {
-          g_variant_get_child (current_apps, n, "&s", &app);
-          if (!g_variant_string_array_has_string (new_apps, app))
-            g_ptr_array_add (apps_array, g_strdup (app));
+          g_object_unref (luc_file);
+          return FALSE;
         }
+      service->luc_dir_exists = TRUE;
+    }
+
+  /* keep the last user context and its file contents alive until they
+   * have been written */
+  service->writing_luc = service->pending_luc;
+  service->pending_luc = NULL;
+  service->writing_data = luc_file_build (service->writing_luc, &length);
+
+  /* replace the contents of the file. g_file_replace_contents_async
+   * guarantees atomic overwriting and keeps the previous file as a backup */
+  g_file_replace_contents_async (luc_file, service->writing_data, length, NULL,
+                                 TRUE, G_FILE_CREATE_NONE, NULL,
+                                 node_startup_controller_service_write_luc_async_finish,
+                                 g_object_ref (service));
+
+  g_object_unref (luc_file);
+
+  return TRUE;
+}
+
+
+
+static void
+node_startup_controller_service_write_luc_async_finish (GObject      *object,
+                                                        GAsyncResult *res,
+                                                        gpointer      user_data)
+{
+  NodeStartupControllerService *service = NODE_STARTUP_CONTROLLER_SERVICE (user_data);
+  GError                       *error = NULL;
 
-      /* add all newly registered apps at the end now */
-      for (n = 0; new_apps != NULL && n < g_variant_n_children (new_apps); n++)
+  if (!g_file_replace_contents_finish (G_FILE (object), res, NULL, &error))
+    {
+      DLT_LOG (controller_context, DLT_LOG_ERROR,
+               DLT_STRING ("Failed to write the LUC:"), DLT_STRING (error->message));
+
+      /* make sure the same context is not skipped the next time */
+      if (service->pending_luc == NULL)
         {
-          g_variant_get_child (new_apps, n, "&s", &app);
-          g_ptr_array_add (apps_array, g_strdup (app));
+          g_free (service->luc_checksum);
+          service->luc_checksum = NULL;
         }
+    }
 
-      /* release app lists for this LUC type */
-      if (current_apps != NULL)
-        g_variant_unref (current_apps);
-      if (new_apps != NULL)
-        g_variant_unref (new_apps);
+  g_variant_unref (service->writing_luc);
+  service->writing_luc = NULL;
+  g_free (service->writing_data);
+  service->writing_data = NULL;
+
+  if (service->flushes != NULL)
+    {
+      /* the context queued in the meantime is written right away if a flush
+       * is waiting, which completes once there is nothing left to write */
+      if (service->pending_luc != NULL)
+        {
+          g_clear_error (&error);
+          node_startup_controller_service_write_luc_async (service, &error);
+        }
+      if (service->writing_luc == NULL)
+        node_startup_controller_service_complete_flushes (service, error);
+    }
+  else if (service->pending_luc != NULL && service->write_id == 0)
+    {
+      /* write the context that has been queued in the meantime */
+      service->write_id =
+        g_timeout_add (service->write_delay,
+                       node_startup_controller_service_write_luc_timeout, service);
     }
 
-  /* construct a new dictionary variant for the new LUC */
-  g_variant_builder_init (&dict_builder, G_VARIANT_TYPE ("a{ias}"));
+  if (error != NULL)
+    g_error_free (error);
+  g_object_unref (service);
+}
 
-  /* copy LUC types and corresponding apps over to the new context.
-   * make sure the order in which we add LUC types to the context
-   * dict is always the same. this is helpful for testing */
-  luc_types = g_hash_table_get_keys (table);
-  luc_types = g_list_sort (luc_types, (GCompareFunc) g_int_pointer_compare);
-  for (lp = luc_types; lp != NULL; lp = lp->next)
+
+
+static gboolean
+node_startup_controller_service_write_luc_sync (NodeStartupControllerService *service,
+                                                GVariant                     *context,
+                                                GError                      **error)
+{
+  gboolean result = FALSE;
+  GFile   *luc_file;
+  gchar   *contents;
+  gchar   *luc_path;
+  gsize    length;
+
+  luc_path = node_startup_controller_service_get_luc_path ();
+  luc_file = g_file_new_for_path (luc_path);
+  g_free (luc_path);
+
+  /* make sure the last user context's directory exists, then replace the
+   * contents of the file. g_file_replace_contents guarantees atomic
+   * overwriting and keeps the previous file as a backup */
+  if (service->luc_dir_exists
+      || node_startup_controller_service_make_luc_dir (luc_file, error))
     {
-      /* get the apps list registered for this LUC type */
-      apps_array = g_hash_table_lookup (table, lp->data);
+      service->luc_dir_exists = TRUE;
+      contents = luc_file_build (context, &length);
+      result = g_file_replace_contents (luc_file, contents, length, NULL,
+                                        TRUE, G_FILE_CREATE_NONE, NULL, NULL, error);
+      g_free (contents);
+    }
 
-      /* NULL-terminate the pointer so that we can treat it as a gchar ** */
-      g_ptr_array_add (apps_array, NULL);
+  g_object_unref (luc_file);
 
-      /* add the LUC type and its apps to the new context */
-      g_variant_builder_add (&dict_builder, "{i^as}",
-                             GPOINTER_TO_INT (lp->data), apps_array->pdata);
+  return result;
+}
+
+
+
+static void
+node_startup_controller_service_complete_flushes (NodeStartupControllerService *service,
+                                                  const GError                 *error)
+{
+  GSimpleAsyncResult *simple;
+  GList              *lp;
+
+  for (lp = service->flushes; lp != NULL; lp = lp->next)
+    {
+      simple = G_SIMPLE_ASYNC_RESULT (lp->data);
+      if (error != NULL)
+        g_simple_async_result_set_from_error (simple, error);
+      g_simple_async_result_complete_in_idle (simple);
+      g_object_unref (simple);
     }
 
-  /* free the LUC types and our LUC type to apps mapping */
-  g_list_free (luc_types);
-  g_hash_table_unref (table);
+  g_list_free (service->flushes);
+  service->flushes = NULL;
+}
 
-  /* free the last user context */
-  g_variant_unref (service->current_user_context);
 
-  /* apply the new last user context */
-  service->current_user_context = g_variant_builder_end (&dict_builder);
 
-  /* log the new last user context */
-  debug_text = g_variant_print (service->current_user_context, TRUE);
-  DLT_LOG (controller_context, DLT_LOG_INFO,
-           DLT_STRING ("Updated LUC to:"), DLT_STRING (debug_text));
-  g_free (debug_text);
+static gboolean
+node_startup_controller_service_make_luc_dir (GFile   *luc_file,
+                                              GError **error)
+{
+  GError *err = NULL;
+  GFile  *luc_dir;
 
-  /* release the current context */
-  g_variant_unref (current_context);
+  luc_dir = g_file_get_parent (luc_file);
 
-  /* notify the caller that we have handled the register request */
-  g_dbus_method_invocation_return_value (invocation, NULL);
+  /* make sure the last user context's directory exists */
+  if (!g_file_make_directory_with_parents (luc_dir, NULL, &err))
+    {
+      if (err->domain == G_IO_ERROR && err->code == G_IO_ERROR_EXISTS)
+        {
+          /* the directory exists already */
+          g_error_free (err);
+        }
+      else
+        {
+          /* let the caller know there was a problem */
+          g_propagate_error (error, err);
+          g_object_unref (luc_dir);
+          return FALSE;
+        }
+    }
 
+  g_object_unref (luc_dir);
   return TRUE;
 }
 
 
 
+static LUCTypeUnits *
+luc_type_units_new (void)
+{
+  LUCTypeUnits *units;
+
+  units = g_slice_new0 (LUCTypeUnits);
+  g_queue_init (&units->queue);
+
+  /* unit names are interned, so they can be compared by pointer */
+  units->links = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  return units;
+}
+
+
+
+static void
+luc_type_units_free (LUCTypeUnits *units)
+{
+  if (units == NULL)
+    return;
+
+  g_queue_clear (&units->queue);
+  g_hash_table_unref (units->links);
+  g_slice_free (LUCTypeUnits, units);
+}
+
+
+
+static void
+luc_type_units_add (LUCTypeUnits *units,
+                    const gchar  *unit)
+{
+  const gchar *name;
+  GList       *link;
+
+  g_return_if_fail (units != NULL);
+  g_return_if_fail (unit != NULL);
+
+  name = g_intern_string (unit);
+
+  /* move the unit to the end if it is registered already, otherwise append it */
+  link = g_hash_table_lookup (units->links, name);
+  if (link != NULL)
+    {
+      g_queue_unlink (&units->queue, link);
+      g_queue_push_tail_link (&units->queue, link);
+    }
+  else
+    {
+      g_queue_push_tail (&units->queue, (gpointer) name);
+      g_hash_table_insert (units->links, (gpointer) name, units->queue.tail);
+    }
+}
+
+
+
 /**
  * node_startup_controller_service_new:
  * @connection: A connection to the system bus.
@@ -529,7 +913,10 @@ node_startup_controller_service_start_up (NodeStartupControllerService *service,
  * @error: The location of the error raised, or %NULL.
  * 
  * Reads the Last User Context from the file whose location is defined by the environment
- * variable %LUC_PATH, or if not, the build-time definition of %LUC_PATH.
+ * variable %LUC_PATH, or if not, the build-time definition of %LUC_PATH. The file is
+ * mapped into memory and validated with luc_file_load(). If it is invalid, the previous
+ * copy of the file is used instead. A Last User Context that is still waiting to be
+ * written is returned without reading the file.
  * 
  * Returns: A #GVariant of the form "a{ias}" which contains the Last User Context if
  * successfully read. In case of failure, %NULL is returned and the error is set.
@@ -538,36 +925,54 @@ GVariant *
 node_startup_controller_service_read_luc (NodeStartupControllerService *service,
                                           GError                      **error)
 {
-  const gchar *luc_path;
-  GVariant    *context;
-  GFile       *luc_file;
-  char        *data;
-  gsize        data_len;
+  GVariant *context;
+  GError   *err = NULL;
+  gchar    *backup_path;
+  gchar    *luc_path;
+  guint     version;
 
   g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (service), NULL);
   g_return_val_if_fail ((error == NULL || *error == NULL), NULL);
 
-  /* check which configuration file to use; the LUC_PATH environment variable
-   * has priority over the build-time LUC_PATH definition */
-  luc_path = g_getenv ("LUC_PATH");
-  if (luc_path == NULL)
-    luc_path = LUC_PATH;
-
-  /* initialize the GFile */
-  luc_file = g_file_new_for_path (luc_path);
+  /* a last user context that has not been written yet is the most recent one */
+  if (service->pending_luc != NULL)
+    return g_variant_ref (service->pending_luc);
+  if (service->writing_luc != NULL)
+    return g_variant_ref (service->writing_luc);
 
-  /* read the contents of the file */
-  if (!g_file_load_contents (luc_file, NULL, &data, &data_len, NULL, error))
+  /* map and validate the file */
+  luc_path = node_startup_controller_service_get_luc_path ();
+  context = luc_file_load (luc_path, &version, &err);
+  if (context == NULL)
     {
-      g_object_unref (luc_file);
-      return NULL;
-    }
+      /* fall back to the previous copy, which is kept as a backup
+       * whenever the file is replaced */
+      backup_path = g_strconcat (luc_path, "~", NULL);
+      context = luc_file_load (backup_path, &version, NULL);
+      g_free (backup_path);
 
-  /* store the contents of the file in a GVariant */
-  context = g_variant_new_from_data (G_VARIANT_TYPE ("a{ias}"), data, data_len,
-                                     TRUE, g_free, data);
+      if (context == NULL)
+        {
+          g_propagate_error (error, err);
+          g_free (luc_path);
+          return NULL;
+        }
 
-  g_object_unref (luc_file);
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Failed to read the LUC, using the previous copy:"),
+               DLT_STRING (err->message));
+      g_error_free (err);
+    }
+  g_free (luc_path);
+
+  /* remember the checksum so that writing the same context again is skipped,
+   * unless the file has to be upgraded to the current version */
+  if (service->luc_checksum == NULL && version == 2)
+    {
+      service->luc_checksum =
+        g_compute_checksum_for_data (G_CHECKSUM_SHA1, g_variant_get_data (context),
+                                     g_variant_get_size (context));
+    }
 
   return context;
 }
@@ -577,59 +982,73 @@ node_startup_controller_service_read_luc (NodeStartupControllerService *service,
 /**
  * node_startup_controller_service_write_luc:
  * @service: A #NodeStartupControllerService.
- * @error: The location of the error raised, or %NULL.
+ * @callback: A #GAsyncReadyCallback to call when the Last User Context is written.
+ * @user_data: Data to pass to @callback.
  * 
- * Atomically writes the Last User Context stored in @service to the file whose location
- * is defined by the environment variable %LUC_PATH, or if not, the build-time definition
- * of %LUC_PATH.
+ * Asynchronously and atomically writes the Last User Context queued in @service to the
+ * file whose location is defined by the environment variable %LUC_PATH, or if not, the
+ * build-time definition of %LUC_PATH, without waiting for the write delay to pass. If a
+ * write is in progress already, it is finished first, so that it cannot replace newer
+ * contents. Call node_startup_controller_service_write_luc_finish() from @callback to
+ * get the result. This is meant to be used before shutting down.
  */
 void
 node_startup_controller_service_write_luc (NodeStartupControllerService *service,
-                                           GError                      **error)
+                                           GAsyncReadyCallback           callback,
+                                           gpointer                      user_data)
 {
-  const gchar *luc_path;
-  GError      *err = NULL;
-  GFile       *luc_file;
-  GFile       *luc_dir;
+  GSimpleAsyncResult *simple;
+  GError             *error = NULL;
 
   g_return_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (service));
-  g_return_if_fail (error == NULL || *error == NULL);
 
-  /* check which configuration file to use; the LUC_PATH environment variable
-   * has priority over the build-time LUC_PATH definition */
-  luc_path = g_getenv ("LUC_PATH");
-  if (luc_path == NULL)
-    luc_path = LUC_PATH;
+  simple = g_simple_async_result_new (G_OBJECT (service), callback, user_data,
+                                      node_startup_controller_service_write_luc);
+  service->flushes = g_list_append (service->flushes, simple);
 
-  /* initialize the GFiles */
-  luc_file = g_file_new_for_path (luc_path);
-  luc_dir = g_file_get_parent (luc_file);
+  /* the context is written right away, so the timeout is no longer needed */
+  if (service->write_id > 0)
+    {
+      g_source_remove (service->write_id);
+      service->write_id = 0;
+    }
 
-  /* make sure the last user context's directory exists */
-  if (!g_file_make_directory_with_parents (luc_dir, NULL, &err))
+  /* a write in progress writes the pending context when it has finished */
+  if (service->writing_luc != NULL)
+    return;
+
+  /* complete right away if there is nothing to write */
+  if (!node_startup_controller_service_write_luc_async (service, &error)
+      || service->writing_luc == NULL)
     {
-      if (err->domain == G_IO_ERROR && err->code == G_IO_ERROR_EXISTS)
-        {
-          /* clear the error for reuse */
-          g_clear_error (&err);
-        }
-      else
-        {
-          /* let the caller know there was a problem */
-          g_propagate_error (error, err);
-          g_object_unref (luc_file);
-          g_object_unref (luc_dir);
-          return;
-        }
+      node_startup_controller_service_complete_flushes (service, error);
+      if (error != NULL)
+        g_error_free (error);
     }
+}
 
-  /* replace the contents with that of the file. g_file_replace_contents
-   * guarantees atomic overwriting and can make backups */
-  g_file_replace_contents (luc_file, g_variant_get_data (service->current_user_context),
-                           g_variant_get_size (service->current_user_context), NULL,
-                           TRUE, G_FILE_CREATE_NONE, NULL, NULL, error);
 
-  /* release the GFiles */
-  g_object_unref (luc_file);
-  g_object_unref (luc_dir);
+
+/**
+ * node_startup_controller_service_write_luc_finish:
+ * @service: A #NodeStartupControllerService.
+ * @res: The #GAsyncResult passed to the callback.
+ * @error: The location of the error raised, or %NULL.
+ *
+ * Finishes an operation started with node_startup_controller_service_write_luc().
+ *
+ * Returns: %TRUE if the Last User Context has been written, %FALSE otherwise.
+ */
+gboolean
+node_startup_controller_service_write_luc_finish (NodeStartupControllerService *service,
+                                                  GAsyncResult                 *res,
+                                                  GError                      **error)
+{
+  g_return_val_if_fail (IS_NODE_STARTUP_CONTROLLER_SERVICE (service), FALSE);
+  g_return_val_if_fail (g_simple_async_result_is_valid (res, G_OBJECT (service),
+                                                        node_startup_controller_service_write_luc),
+                        FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  return !g_simple_async_result_propagate_error (G_SIMPLE_ASYNC_RESULT (res), error);
 }
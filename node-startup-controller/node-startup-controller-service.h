@@ -38,15 +38,19 @@ typedef struct _NodeStartupControllerService      NodeStartupControllerService;
 
 
 
-GType                         node_startup_controller_service_get_type  (void) G_GNUC_CONST;
-
-NodeStartupControllerService *node_startup_controller_service_new       (GDBusConnection              *connection) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
-gboolean                      node_startup_controller_service_start_up  (NodeStartupControllerService *service,
-                                                                         GError                      **error);
-GVariant                     *node_startup_controller_service_read_luc  (NodeStartupControllerService *service,
-                                                                         GError                      **error);
-void                          node_startup_controller_service_write_luc (NodeStartupControllerService *service,
-                                                                         GError                      **error);
+GType                         node_startup_controller_service_get_type         (void) G_GNUC_CONST;
+
+NodeStartupControllerService *node_startup_controller_service_new              (GDBusConnection              *connection) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+gboolean                      node_startup_controller_service_start_up         (NodeStartupControllerService *service,
+                                                                                GError                      **error);
+GVariant                     *node_startup_controller_service_read_luc         (NodeStartupControllerService *service,
+                                                                                GError                      **error);
+void                          node_startup_controller_service_write_luc        (NodeStartupControllerService *service,
+                                                                                GAsyncReadyCallback           callback,
+                                                                                gpointer                      user_data);
+gboolean                      node_startup_controller_service_write_luc_finish (NodeStartupControllerService *service,
+                                                                                GAsyncResult                 *res,
+                                                                                GError                      **error);
 
 
 G_END_DECLS
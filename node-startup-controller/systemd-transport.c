@@ -0,0 +1,231 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <dlt/dlt.h>
+
+#include <node-startup-controller/config-file.h>
+#include <node-startup-controller/systemd-manager-dbus.h>
+#include <node-startup-controller/systemd-transport.h>
+
+
+
+/**
+ * SECTION: systemd-transport
+ * @title: Systemd Transport
+ * @short_description: Connects to the systemd manager.
+ * @stability: Internal
+ *
+ * By default, all communication with systemd goes through the system bus daemon, which
+ * adds a hop to every StartUnit reply and every "JobRemoved" signal. When running as
+ * root, the Node Startup Controller can instead talk to systemd directly through its
+ * private peer-to-peer socket. This is enabled with the %PrivateSocket key in the
+ * %Systemd group of the configuration file; the address of the socket can be changed
+ * with the %PrivateSocketAddress key. If the private socket cannot be used, the
+ * connection falls back to the system bus.
+ *
+ * Objects that talk to systemd, like the #JobManager and the #TargetStartupMonitor, use
+ * the connection of the #SystemdManager they are given. Since there is no bus daemon
+ * on a peer-to-peer connection, messages sent over it must not name a destination;
+ * systemd_transport_get_bus_name() returns the right destination for a connection.
+ *
+ * systemd closes its private socket when it is re-executed. The #JobManager connects
+ * again with systemd_transport_connect() when that happens and hands the new
+ * #SystemdManager to the #TargetStartupMonitor.
+ */
+
+
+
+#define SYSTEMD_TRANSPORT_BUS_NAME        "org.freedesktop.systemd1"
+#define SYSTEMD_TRANSPORT_OBJECT_PATH     "/org/freedesktop/systemd1"
+#define SYSTEMD_TRANSPORT_PRIVATE_ADDRESS "unix:path=/run/systemd/private"
+
+
+
+DLT_IMPORT_CONTEXT (controller_context);
+
+
+
+/**
+ * systemd_transport_connect:
+ * @error: Return location for a #GError, or %NULL.
+ *
+ * Connects to the systemd manager, through its private socket if this is enabled in
+ * the configuration file and the process runs as root, or through the system bus.
+ *
+ * Returns: A #SystemdManager proxy, or %NULL if connecting failed. Release it with
+ * g_object_unref().
+ */
+SystemdManager *
+systemd_transport_connect (GError **error)
+{
+  SystemdManager *systemd_manager = NULL;
+  GKeyFile       *config;
+  GError         *private_error = NULL;
+  gboolean        use_private;
+  gchar          *address;
+
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  /* check whether the private socket should be used */
+  config = config_file_load ();
+  use_private = config_file_get_boolean (config, "Systemd", "PrivateSocket", FALSE);
+  address = g_key_file_get_string (config, "Systemd", "PrivateSocketAddress", NULL);
+  g_key_file_free (config);
+
+#ifdef HAVE_UNISTD_H
+  /* systemd only accepts connections from root on its private socket */
+  if (use_private && geteuid () != 0)
+    {
+      DLT_LOG (controller_context, DLT_LOG_WARN,
+               DLT_STRING ("Not running as root, not using the private systemd socket"));
+      use_private = FALSE;
+    }
+#endif
+
+  if (use_private)
+    {
+      systemd_manager =
+        systemd_transport_connect_private (address != NULL
+                                           ? address : SYSTEMD_TRANSPORT_PRIVATE_ADDRESS,
+                                           &private_error);
+      if (systemd_manager == NULL)
+        {
+          DLT_LOG (controller_context, DLT_LOG_WARN,
+                   DLT_STRING ("Failed to connect to the private systemd socket,"
+                               " falling back to the system bus:"),
+                   DLT_STRING (private_error->message));
+          g_error_free (private_error);
+        }
+    }
+  g_free (address);
+
+  /* fall back to the system bus */
+  if (systemd_manager == NULL)
+    systemd_manager = systemd_transport_connect_bus (G_BUS_TYPE_SYSTEM, error);
+
+  return systemd_manager;
+}
+
+
+
+/**
+ * systemd_transport_connect_bus:
+ * @bus_type: The #GBusType of the bus systemd is connected to.
+ * @error: Return location for a #GError, or %NULL.
+ *
+ * Connects to the systemd manager through the message bus @bus_type.
+ *
+ * Returns: A #SystemdManager proxy, or %NULL if connecting failed. Release it with
+ * g_object_unref().
+ */
+SystemdManager *
+systemd_transport_connect_bus (GBusType bus_type,
+                               GError **error)
+{
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  return systemd_manager_proxy_new_for_bus_sync (bus_type,
+                                                 G_DBUS_PROXY_FLAGS_NONE,
+                                                 SYSTEMD_TRANSPORT_BUS_NAME,
+                                                 SYSTEMD_TRANSPORT_OBJECT_PATH,
+                                                 NULL, error);
+}
+
+
+
+/**
+ * systemd_transport_connect_private:
+ * @address: The D-Bus address of the private socket of systemd.
+ * @error: Return location for a #GError, or %NULL.
+ *
+ * Connects to the systemd manager directly through the peer-to-peer socket at
+ * @address, bypassing the bus daemon.
+ *
+ * Returns: A #SystemdManager proxy, or %NULL if connecting failed. Release it with
+ * g_object_unref().
+ */
+SystemdManager *
+systemd_transport_connect_private (const gchar *address,
+                                   GError     **error)
+{
+  SystemdManager  *systemd_manager;
+  GDBusConnection *connection;
+
+  g_return_val_if_fail (address != NULL && *address != '\0', NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  /* connect to the socket; it is not a message bus, so there is no hello */
+  connection =
+    g_dbus_connection_new_for_address_sync (address,
+                                            G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                                            NULL, NULL, error);
+  if (connection == NULL)
+    return NULL;
+
+  /* there is no bus daemon to resolve names, so the proxy has no bus name */
+  systemd_manager = systemd_manager_proxy_new_sync (connection,
+                                                    G_DBUS_PROXY_FLAGS_NONE,
+                                                    NULL,
+                                                    SYSTEMD_TRANSPORT_OBJECT_PATH,
+                                                    NULL, error);
+  g_object_unref (connection);
+
+  if (systemd_manager != NULL)
+    {
+      DLT_LOG (controller_context, DLT_LOG_INFO,
+               DLT_STRING ("Connected to systemd through its private socket:"),
+               DLT_STRING (address));
+    }
+
+  return systemd_manager;
+}
+
+
+
+/**
+ * systemd_transport_get_bus_name:
+ * @connection: The #GDBusConnection of a #SystemdManager.
+ *
+ * Looks up the name to send messages for systemd to on @connection.
+ *
+ * Returns: The bus name of systemd, or %NULL if @connection is a peer-to-peer
+ * connection to systemd.
+ */
+const gchar *
+systemd_transport_get_bus_name (GDBusConnection *connection)
+{
+  g_return_val_if_fail (G_IS_DBUS_CONNECTION (connection), NULL);
+
+  /* only connections to a message bus have a unique name */
+  if (g_dbus_connection_get_unique_name (connection) == NULL)
+    return NULL;
+
+  return SYSTEMD_TRANSPORT_BUS_NAME;
+}
@@ -0,0 +1,36 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifndef __SYSTEMD_TRANSPORT_H__
+#define __SYSTEMD_TRANSPORT_H__
+
+#include <node-startup-controller/systemd-manager-dbus.h>
+
+G_BEGIN_DECLS
+
+SystemdManager *systemd_transport_connect         (GError         **error) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+SystemdManager *systemd_transport_connect_bus     (GBusType         bus_type,
+                                                   GError         **error) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+SystemdManager *systemd_transport_connect_private (const gchar     *address,
+                                                   GError         **error) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+const gchar    *systemd_transport_get_bus_name    (GDBusConnection *connection);
+
+G_END_DECLS
+
+#endif /* !__SYSTEMD_TRANSPORT_H__ */
@@ -29,6 +29,8 @@
 #include <common/nsm-enum-types.h>
 #include <common/nsm-lifecycle-control-dbus.h>
 
+#include <node-startup-controller/config-file.h>
+#include <node-startup-controller/systemd-transport.h>
 #include <node-startup-controller/target-startup-monitor.h>
 #include <node-startup-controller/systemd-unit-dbus.h>
 
@@ -60,6 +62,25 @@
  * 
  *     - If the systemd unit "lazy.target" has started - set the state to
  *       %NSM_NODE_STATE_FULLY_OPERATIONAL.
+ *
+ * The mapping above is the default. It is replaced by the "TargetNodeStates" group
+ * of the configuration file if that group exists. Each key of the group is the name
+ * of a systemd unit and its value the name of the start-up #NSMNodeState to set when
+ * the unit becomes active, with or without the "NSM_NODE_STATE_" prefix. Several
+ * units may map to the same node state, in which case the first of them to become
+ * active sets it. Node states only ever move forward: a unit that becomes active
+ * after a later node state has been set is ignored.
+ *
+ * To avoid round trips to systemd whenever the state of a target changes, the
+ * #TargetStartupMonitor creates a long-lived #SystemdUnit proxy for each monitored
+ * target when it is constructed. The object path of the target is computed from its
+ * name the same way systemd does it, and its "ActiveState" is tracked through the
+ * PropertiesChanged signals received by the proxy. A "JobRemoved" signal for a target
+ * only causes a %GetUnit call if there is no usable proxy for the target yet.
+ *
+ * When the connection to systemd is re-established, the new #SystemdManager is passed
+ * to target_startup_monitor_set_systemd_manager(), which recreates the proxies of all
+ * targets on the new connection.
  */
 
 
@@ -77,37 +98,54 @@ enum
 
 
 
-typedef struct _GetUnitData GetUnitData;
-
-
-
-static void     target_startup_monitor_finalize                (GObject              *object);
-static void     target_startup_monitor_constructed             (GObject              *object);
-static void     target_startup_monitor_get_property            (GObject              *object,
-                                                                guint                 prop_id,
-                                                                GValue               *value,
-                                                                GParamSpec           *pspec);
-static void     target_startup_monitor_set_property            (GObject              *object,
-                                                                guint                 prop_id,
-                                                                const GValue         *value,
-                                                                GParamSpec           *pspec);
-static void     target_startup_monitor_job_removed             (SystemdManager       *manager,
-                                                                guint                 id,
-                                                                const gchar          *job_name,
-                                                                const gchar          *unit,
-                                                                const gchar          *result,
-                                                                TargetStartupMonitor *monitor);
-static void     target_startup_monitor_get_unit_finish         (GObject              *object,
-                                                                GAsyncResult         *res,
-                                                                gpointer              user_data);
-static void     target_startup_monitor_unit_proxy_new_finish   (GObject              *object,
-                                                                GAsyncResult         *res,
-                                                                gpointer              user_data);
-static void     target_startup_monitor_set_node_state          (TargetStartupMonitor *monitor,
-                                                                NSMNodeState          state);
-static void     target_startup_monitor_set_node_state_finish   (GObject              *object,
-                                                                GAsyncResult         *res,
-                                                                gpointer              user_data);
+typedef struct _GetUnitData                GetUnitData;
+typedef struct _TargetStartupMonitorTarget TargetStartupMonitorTarget;
+
+
+
+static void     target_startup_monitor_finalize                (GObject                    *object);
+static void     target_startup_monitor_constructed             (GObject                    *object);
+static void     target_startup_monitor_get_property            (GObject                    *object,
+                                                                guint                       prop_id,
+                                                                GValue                     *value,
+                                                                GParamSpec                 *pspec);
+static void     target_startup_monitor_set_property            (GObject                    *object,
+                                                                guint                       prop_id,
+                                                                const GValue               *value,
+                                                                GParamSpec                 *pspec);
+static void     target_startup_monitor_job_removed             (SystemdManager             *manager,
+                                                                guint                       id,
+                                                                const gchar                *job_name,
+                                                                const gchar                *unit,
+                                                                const gchar                *result,
+                                                                TargetStartupMonitor       *monitor);
+static void     target_startup_monitor_get_unit_finish         (GObject                    *object,
+                                                                GAsyncResult               *res,
+                                                                gpointer                    user_data);
+static void     target_startup_monitor_watch_target            (TargetStartupMonitorTarget *target,
+                                                                const gchar                *object_path);
+static void     target_startup_monitor_unit_proxy_new_finish   (GObject                    *object,
+                                                                GAsyncResult               *res,
+                                                                gpointer                    user_data);
+static void     target_startup_monitor_unit_properties_changed (GDBusProxy                 *proxy,
+                                                                GVariant                   *changed_properties,
+                                                                GStrv                       invalidated_properties,
+                                                                TargetStartupMonitorTarget *target);
+static void     target_startup_monitor_check_target            (TargetStartupMonitorTarget *target);
+static void     target_startup_monitor_unwatch_target          (TargetStartupMonitorTarget *target);
+static void     target_startup_monitor_load_targets            (TargetStartupMonitor       *monitor);
+static void     target_startup_monitor_add_target              (TargetStartupMonitor       *monitor,
+                                                                const gchar                *name,
+                                                                NSMNodeState                node_state);
+static gboolean target_startup_monitor_parse_node_state        (const gchar                *string,
+                                                                NSMNodeState               *node_state);
+static void     target_startup_monitor_target_free             (TargetStartupMonitorTarget *target);
+static gchar   *target_startup_monitor_unit_object_path        (const gchar                *unit);
+static void     target_startup_monitor_set_node_state          (TargetStartupMonitor       *monitor,
+                                                                NSMNodeState                state);
+static void     target_startup_monitor_set_node_state_finish   (GObject                    *object,
+                                                                GAsyncResult               *res,
+                                                                gpointer                    user_data);
 
 
 
@@ -124,15 +162,33 @@ struct _TargetStartupMonitor
 
   NSMLifecycleControl *nsm_lifecycle_control;
 
-  /* map of systemd target names to corresponding node states */
-  GHashTable          *targets_to_states;
+  /* map of systemd target names to TargetStartupMonitorTargets */
+  GHashTable          *targets;
+
+  /* the latest node state that has been set */
+  NSMNodeState         node_state;
 };
 
 struct _GetUnitData
+{
+  TargetStartupMonitor       *monitor;
+  TargetStartupMonitorTarget *target;
+};
+
+struct _TargetStartupMonitorTarget
 {
   TargetStartupMonitor *monitor;
-  gchar                *unit_name;
-  gchar                *object_path;
+  gchar                *name;
+
+  /* node state to apply when the target becomes active */
+  NSMNodeState          node_state;
+
+  /* long-lived proxy for the target, and whether it is being created */
+  SystemdUnit          *proxy;
+  gboolean              proxy_pending;
+
+  /* whether the node state has been applied since the target became active */
+  gboolean              reached;
 };
 
 
@@ -191,13 +247,10 @@ target_startup_monitor_init (TargetStartupMonitor *monitor)
   target_startup_monitor_set_node_state (monitor, NSM_NODE_STATE_BASE_RUNNING);
 
   /* create the table of targets and their node states */
-  monitor->targets_to_states = g_hash_table_new (g_str_hash, g_str_equal);
-  g_hash_table_insert (monitor->targets_to_states, "focussed.target",
-                       GUINT_TO_POINTER (NSM_NODE_STATE_LUC_RUNNING));
-  g_hash_table_insert (monitor->targets_to_states, "unfocussed.target",
-                       GUINT_TO_POINTER (NSM_NODE_STATE_FULLY_RUNNING));
-  g_hash_table_insert (monitor->targets_to_states, "lazy.target",
-                       GUINT_TO_POINTER (NSM_NODE_STATE_FULLY_OPERATIONAL));
+  monitor->targets =
+    g_hash_table_new_full (g_str_hash, g_str_equal,
+                           NULL, (GDestroyNotify) target_startup_monitor_target_free);
+  target_startup_monitor_load_targets (monitor);
 }
 
 
@@ -205,10 +258,17 @@ target_startup_monitor_init (TargetStartupMonitor *monitor)
 static void
 target_startup_monitor_constructed (GObject *object)
 {
-  TargetStartupMonitor *monitor = TARGET_STARTUP_MONITOR (object);
+  TargetStartupMonitor       *monitor = TARGET_STARTUP_MONITOR (object);
+  TargetStartupMonitorTarget *target;
+  GHashTableIter              iter;
 
   g_signal_connect (monitor->systemd_manager, "job-removed",
                     G_CALLBACK (target_startup_monitor_job_removed), monitor);
+
+  /* create long-lived proxies for all monitored targets */
+  g_hash_table_iter_init (&iter, monitor->targets);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &target))
+    target_startup_monitor_watch_target (target, NULL);
 }
 
 
@@ -218,8 +278,8 @@ target_startup_monitor_finalize (GObject *object)
 {
   TargetStartupMonitor *monitor = TARGET_STARTUP_MONITOR (object);
 
-  /* release the mapping of systemd targets to node states */
-  g_hash_table_destroy (monitor->targets_to_states);
+  /* release the monitored targets and their proxies */
+  g_hash_table_destroy (monitor->targets);
 
   /* release the systemd manager */
   g_signal_handlers_disconnect_matched (monitor->systemd_manager,
@@ -285,7 +345,8 @@ target_startup_monitor_job_removed (SystemdManager       *manager,
                                     const gchar          *result,
                                     TargetStartupMonitor *monitor)
 {
-  GetUnitData *data;
+  TargetStartupMonitorTarget *target;
+  GetUnitData                *data;
 
   g_return_if_fail (IS_SYSTEMD_MANAGER (manager));
   g_return_if_fail (job_name != NULL && *job_name != '\0');
@@ -294,17 +355,34 @@ target_startup_monitor_job_removed (SystemdManager       *manager,
   g_return_if_fail (IS_TARGET_STARTUP_MONITOR (monitor));
 
   /* check if the unit corresponds to one which has to be monitored */
-  if (g_hash_table_lookup_extended (monitor->targets_to_states, unit, NULL, NULL))
+  target = g_hash_table_lookup (monitor->targets, unit);
+  if (target == NULL)
+    return;
+
+  /* the proxy knows the active state already, no need to ask systemd */
+  if (target->proxy != NULL && systemd_unit_get_active_state (target->proxy) != NULL)
     {
-      /* create a temporary struct to bundle information about the unit */
-      data = g_slice_new0 (GetUnitData);
-      data->monitor = g_object_ref (monitor);
-      data->unit_name = g_strdup (unit);
-
-      /* ask systemd to return the object path for this unit */
-      systemd_manager_call_get_unit (monitor->systemd_manager, unit, NULL,
-                                     target_startup_monitor_get_unit_finish, data);
+      target_startup_monitor_check_target (target);
+      return;
     }
+
+  /* wait for a proxy that is being created */
+  if (target->proxy_pending)
+    return;
+
+  /* the proxy could not be created or its state has been invalidated, so
+   * drop it and resolve the object path of the unit through systemd */
+  target_startup_monitor_unwatch_target (target);
+
+  /* create a temporary struct to bundle information about the unit */
+  data = g_slice_new0 (GetUnitData);
+  data->monitor = g_object_ref (monitor);
+  data->target = target;
+
+  /* ask systemd to return the object path for this unit */
+  target->proxy_pending = TRUE;
+  systemd_manager_call_get_unit (monitor->systemd_manager, unit, NULL,
+                                 target_startup_monitor_get_unit_finish, data);
 }
 
 
@@ -322,40 +400,79 @@ target_startup_monitor_get_unit_finish (GObject      *object,
   g_return_if_fail (G_IS_ASYNC_RESULT (res));
   g_return_if_fail (data != NULL);
 
+  data->target->proxy_pending = FALSE;
+
   /* finish obtaining the object path for the unit from systemd */
   if (!systemd_manager_call_get_unit_finish (SYSTEMD_MANAGER (object), &object_path,
                                              res, &error))
     {
-      /* there was an error, log it */
-      DLT_LOG (controller_context, DLT_LOG_ERROR,
-               DLT_STRING ("Failed to get a unit from systemd:"),
-               DLT_STRING ("unit"), DLT_STRING (data->unit_name),
-               DLT_STRING ("error message"), DLT_STRING (error->message));
+      if (SYSTEMD_MANAGER (object) != data->monitor->systemd_manager)
+        {
+          /* the systemd manager has been replaced while waiting for the reply;
+           * create the proxy on the new connection instead */
+          target_startup_monitor_watch_target (data->target, NULL);
+        }
+      else
+        {
+          /* there was an error, log it */
+          DLT_LOG (controller_context, DLT_LOG_ERROR,
+                   DLT_STRING ("Failed to get a unit from systemd:"),
+                   DLT_STRING ("unit"), DLT_STRING (data->target->name),
+                   DLT_STRING ("error message"), DLT_STRING (error->message));
+        }
       g_error_free (error);
-
-      /* release the get unit data */
-      g_object_unref (data->monitor);
-      g_free (data->unit_name);
-      g_slice_free (GetUnitData, data);
     }
   else
     {
-      DLT_LOG (controller_context, DLT_LOG_INFO,
-               DLT_STRING ("Creating D-Bus proxy:"),
-               DLT_STRING ("object path"), DLT_STRING (object_path));
-
-      /* remember the object path */
-      data->object_path = object_path;
-
-      /* create a proxy for this unit D-Bus object */
-      systemd_unit_proxy_new (g_dbus_proxy_get_connection (G_DBUS_PROXY (data->monitor->systemd_manager)),
-                              G_DBUS_PROXY_FLAGS_NONE,
-                              "org.freedesktop.systemd1",
-                              object_path,
-                              NULL,
-                              target_startup_monitor_unit_proxy_new_finish,
-                              data);
+      /* create a proxy for this unit D-Bus object; this uses the connection of
+       * the current systemd manager, even if it has been replaced meanwhile */
+      target_startup_monitor_watch_target (data->target, object_path);
+      g_free (object_path);
     }
+
+  /* release the get unit data */
+  g_object_unref (data->monitor);
+  g_slice_free (GetUnitData, data);
+}
+
+
+
+static void
+target_startup_monitor_watch_target (TargetStartupMonitorTarget *target,
+                                     const gchar                *object_path)
+{
+  TargetStartupMonitor *monitor = target->monitor;
+  GDBusConnection      *connection;
+  gchar                *path;
+
+  /* nothing to do if there is a proxy already or one is being created */
+  if (target->proxy != NULL || target->proxy_pending)
+    return;
+
+  /* compute the object path unless it has been resolved through systemd */
+  if (object_path != NULL)
+    path = g_strdup (object_path);
+  else
+    path = target_startup_monitor_unit_object_path (target->name);
+
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Creating D-Bus proxy:"),
+           DLT_STRING ("object path"), DLT_STRING (path));
+
+  /* create a proxy for this unit D-Bus object; keep the monitor alive until
+   * this is finished */
+  target->proxy_pending = TRUE;
+  g_object_ref (monitor);
+  connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (monitor->systemd_manager));
+  systemd_unit_proxy_new (connection,
+                          G_DBUS_PROXY_FLAGS_NONE,
+                          systemd_transport_get_bus_name (connection),
+                          path,
+                          NULL,
+                          target_startup_monitor_unit_proxy_new_finish,
+                          target);
+
+  g_free (path);
 }
 
 
@@ -365,59 +482,280 @@ target_startup_monitor_unit_proxy_new_finish (GObject      *object,
                                               GAsyncResult *res,
                                               gpointer      user_data)
 {
-  GetUnitData *data = user_data;
-  SystemdUnit *unit;
-  const gchar *state;
-  gpointer     node_state;
-  GError      *error = NULL;
+  TargetStartupMonitorTarget *target = user_data;
+  TargetStartupMonitor       *monitor = target->monitor;
+  GDBusConnection            *connection;
+  SystemdUnit                *unit;
+  GError                     *error = NULL;
 
   g_return_if_fail (G_IS_ASYNC_RESULT (res));
-  g_return_if_fail (data != NULL);
+
+  target->proxy_pending = FALSE;
 
   /* finish creating the proxy for this systemd unit */
   unit = systemd_unit_proxy_new_finish (res, &error);
-  if (error != NULL)
+  connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (monitor->systemd_manager));
+  if (g_dbus_proxy_get_connection (G_DBUS_PROXY (object)) != connection)
+    {
+      /* the systemd manager has been replaced while the proxy was created;
+       * create it again on the new connection */
+      if (unit != NULL)
+        g_object_unref (unit);
+      else
+        g_error_free (error);
+      target_startup_monitor_watch_target (target, NULL);
+    }
+  else if (error != NULL)
     {
       /* there was an error, log it */
       DLT_LOG (controller_context, DLT_LOG_ERROR,
                DLT_STRING ("Failed to create D-Bus proxy:"),
-               DLT_STRING ("object path"), DLT_STRING (data->object_path),
+               DLT_STRING ("unit"), DLT_STRING (target->name),
                DLT_STRING ("error message"), DLT_STRING (error->message));
       g_error_free (error);
     }
   else
     {
-      /* query the unit for its current active state */
-      state = systemd_unit_get_active_state (unit);
+      /* keep the proxy and follow changes of the active state */
+      target->proxy = unit;
+      g_signal_connect (unit, "g-properties-changed",
+                        G_CALLBACK (target_startup_monitor_unit_properties_changed),
+                        target);
+
+      /* the target may be active already */
+      target_startup_monitor_check_target (target);
+    }
+
+  /* release the monitor */
+  g_object_unref (monitor);
+}
+
+
+
+static void
+target_startup_monitor_unit_properties_changed (GDBusProxy                 *proxy,
+                                                GVariant                   *changed_properties,
+                                                GStrv                       invalidated_properties,
+                                                TargetStartupMonitorTarget *target)
+{
+  GVariant *active_state;
+
+  g_return_if_fail (G_IS_DBUS_PROXY (proxy));
+  g_return_if_fail (target != NULL);
+
+  /* only changes of the active state are of interest */
+  active_state = g_variant_lookup_value (changed_properties, "ActiveState",
+                                         G_VARIANT_TYPE_STRING);
+  if (active_state == NULL)
+    return;
+
+  g_variant_unref (active_state);
+
+  /* the proxy has updated its cached property already */
+  target_startup_monitor_check_target (target);
+}
+
+
+
+static void
+target_startup_monitor_check_target (TargetStartupMonitorTarget *target)
+{
+  const gchar *state;
+
+  g_return_if_fail (target != NULL);
+  g_return_if_fail (IS_SYSTEMD_UNIT (target->proxy));
 
-      /* log the the active state has changed */
-      DLT_LOG (controller_context, DLT_LOG_INFO,
-               DLT_STRING ("Active state of unit changed:"),
-               DLT_STRING ("unit"), DLT_STRING (data->unit_name),
-               DLT_STRING ("state"), DLT_STRING (state));
+  /* query the cached active state of the unit */
+  state = systemd_unit_get_active_state (target->proxy);
 
-      /* check if the new state is active */
-      if (g_strcmp0 (state, "active") == 0)
+  /* log the the active state has changed */
+  DLT_LOG (controller_context, DLT_LOG_INFO,
+           DLT_STRING ("Active state of unit changed:"),
+           DLT_STRING ("unit"), DLT_STRING (target->name),
+           DLT_STRING ("state"), DLT_STRING (state != NULL ? state : "unknown"));
+
+  /* check if the new state is active */
+  if (g_strcmp0 (state, "active") == 0)
+    {
+      /* apply the node state only once each time the target becomes active
+       * and only if it is later than the node state that has been set */
+      if (!target->reached)
         {
-          /* look up the node state corresponding to this unit, if there is one */
-          if (g_hash_table_lookup_extended (data->monitor->targets_to_states,
-                                            data->unit_name, NULL, &node_state))
-            {
-              /* we do have a state for this unit, so apply it now */
-              target_startup_monitor_set_node_state (data->monitor,
-                                                     GPOINTER_TO_UINT (node_state));
-            }
+          target->reached = TRUE;
+          if (target->node_state > target->monitor->node_state)
+            target_startup_monitor_set_node_state (target->monitor, target->node_state);
         }
+    }
+  else
+    {
+      target->reached = FALSE;
+    }
+}
+
+
+
+static void
+target_startup_monitor_unwatch_target (TargetStartupMonitorTarget *target)
+{
+  g_return_if_fail (target != NULL);
 
-      /* release the unit proxy */
-      g_object_unref (unit);
+  if (target->proxy == NULL)
+    return;
+
+  g_signal_handlers_disconnect_matched (target->proxy, G_SIGNAL_MATCH_DATA,
+                                        0, 0, NULL, NULL, target);
+  g_object_unref (target->proxy);
+  target->proxy = NULL;
+}
+
+
+
+static void
+target_startup_monitor_load_targets (TargetStartupMonitor *monitor)
+{
+  NSMNodeState node_state;
+  GKeyFile    *config;
+  gchar      **keys;
+  gchar       *value;
+  guint        n;
+
+  g_return_if_fail (IS_TARGET_STARTUP_MONITOR (monitor));
+
+  config = config_file_load ();
+  keys = g_key_file_get_keys (config, "TargetNodeStates", NULL, NULL);
+  if (keys == NULL)
+    {
+      /* use the default mapping of targets to node states */
+      target_startup_monitor_add_target (monitor, "focussed.target",
+                                         NSM_NODE_STATE_LUC_RUNNING);
+      target_startup_monitor_add_target (monitor, "unfocussed.target",
+                                         NSM_NODE_STATE_FULLY_RUNNING);
+      target_startup_monitor_add_target (monitor, "lazy.target",
+                                         NSM_NODE_STATE_FULLY_OPERATIONAL);
+      g_key_file_free (config);
+      return;
     }
 
-  /* free the get unit data */
-  g_object_unref (data->monitor);
-  g_free (data->unit_name);
-  g_free (data->object_path);
-  g_slice_free (GetUnitData, data);
+  for (n = 0; keys[n] != NULL; n++)
+    {
+      value = g_key_file_get_string (config, "TargetNodeStates", keys[n], NULL);
+      if (value != NULL)
+        g_strstrip (value);
+
+      /* only states of the start-up phase can be set by targets */
+      if (value == NULL
+          || !target_startup_monitor_parse_node_state (value, &node_state)
+          || node_state <= NSM_NODE_STATE_BASE_RUNNING
+          || node_state > NSM_NODE_STATE_FULLY_OPERATIONAL)
+        {
+          DLT_LOG (controller_context, DLT_LOG_WARN,
+                   DLT_STRING ("Ignoring invalid node state for target:"),
+                   DLT_STRING ("target"), DLT_STRING (keys[n]),
+                   DLT_STRING ("node state"), DLT_STRING (value != NULL ? value : ""));
+        }
+      else
+        {
+          target_startup_monitor_add_target (monitor, keys[n], node_state);
+        }
+
+      g_free (value);
+    }
+
+  g_strfreev (keys);
+  g_key_file_free (config);
+}
+
+
+
+static void
+target_startup_monitor_add_target (TargetStartupMonitor *monitor,
+                                   const gchar          *name,
+                                   NSMNodeState          node_state)
+{
+  TargetStartupMonitorTarget *target;
+
+  target = g_slice_new0 (TargetStartupMonitorTarget);
+  target->monitor = monitor;
+  target->name = g_strdup (name);
+  target->node_state = node_state;
+
+  g_hash_table_insert (monitor->targets, target->name, target);
+}
+
+
+
+static gboolean
+target_startup_monitor_parse_node_state (const gchar  *string,
+                                         NSMNodeState *node_state)
+{
+  GEnumClass *enum_class;
+  GEnumValue *enum_value;
+  gchar      *name;
+  gchar      *tmp;
+
+  g_return_val_if_fail (string != NULL, FALSE);
+  g_return_val_if_fail (node_state != NULL, FALSE);
+
+  /* accept names with and without the NSM_NODE_STATE_ prefix, in any case
+   * and with dashes instead of underscores */
+  name = g_ascii_strup (string, -1);
+  g_strdelimit (name, "-", '_');
+  if (!g_str_has_prefix (name, "NSM_NODE_STATE_"))
+    {
+      tmp = name;
+      name = g_strconcat ("NSM_NODE_STATE_", tmp, NULL);
+      g_free (tmp);
+    }
+
+  enum_class = g_type_class_ref (TYPE_NSM_NODE_STATE);
+  enum_value = g_enum_get_value_by_name (enum_class, name);
+  g_type_class_unref (enum_class);
+  g_free (name);
+
+  if (enum_value == NULL)
+    return FALSE;
+
+  *node_state = enum_value->value;
+  return TRUE;
+}
+
+
+
+static void
+target_startup_monitor_target_free (TargetStartupMonitorTarget *target)
+{
+  if (target == NULL)
+    return;
+
+  target_startup_monitor_unwatch_target (target);
+
+  g_free (target->name);
+  g_slice_free (TargetStartupMonitorTarget, target);
+}
+
+
+
+static gchar *
+target_startup_monitor_unit_object_path (const gchar *unit)
+{
+  const gchar *p;
+  GString     *path;
+
+  g_return_val_if_fail (unit != NULL && *unit != '\0', NULL);
+
+  /* systemd escapes all characters of a unit name other than ASCII letters and
+   * digits as "_xx" with the lower-case hex value of the character, as well as
+   * a leading digit */
+  path = g_string_new ("/org/freedesktop/systemd1/unit/");
+  for (p = unit; *p != '\0'; p++)
+    {
+      if (g_ascii_isalpha (*p) || (g_ascii_isdigit (*p) && p != unit))
+        g_string_append_c (path, *p);
+      else
+        g_string_append_printf (path, "_%02x", (guchar) *p);
+    }
+
+  return g_string_free (path, FALSE);
 }
 
 
@@ -428,6 +766,9 @@ target_startup_monitor_set_node_state (TargetStartupMonitor *monitor,
 {
   g_return_if_fail (IS_TARGET_STARTUP_MONITOR (monitor));
 
+  /* remember the state so that node states only move forward */
+  monitor->node_state = state;
+
   /* set node state in the Node State Manager */
   nsm_lifecycle_control_call_set_node_state (monitor->nsm_lifecycle_control,
                                              (gint) state, NULL,
@@ -472,7 +813,7 @@ target_startup_monitor_set_node_state_finish (GObject      *object,
 /**
  * target_startup_monitor_new:
  * @systemd_manager: An interface to the systemd manager created with
- * systemd_manager_proxy_new_for_bus_sync()
+ * systemd_transport_connect()
  * 
  * Creates a new target startup monitor and begins listening to %JobRemoved signals from
  * systemd.
@@ -488,3 +829,47 @@ target_startup_monitor_new (SystemdManager *systemd_manager)
                        "systemd-manager", systemd_manager,
                        NULL);
 }
+
+
+
+/**
+ * target_startup_monitor_set_systemd_manager:
+ * @monitor: A #TargetStartupMonitor.
+ * @systemd_manager: An interface to the systemd manager created with
+ * systemd_transport_connect()
+ *
+ * Replaces the #SystemdManager the @monitor listens to, e.g. after the connection to
+ * systemd has been re-established, and recreates the proxies of the monitored targets
+ * on the connection of @systemd_manager.
+ */
+void
+target_startup_monitor_set_systemd_manager (TargetStartupMonitor *monitor,
+                                            SystemdManager       *systemd_manager)
+{
+  TargetStartupMonitorTarget *target;
+  GHashTableIter              iter;
+
+  g_return_if_fail (IS_TARGET_STARTUP_MONITOR (monitor));
+  g_return_if_fail (IS_SYSTEMD_MANAGER (systemd_manager));
+
+  if (monitor->systemd_manager == systemd_manager)
+    return;
+
+  /* listen to the "JobRemoved" signals of the new systemd manager */
+  g_signal_handlers_disconnect_matched (monitor->systemd_manager,
+                                        G_SIGNAL_MATCH_DATA,
+                                        0, 0, NULL, NULL, monitor);
+  g_object_unref (monitor->systemd_manager);
+  monitor->systemd_manager = g_object_ref (systemd_manager);
+  g_signal_connect (monitor->systemd_manager, "job-removed",
+                    G_CALLBACK (target_startup_monitor_job_removed), monitor);
+
+  /* the proxies of the targets belong to the old connection; proxies that are
+   * being created are recreated once they are finished */
+  g_hash_table_iter_init (&iter, monitor->targets);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer) &target))
+    {
+      target_startup_monitor_unwatch_target (target);
+      target_startup_monitor_watch_target (target, NULL);
+    }
+}
@@ -34,8 +34,10 @@ G_BEGIN_DECLS
 typedef struct _TargetStartupMonitor      TargetStartupMonitor;
 typedef struct _TargetStartupMonitorClass TargetStartupMonitorClass;
 
-GType                 target_startup_monitor_get_type (void) G_GNUC_CONST;
-TargetStartupMonitor *target_startup_monitor_new      (SystemdManager *systemd_manager) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+GType                 target_startup_monitor_get_type            (void) G_GNUC_CONST;
+TargetStartupMonitor *target_startup_monitor_new                 (SystemdManager       *systemd_manager) G_GNUC_MALLOC G_GNUC_WARN_UNUSED_RESULT;
+void                  target_startup_monitor_set_systemd_manager (TargetStartupMonitor *monitor,
+                                                                  SystemdManager       *systemd_manager);
 
 G_END_DECLS
 
@@ -0,0 +1,446 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <node-startup-controller/systemd-manager-dbus.h>
+
+#include <tests/node-startup-controller/fake-systemd.h>
+
+
+
+/* A stand-in for systemd that runs in a child process and serves a private
+ * peer-to-peer socket and, optionally, the org.freedesktop.systemd1 name on the
+ * session bus. It finishes every job right after creating it and emits its
+ * "JobRemoved" signal immediately afterwards:
+ *
+ * - StartUnit activates the unit. If the name of the unit starts with
+ *   %FAKE_SYSTEMD_EARLY_PREFIX, the "JobRemoved" signal is emitted before the
+ *   reply, like systemd does for jobs that finish while the reply is queued.
+ * - StartTransientUnit activates the units the transient unit wants, if it is
+ *   ordered after them as well and the job mode does not ignore dependencies. It
+ *   refuses to create %FAKE_SYSTEMD_REFUSED_UNIT.
+ * - ListUnitsByNames reports the units as "loaded". Units that have been started
+ *   are "active", or "failed" if their name starts with %FAKE_SYSTEMD_FAILING_PREFIX,
+ *   all others are "inactive". The description of a unit that has been started is
+ *   the name of the unit whose job started it, so tests can tell whether a unit was
+ *   started on its own or through a transient target. */
+
+
+
+struct _FakeSystemd
+{
+  gchar *directory;
+  gchar *socket_path;
+  gchar *address;
+  pid_t  pid;
+};
+
+
+
+/* mapping of started units to the unit whose job started them, and the
+ * ID of the last job created */
+static GHashTable *fake_started_units = NULL;
+static guint       fake_job_id = 0;
+
+
+
+static void
+fake_systemd_start_unit (const gchar *name,
+                         const gchar *started_by)
+{
+  g_hash_table_insert (fake_started_units, g_strdup (name), g_strdup (started_by));
+}
+
+
+
+static gboolean
+fake_systemd_handle_start_unit (SystemdManager        *skeleton,
+                                GDBusMethodInvocation *invocation,
+                                const gchar           *name,
+                                const gchar           *mode,
+                                gpointer               user_data)
+{
+  gboolean early;
+  gchar   *job_name;
+
+  fake_systemd_start_unit (name, name);
+
+  /* create the job and finish it right away; both messages are sent in
+   * order on the same connection, so an early "JobRemoved" signal reaches
+   * the client before the job name */
+  job_name = g_strdup_printf ("/org/freedesktop/systemd1/job/%u", ++fake_job_id);
+  early = g_str_has_prefix (name, FAKE_SYSTEMD_EARLY_PREFIX);
+  if (!early)
+    systemd_manager_complete_start_unit (skeleton, invocation, job_name);
+  systemd_manager_emit_job_removed (skeleton, fake_job_id, job_name, name,
+                                    g_str_has_prefix (name, FAKE_SYSTEMD_FAILING_PREFIX)
+                                    ? "failed" : "done");
+  if (early)
+    systemd_manager_complete_start_unit (skeleton, invocation, job_name);
+  g_free (job_name);
+
+  return TRUE;
+}
+
+
+
+static gboolean
+fake_systemd_handle_start_transient_unit (SystemdManager        *skeleton,
+                                          GDBusMethodInvocation *invocation,
+                                          const gchar           *name,
+                                          const gchar           *mode,
+                                          GVariant              *properties,
+                                          GVariant              *aux,
+                                          gpointer               user_data)
+{
+  GVariantIter  iter;
+  const gchar  *property;
+  GVariant     *value;
+  gboolean      wants = FALSE;
+  gboolean      after = FALSE;
+  gchar       **units = NULL;
+  gchar        *job_name;
+  guint         n;
+
+  if (g_strcmp0 (name, FAKE_SYSTEMD_REFUSED_UNIT) == 0)
+    {
+      g_dbus_method_invocation_return_dbus_error (invocation,
+                                                  "org.freedesktop.DBus.Error.InvalidArgs",
+                                                  "Unit type target does not support"
+                                                  " transient units");
+      return TRUE;
+    }
+
+  /* the wanted units are only started if the unit is also ordered after them
+   * and the job mode does not make systemd ignore them */
+  g_variant_iter_init (&iter, properties);
+  while (g_variant_iter_next (&iter, "(&sv)", &property, &value))
+    {
+      if (g_strcmp0 (property, "Wants") == 0)
+        {
+          g_strfreev (units);
+          units = g_variant_dup_strv (value, NULL);
+          wants = TRUE;
+        }
+      else if (g_strcmp0 (property, "After") == 0)
+        {
+          after = TRUE;
+        }
+      g_variant_unref (value);
+    }
+
+  if (wants && after && !g_str_has_prefix (mode, "ignore-"))
+    {
+      for (n = 0; units[n] != NULL; n++)
+        fake_systemd_start_unit (units[n], name);
+    }
+  g_strfreev (units);
+
+  /* create the job and finish it right away; the target does not fail if
+   * some of the units it wants fail */
+  job_name = g_strdup_printf ("/org/freedesktop/systemd1/job/%u", ++fake_job_id);
+  systemd_manager_complete_start_transient_unit (skeleton, invocation, job_name);
+  systemd_manager_emit_job_removed (skeleton, fake_job_id, job_name, name, "done");
+  g_free (job_name);
+
+  return TRUE;
+}
+
+
+
+static gboolean
+fake_systemd_handle_list_units_by_names (SystemdManager        *skeleton,
+                                         GDBusMethodInvocation *invocation,
+                                         const gchar *const    *names,
+                                         gpointer               user_data)
+{
+  GVariantBuilder builder;
+  const gchar    *started_by;
+  const gchar    *active_state;
+  guint           n;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssssssouso)"));
+  for (n = 0; names[n] != NULL; n++)
+    {
+      started_by = g_hash_table_lookup (fake_started_units, names[n]);
+      if (started_by == NULL)
+        active_state = "inactive";
+      else if (g_str_has_prefix (names[n], FAKE_SYSTEMD_FAILING_PREFIX))
+        active_state = "failed";
+      else
+        active_state = "active";
+
+      g_variant_builder_add (&builder, "(ssssssouso)", names[n],
+                             started_by != NULL ? started_by : "", "loaded",
+                             active_state,
+                             g_strcmp0 (active_state, "active") == 0 ? "running" : "dead",
+                             "", "/org/freedesktop/systemd1/unit/fake", 0, "", "/");
+    }
+
+  systemd_manager_complete_list_units_by_names (skeleton, invocation,
+                                                g_variant_builder_end (&builder));
+  return TRUE;
+}
+
+
+
+static gboolean
+fake_systemd_handle_subscribe (SystemdManager        *skeleton,
+                               GDBusMethodInvocation *invocation,
+                               gpointer               user_data)
+{
+  systemd_manager_complete_subscribe (skeleton, invocation);
+  return TRUE;
+}
+
+
+
+static void
+fake_systemd_export (GDBusConnection *connection)
+{
+  SystemdManager *skeleton;
+  GError         *error = NULL;
+
+  /* every connection gets its own manager, so signals only go to the
+   * connection that started the job */
+  skeleton = systemd_manager_skeleton_new ();
+  g_signal_connect (skeleton, "handle-start-unit",
+                    G_CALLBACK (fake_systemd_handle_start_unit), NULL);
+  g_signal_connect (skeleton, "handle-start-transient-unit",
+                    G_CALLBACK (fake_systemd_handle_start_transient_unit), NULL);
+  g_signal_connect (skeleton, "handle-list-units-by-names",
+                    G_CALLBACK (fake_systemd_handle_list_units_by_names), NULL);
+  g_signal_connect (skeleton, "handle-subscribe",
+                    G_CALLBACK (fake_systemd_handle_subscribe), NULL);
+
+  if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (skeleton),
+                                         connection, "/org/freedesktop/systemd1",
+                                         &error))
+    {
+      g_error ("Failed to export the fake systemd manager: %s", error->message);
+    }
+}
+
+
+
+static gboolean
+fake_systemd_new_connection (GDBusServer     *server,
+                             GDBusConnection *connection,
+                             gpointer         user_data)
+{
+  g_object_ref (connection);
+  fake_systemd_export (connection);
+  return TRUE;
+}
+
+
+
+static void
+fake_systemd_notify_ready (gint ready_fd)
+{
+  if (write (ready_fd, "", 1) != 1)
+    g_error ("Failed to notify the test");
+  close (ready_fd);
+}
+
+
+
+static void
+fake_systemd_bus_acquired (GDBusConnection *connection,
+                           const gchar     *name,
+                           gpointer         user_data)
+{
+  fake_systemd_export (connection);
+}
+
+
+
+static void
+fake_systemd_name_acquired (GDBusConnection *connection,
+                            const gchar     *name,
+                            gpointer         user_data)
+{
+  /* both transports are available now */
+  fake_systemd_notify_ready (GPOINTER_TO_INT (user_data));
+}
+
+
+
+static void
+fake_systemd_name_lost (GDBusConnection *connection,
+                        const gchar     *name,
+                        gpointer         user_data)
+{
+  g_error ("Failed to own %s on the session bus", name);
+}
+
+
+
+static void
+fake_systemd_run (const gchar *address,
+                  gboolean     own_bus_name,
+                  gint         ready_fd)
+{
+  GDBusServer *server;
+  GMainLoop   *main_loop;
+  GError      *error = NULL;
+  gchar       *guid;
+
+  fake_started_units = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  /* serve the private socket */
+  guid = g_dbus_generate_guid ();
+  server = g_dbus_server_new_sync (address, G_DBUS_SERVER_FLAGS_NONE, guid,
+                                   NULL, NULL, &error);
+  if (server == NULL)
+    g_error ("Failed to listen on %s: %s", address, error->message);
+  g_signal_connect (server, "new-connection",
+                    G_CALLBACK (fake_systemd_new_connection), NULL);
+  g_dbus_server_start (server);
+  g_free (guid);
+
+  /* serve the bus if asked to, and tell the test that the fake is ready
+   * once all transports are available */
+  if (own_bus_name)
+    {
+      g_bus_own_name (G_BUS_TYPE_SESSION, "org.freedesktop.systemd1",
+                      G_BUS_NAME_OWNER_FLAGS_NONE, fake_systemd_bus_acquired,
+                      fake_systemd_name_acquired, fake_systemd_name_lost,
+                      GINT_TO_POINTER (ready_fd), NULL);
+    }
+  else
+    {
+      fake_systemd_notify_ready (ready_fd);
+    }
+
+  /* run until the test is done */
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (main_loop);
+}
+
+
+
+/**
+ * fake_systemd_start:
+ * @name: The name of the test, used for the temporary directory of the socket.
+ * @own_bus_name: Whether the fake also serves org.freedesktop.systemd1 on the
+ *                session bus.
+ *
+ * Forks a fake systemd and waits until it is ready.
+ *
+ * Returns: A #FakeSystemd to pass to fake_systemd_stop().
+ */
+FakeSystemd *
+fake_systemd_start (const gchar *name,
+                    gboolean     own_bus_name)
+{
+  FakeSystemd *fake;
+  GError      *error = NULL;
+  gchar       *template;
+  gchar        ready;
+  gint         ready_pipe[2];
+
+  g_return_val_if_fail (name != NULL && *name != '\0', NULL);
+
+  fake = g_slice_new0 (FakeSystemd);
+
+  /* the private socket of the fake lives in a temporary directory */
+  template = g_strdup_printf ("%s-XXXXXX", name);
+  fake->directory = g_dir_make_tmp (template, &error);
+  if (fake->directory == NULL)
+    g_error ("Failed to create a temporary directory: %s", error->message);
+  g_free (template);
+  fake->socket_path = g_build_filename (fake->directory, "private", NULL);
+  fake->address = g_strdup_printf ("unix:path=%s", fake->socket_path);
+
+  /* start the fake and wait until it is ready */
+  if (pipe (ready_pipe) != 0)
+    g_error ("Failed to create a pipe");
+  fake->pid = fork ();
+  if (fake->pid < 0)
+    g_error ("Failed to fork the fake systemd");
+  if (fake->pid == 0)
+    {
+      close (ready_pipe[0]);
+      fake_systemd_run (fake->address, own_bus_name, ready_pipe[1]);
+      _exit (EXIT_SUCCESS);
+    }
+  close (ready_pipe[1]);
+  if (read (ready_pipe[0], &ready, 1) != 1)
+    g_error ("The fake systemd failed to start");
+  close (ready_pipe[0]);
+
+  return fake;
+}
+
+
+
+/**
+ * fake_systemd_get_address:
+ * @fake: A #FakeSystemd.
+ *
+ * Returns: The D-Bus address of the private socket of @fake.
+ */
+const gchar *
+fake_systemd_get_address (FakeSystemd *fake)
+{
+  g_return_val_if_fail (fake != NULL, NULL);
+
+  return fake->address;
+}
+
+
+
+/**
+ * fake_systemd_stop:
+ * @fake: A #FakeSystemd.
+ *
+ * Stops the fake systemd, removes its socket and frees @fake.
+ */
+void
+fake_systemd_stop (FakeSystemd *fake)
+{
+  g_return_if_fail (fake != NULL);
+
+  kill (fake->pid, SIGTERM);
+  waitpid (fake->pid, NULL, 0);
+  g_unlink (fake->socket_path);
+  g_rmdir (fake->directory);
+
+  g_free (fake->address);
+  g_free (fake->socket_path);
+  g_free (fake->directory);
+  g_slice_free (FakeSystemd, fake);
+}
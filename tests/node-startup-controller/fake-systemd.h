@@ -0,0 +1,47 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifndef __FAKE_SYSTEMD_H__
+#define __FAKE_SYSTEMD_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* the transient unit the fake refuses to create, like a systemd that does not
+ * support transient targets; it is the target of the LUC type 9 */
+#define FAKE_SYSTEMD_REFUSED_UNIT   "luc-group-9.target"
+
+/* units with this prefix fail to start */
+#define FAKE_SYSTEMD_FAILING_PREFIX "failing-"
+
+/* the "JobRemoved" signal of units with this prefix is emitted before the
+ * reply to their StartUnit call */
+#define FAKE_SYSTEMD_EARLY_PREFIX   "early-"
+
+typedef struct _FakeSystemd FakeSystemd;
+
+FakeSystemd *fake_systemd_start       (const gchar *name,
+                                       gboolean     own_bus_name);
+const gchar *fake_systemd_get_address (FakeSystemd *fake);
+void         fake_systemd_stop        (FakeSystemd *fake);
+
+G_END_DECLS
+
+#endif /* !__FAKE_SYSTEMD_H__ */
@@ -28,6 +28,8 @@
 #include <glib.h>
 #include <gio/gio.h>
 
+#include <node-startup-controller/luc-file.h>
+
 
 
 static void
@@ -49,6 +51,8 @@ main (int    argc,
   GVariant          *variant;
   GError            *error = NULL;
   GFile             *outfile;
+  gchar             *contents;
+  gsize              length;
 
   g_type_init();
 
@@ -79,11 +83,13 @@ main (int    argc,
       g_object_unref (stream);
     }
 
-  g_file_replace_contents (outfile, g_variant_get_data (variant),
-                           g_variant_get_size (variant), NULL, FALSE, G_FILE_CREATE_NONE,
+  /* write the variant in the same format as the Node Startup Controller */
+  contents = luc_file_build (variant, &length);
+  g_file_replace_contents (outfile, contents, length, NULL, FALSE, G_FILE_CREATE_NONE,
                            NULL, NULL, &error);
   if (error != NULL)
     g_error ("Error occurred writing variant: %s", error->message);
+  g_free (contents);
 
   g_variant_unref (variant);
   g_object_unref (outfile);
@@ -0,0 +1,188 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#include <glib.h>
+#include <gio/gio.h>
+
+#include <dlt/dlt.h>
+
+#include <node-startup-controller/job-manager.h>
+#include <node-startup-controller/systemd-manager-dbus.h>
+#include <node-startup-controller/systemd-transport.h>
+
+#include <tests/node-startup-controller/fake-systemd.h>
+
+
+
+/* Measures the time it takes the JobManager to start a unit, from job_manager_start()
+ * until the callback is called, once through the message bus and once through a
+ * private peer-to-peer socket. The fake systemd serves both transports; it answers
+ * every StartUnit call right away and emits the "JobRemoved" signal of the job
+ * immediately afterwards, so the measured time is dominated by the D-Bus transport.
+ * The session bus stands in for the system bus, so the benchmark has to be run inside
+ * a session bus, e.g. with dbus-run-session. */
+
+
+
+#define DEFAULT_N_JOBS 1000
+
+
+
+DLT_DECLARE_CONTEXT (controller_context);
+
+
+
+typedef struct _BenchmarkRun BenchmarkRun;
+
+struct _BenchmarkRun
+{
+  GMainLoop *main_loop;
+  gint64     start_time;
+  gint64    *latencies;
+  guint      n_finished;
+};
+
+
+
+static void
+benchmark_job_finished (JobManager  *manager,
+                        const gchar *unit,
+                        const gchar *result,
+                        GError      *error,
+                        gpointer     user_data)
+{
+  BenchmarkRun *run = user_data;
+
+  if (error != NULL)
+    g_error ("Failed to start %s: %s", unit, error->message);
+
+  run->latencies[run->n_finished++] = g_get_monotonic_time () - run->start_time;
+  g_main_loop_quit (run->main_loop);
+}
+
+
+
+static gint
+benchmark_compare_latencies (gconstpointer a,
+                             gconstpointer b)
+{
+  gint64 latency_a = *(const gint64 *) a;
+  gint64 latency_b = *(const gint64 *) b;
+
+  return latency_a < latency_b ? -1 : (latency_a > latency_b ? 1 : 0);
+}
+
+
+
+static void
+benchmark_run (const gchar    *transport,
+               SystemdManager *systemd_manager,
+               guint           n_jobs)
+{
+  BenchmarkRun run = { 0, };
+  JobManager  *job_manager;
+  GError      *error = NULL;
+  gint64       total = 0;
+  gchar       *unit;
+  guint        n;
+
+  if (!systemd_manager_call_subscribe_sync (systemd_manager, NULL, &error))
+    g_error ("Failed to subscribe through the %s: %s", transport, error->message);
+
+  job_manager =
+    job_manager_new (g_dbus_proxy_get_connection (G_DBUS_PROXY (systemd_manager)),
+                     systemd_manager);
+
+  run.main_loop = g_main_loop_new (NULL, FALSE);
+  run.latencies = g_new0 (gint64, n_jobs);
+
+  /* start the jobs one after another so that each measures a full round trip */
+  for (n = 0; n < n_jobs; n++)
+    {
+      unit = g_strdup_printf ("benchmark-%u.service", n);
+      run.start_time = g_get_monotonic_time ();
+      job_manager_start (job_manager, unit, NULL, NULL, benchmark_job_finished, &run);
+      g_main_loop_run (run.main_loop);
+      g_free (unit);
+    }
+
+  for (n = 0; n < n_jobs; n++)
+    total += run.latencies[n];
+  qsort (run.latencies, n_jobs, sizeof (gint64), benchmark_compare_latencies);
+
+  g_print ("%-16s jobs %u  mean %6" G_GINT64_FORMAT " us  median %6" G_GINT64_FORMAT
+           " us  p95 %6" G_GINT64_FORMAT " us\n",
+           transport, n_jobs, total / n_jobs,
+           run.latencies[n_jobs / 2], run.latencies[n_jobs * 95 / 100]);
+
+  g_free (run.latencies);
+  g_main_loop_unref (run.main_loop);
+  g_object_unref (job_manager);
+}
+
+
+
+int
+main (int    argc,
+      char **argv)
+{
+  SystemdManager *systemd_manager;
+  FakeSystemd    *fake;
+  GError         *error = NULL;
+  guint           n_jobs = DEFAULT_N_JOBS;
+
+  g_type_init ();
+
+  if (argc > 2 || (argc == 2 && (n_jobs = strtoul (argv[1], NULL, 10)) == 0))
+    {
+      g_print ("Usage: \"%s [<number of jobs>]\"\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+
+  /* start the fake systemd on the bus and on its private socket */
+  fake = fake_systemd_start ("systemd-transport-benchmark", TRUE);
+
+  /* measure the bus */
+  systemd_manager = systemd_transport_connect_bus (G_BUS_TYPE_SESSION, &error);
+  if (systemd_manager == NULL)
+    g_error ("Failed to connect through the bus: %s", error->message);
+  benchmark_run ("bus", systemd_manager, n_jobs);
+  g_object_unref (systemd_manager);
+
+  /* measure the private socket */
+  systemd_manager = systemd_transport_connect_private (fake_systemd_get_address (fake),
+                                                       &error);
+  if (systemd_manager == NULL)
+    g_error ("Failed to connect through the private socket: %s", error->message);
+  benchmark_run ("private socket", systemd_manager, n_jobs);
+  g_object_unref (systemd_manager);
+
+  /* stop the fake and clean up */
+  fake_systemd_stop (fake);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,428 @@
+/* vi:set et ai sw=2 sts=2 ts=2: */
+/* SPDX license identifier: MPL-2.0
+ *
+ * Copyright (C) 2012, GENIVI
+ *
+ * This file is part of node-startup-controller.
+ *
+ * This Source Code Form is subject to the terms of the
+ * Mozilla Public License (MPL), v. 2.0.
+ * If a copy of the MPL was not distributed with this file,
+ * You can obtain one at http://mozilla.org/MPL/2.0/.
+ *
+ * For further information see http://www.genivi.org/.
+ *
+ * List of changes:
+ * 2015-04-30, Jonathan Maw, List of changes started
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gio/gio.h>
+
+#include <dlt/dlt.h>
+
+#include <node-startup-controller/job-manager.h>
+#include <node-startup-controller/luc-file.h>
+#include <node-startup-controller/luc-starter.h>
+#include <node-startup-controller/node-startup-controller-service.h>
+#include <node-startup-controller/systemd-manager-dbus.h>
+#include <node-startup-controller/systemd-transport.h>
+
+#include <tests/node-startup-controller/fake-systemd.h>
+
+
+
+/* Tests job_manager_start_transient() and the start of the LUC through transient
+ * targets against the fake systemd, which serves a private peer-to-peer socket so no
+ * message bus is needed. The LUCStarter tests check that a group is finished once the
+ * job of its target and the check of the states of its apps are done, that apps the
+ * target failed to start do not hold up the group, and that the apps are started one
+ * by one if systemd refuses to create the target. The fake, like systemd, ignores the
+ * units a target wants if it is started in an ignore-* job mode, so a group whose
+ * start mode ignores dependencies still has to start its apps. A job whose
+ * "JobRemoved" signal arrives before the reply to its StartUnit call is still
+ * finished and counted as an early removal. */
+
+
+
+#define TEST_LUC_DEADLINE 10
+
+
+
+DLT_DECLARE_CONTEXT (controller_context);
+
+
+
+typedef struct _TestResult TestResult;
+
+struct _TestResult
+{
+  GMainLoop *main_loop;
+  gchar     *result;
+  GError    *error;
+};
+
+
+
+static void
+test_job_finished (JobManager  *manager,
+                   const gchar *unit,
+                   const gchar *result,
+                   GError      *error,
+                   gpointer     user_data)
+{
+  TestResult *test = user_data;
+
+  test->result = g_strdup (result);
+  if (error != NULL)
+    test->error = g_error_copy (error);
+  g_main_loop_quit (test->main_loop);
+}
+
+
+
+static void
+test_start_transient (JobManager         *job_manager,
+                      const gchar        *unit,
+                      const gchar *const *wants,
+                      TestResult         *test)
+{
+  test->main_loop = g_main_loop_new (NULL, FALSE);
+  job_manager_start_transient (job_manager, unit, NULL, wants, NULL,
+                               test_job_finished, test);
+  g_main_loop_run (test->main_loop);
+  g_main_loop_unref (test->main_loop);
+}
+
+
+
+static void
+test_start (JobManager  *job_manager,
+            const gchar *unit,
+            TestResult  *test)
+{
+  test->main_loop = g_main_loop_new (NULL, FALSE);
+  job_manager_start (job_manager, unit, NULL, NULL, test_job_finished, test);
+  g_main_loop_run (test->main_loop);
+  g_main_loop_unref (test->main_loop);
+}
+
+
+
+static void
+test_check_units (JobManager         *job_manager,
+                  const gchar *const *names,
+                  const gchar *const *active_states,
+                  const gchar *const *started_by)
+{
+  SystemdManager *systemd_manager;
+  GVariantIter    iter;
+  const gchar    *description;
+  const gchar    *active_state;
+  GVariant       *units;
+  GError         *error = NULL;
+  guint           n = 0;
+
+  /* the fake reports the unit whose job started a unit as its description */
+  g_object_get (job_manager, "systemd-manager", &systemd_manager, NULL);
+  if (!systemd_manager_call_list_units_by_names_sync (systemd_manager, names, &units,
+                                                      NULL, &error))
+    {
+      g_error ("Failed to list the units: %s", error->message);
+    }
+  g_object_unref (systemd_manager);
+
+  g_variant_iter_init (&iter, units);
+  while (g_variant_iter_next (&iter, "(&s&s&s&s&s&s&ou&s&o)", NULL, &description, NULL,
+                              &active_state, NULL, NULL, NULL, NULL, NULL, NULL))
+    {
+      g_assert_cmpstr (active_state, ==, active_states[n]);
+      g_assert_cmpstr (description, ==, started_by[n]);
+      n++;
+    }
+  g_assert_cmpuint (n, ==, g_strv_length ((gchar **) names));
+  g_variant_unref (units);
+}
+
+
+
+static void
+test_luc_groups_started (LUCStarter *starter,
+                         GMainLoop  *main_loop)
+{
+  g_main_loop_quit (main_loop);
+}
+
+
+
+static gboolean
+test_luc_deadline_expired (gpointer user_data)
+{
+  g_error ("The LUC groups were not started within %u seconds", TEST_LUC_DEADLINE);
+  return FALSE;
+}
+
+
+
+static void
+test_start_luc (JobManager  *job_manager,
+                const gchar *luc,
+                const gchar *start_mode)
+{
+  NodeStartupControllerService *service;
+  SystemdManager               *systemd_manager;
+  GDBusConnection              *connection;
+  LUCStarter                   *starter;
+  GMainLoop                    *main_loop;
+  GVariant                     *context;
+  GError                       *error = NULL;
+  gchar                        *contents;
+  gsize                         length;
+  guint                         deadline_id;
+
+  /* write the LUC in the same format as the Node Startup Controller */
+  context = g_variant_parse (G_VARIANT_TYPE ("a{ias}"), luc, NULL, NULL, &error);
+  if (context == NULL)
+    g_error ("Failed to parse the LUC: %s", error->message);
+  contents = luc_file_build (context, &length);
+  if (!g_file_set_contents (g_getenv ("LUC_PATH"), contents, length, &error))
+    g_error ("Failed to write the LUC: %s", error->message);
+  g_free (contents);
+  g_variant_unref (context);
+
+  g_object_get (job_manager, "systemd-manager", &systemd_manager, NULL);
+  connection = g_dbus_proxy_get_connection (G_DBUS_PROXY (systemd_manager));
+  service = node_startup_controller_service_new (connection);
+  g_object_unref (systemd_manager);
+
+  /* start the groups through transient targets and wait until all of them
+   * have finished starting */
+  starter = luc_starter_new (job_manager, service);
+  g_object_set (starter, "transient-targets", TRUE, "start-mode", start_mode, NULL);
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_signal_connect (starter, "luc-groups-started",
+                    G_CALLBACK (test_luc_groups_started), main_loop);
+  deadline_id =
+    g_timeout_add_seconds (TEST_LUC_DEADLINE, test_luc_deadline_expired, NULL);
+
+  luc_starter_start_groups (starter);
+  g_main_loop_run (main_loop);
+
+  g_source_remove (deadline_id);
+  g_signal_handlers_disconnect_by_func (starter, test_luc_groups_started, main_loop);
+  g_main_loop_unref (main_loop);
+  g_object_unref (starter);
+  g_object_unref (service);
+}
+
+
+
+static void
+test_wanted_units_started (JobManager *job_manager)
+{
+  const gchar *wants[] = { "app1.service", "app2.service", "app3.service", NULL };
+  const gchar *names[] = { "app1.service", "app2.service", "app3.service",
+                           "other.service", NULL };
+  const gchar *active_states[] = { "active", "active", "active", "inactive" };
+  const gchar *started_by[] = { "test-group.target", "test-group.target",
+                                "test-group.target", "" };
+  TestResult   test = { 0, };
+
+  test_start_transient (job_manager, "test-group.target", wants, &test);
+  g_assert_no_error (test.error);
+  g_assert_cmpstr (test.result, ==, "done");
+  g_free (test.result);
+
+  /* only the wanted units have been started */
+  test_check_units (job_manager, names, active_states, started_by);
+
+  g_print ("Transient target starts the wanted units: passed\n");
+}
+
+
+
+static void
+test_refused_target (JobManager *job_manager)
+{
+  const gchar *wants[] = { "app4.service", NULL };
+  TestResult   test = { 0, };
+
+  test_start_transient (job_manager, FAKE_SYSTEMD_REFUSED_UNIT, wants, &test);
+  g_assert (test.error != NULL);
+  g_assert_cmpstr (test.result, ==, "failed");
+  g_error_free (test.error);
+  g_free (test.result);
+
+  g_print ("Refused transient target fails with an error: passed\n");
+}
+
+
+
+static void
+test_early_removal (JobManager *job_manager)
+{
+  TestResult test = { 0, };
+  guint64    early_removals;
+  guint64    n_early_removals;
+
+  g_object_get (job_manager, "early-removals", &early_removals, NULL);
+
+  /* the job is finished with the result of the buffered "JobRemoved" signal
+   * once its name is known */
+  test_start (job_manager, FAKE_SYSTEMD_EARLY_PREFIX "app15.service", &test);
+  g_assert_no_error (test.error);
+  g_assert_cmpstr (test.result, ==, "done");
+  g_free (test.result);
+
+  g_object_get (job_manager, "early-removals", &n_early_removals, NULL);
+  g_assert_cmpuint (n_early_removals, ==, early_removals + 1);
+
+  g_print ("Job removed before its start call returned is finished: passed\n");
+}
+
+
+
+static void
+test_luc_target_finished (JobManager *job_manager)
+{
+  const gchar *names[] = { "app5.service", "app6.service", "app7.service", NULL };
+  const gchar *active_states[] = { "active", "active", "active" };
+  const gchar *started_by[] = { "luc-group-1.target", "luc-group-1.target",
+                                "luc-group-2.target" };
+
+  /* every group is started through its own target */
+  test_start_luc (job_manager,
+                  "{1: ['app5.service', 'app6.service'], 2: ['app7.service']}",
+                  NULL);
+  test_check_units (job_manager, names, active_states, started_by);
+
+  g_print ("LUC groups are finished through their transient targets: passed\n");
+}
+
+
+
+static void
+test_luc_inactive_units (JobManager *job_manager)
+{
+  const gchar *names[] = { "app8.service", FAKE_SYSTEMD_FAILING_PREFIX "app9.service",
+                           NULL };
+  const gchar *active_states[] = { "active", "failed" };
+  const gchar *started_by[] = { "luc-group-3.target", "luc-group-3.target" };
+
+  /* the group is finished although the target failed to start one of its
+   * apps, and the app is not started once more on its own */
+  test_start_luc (job_manager,
+                  "{3: ['app8.service', '" FAKE_SYSTEMD_FAILING_PREFIX "app9.service']}",
+                  NULL);
+  test_check_units (job_manager, names, active_states, started_by);
+
+  g_print ("LUC group with apps its target failed to start is finished: passed\n");
+}
+
+
+
+static void
+test_luc_refused_target (JobManager *job_manager)
+{
+  const gchar *names[] = { "app10.service", "app11.service", "app12.service", NULL };
+  const gchar *active_states[] = { "active", "active", "active" };
+  const gchar *started_by[] = { "app10.service", "app11.service", "app12.service" };
+
+  /* the target of type 9 is refused, so its apps and the apps of all further
+   * groups are started one by one */
+  test_start_luc (job_manager,
+                  "{9: ['app10.service', 'app11.service'], 10: ['app12.service']}",
+                  NULL);
+  test_check_units (job_manager, names, active_states, started_by);
+
+  g_print ("LUC apps are started one by one if the target is refused: passed\n");
+}
+
+
+
+static void
+test_luc_ignore_dependencies (JobManager *job_manager)
+{
+  const gchar *names[] = { "app13.service", "app14.service", NULL };
+  const gchar *active_states[] = { "active", "active" };
+  const gchar *started_by[] = { "luc-group-4.target", "luc-group-4.target" };
+
+  /* the apps are started with a mode that ignores dependencies, which the
+   * target itself must not use or its apps would not be started */
+  test_start_luc (job_manager, "{4: ['app13.service', 'app14.service']}",
+                  "ignore-dependencies");
+  test_check_units (job_manager, names, active_states, started_by);
+
+  g_print ("LUC group with an ignore-dependencies start mode starts its apps: passed\n");
+}
+
+
+
+int
+main (int    argc,
+      char **argv)
+{
+  SystemdManager *systemd_manager;
+  FakeSystemd    *fake;
+  JobManager     *job_manager;
+  GError         *error = NULL;
+  gchar          *directory;
+  gchar          *luc_path;
+  gchar          *backup_path;
+
+  g_type_init ();
+
+  /* the LUC of the LUCStarter tests lives in a temporary directory */
+  directory = g_dir_make_tmp ("transient-target-test-XXXXXX", &error);
+  if (directory == NULL)
+    g_error ("Failed to create a temporary directory: %s", error->message);
+  luc_path = g_build_filename (directory, "last-user-context", NULL);
+  backup_path = g_strconcat (luc_path, "~", NULL);
+  g_setenv ("LUC_PATH", luc_path, TRUE);
+
+  fake = fake_systemd_start ("transient-target-test", FALSE);
+
+  systemd_manager = systemd_transport_connect_private (fake_systemd_get_address (fake),
+                                                       &error);
+  if (systemd_manager == NULL)
+    g_error ("Failed to connect to the fake systemd: %s", error->message);
+  if (!systemd_manager_call_subscribe_sync (systemd_manager, NULL, &error))
+    g_error ("Failed to subscribe to the fake systemd: %s", error->message);
+
+  job_manager =
+    job_manager_new (g_dbus_proxy_get_connection (G_DBUS_PROXY (systemd_manager)),
+                     systemd_manager);
+
+  test_wanted_units_started (job_manager);
+  test_refused_target (job_manager);
+  test_early_removal (job_manager);
+  test_luc_target_finished (job_manager);
+  test_luc_inactive_units (job_manager);
+  test_luc_ignore_dependencies (job_manager);
+  test_luc_refused_target (job_manager);
+
+  g_object_unref (job_manager);
+  g_object_unref (systemd_manager);
+
+  /* stop the fake and clean up */
+  fake_systemd_stop (fake);
+  g_unlink (luc_path);
+  g_unlink (backup_path);
+  g_rmdir (directory);
+  g_free (backup_path);
+  g_free (luc_path);
+  g_free (directory);
+
+  return EXIT_SUCCESS;
+}